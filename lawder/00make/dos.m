@@ -68,8 +68,8 @@ COMPILER2    =  gxx
 #~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 
 OBJECTS1	=	btree.o utils.o test5.o
-OBJECTS2	=	btree.o db.o buffer.o page.o hilbert.o utils.o test2.o
-DEMO_OBJ	=	btree.o db.o buffer.o page.o query.o hilbert.o utils.o demo.o
+OBJECTS2	=	btree.o db.o buffer.o page.o hilbert.o morton.o curve.o utils.o test2.o
+DEMO_OBJ	=	btree.o db.o buffer.o page.o query.o columns.o hilbert.o morton.o curve.o utils.o demo.o
 OBJECTSj	=	db.o buffer.o page.o utils.o testj.o
 
 #~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
@@ -128,8 +128,17 @@ page.o:		$(ROOT_DIR)gendefs.h $(D_DIR)db.h $(D_DIR)page.h \
 query.o:	$(ROOT_DIR)gendefs.h $(D_DIR)db.h $(D_DIR)query.cc
 		$(COMPILER) $(O_FLAGS) $(D_DIR)query.cc
 
+columns.o:	$(ROOT_DIR)gendefs.h $(D_DIR)columns.h $(D_DIR)columns.cc
+		$(COMPILER) $(O_FLAGS) $(D_DIR)columns.cc
+
 hilbert.o:	$(ROOT_DIR)gendefs.h $(U_DIR)utils.h $(H_DIR)hilbert.cc
 		$(COMPILER) $(O_FLAGS) $(H_DIR)hilbert.cc
 
+morton.o:	$(ROOT_DIR)gendefs.h $(U_DIR)utils.h $(H_DIR)morton.cc
+		$(COMPILER) $(O_FLAGS) $(H_DIR)morton.cc
+
+curve.o:	$(ROOT_DIR)gendefs.h $(H_DIR)curve.cc
+		$(COMPILER) $(O_FLAGS) $(H_DIR)curve.cc
+
 utils.o:	$(ROOT_DIR)gendefs.h $(U_DIR)utils.cc
 		$(COMPILER) $(O_FLAGS) $(U_DIR)utils.cc
\ No newline at end of file
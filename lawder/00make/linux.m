@@ -7,6 +7,7 @@ TARGET1		=	a.out
 TARGET2		= 	b.exe
 DEMO		=	demo.exe
 SERF_DRIVER = 	serf_driver.exe
+HILBERT_BENCH =	hilbert_bench.exe
 #..............................................................................
 #		IF FDL NOT ENABLED			FDLFDLFDLFDLFDL!!!!!!!!
 #..............................................................................
@@ -51,8 +52,9 @@ COMPILER2	=	g++
 #~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 #OBJECTS1	=	btree.o utils.o test5.o
 #OBJECTS2	=	btree.o db.o buffer.o page.o hilbert.o utils.o test2.o
-DEMO_OBJ	=	btree.o db.o buffer.o page.o query.o hilbert.o utils.o demo.o
-SERF_OBJ    = 	btree.o db.o buffer.o page.o query.o hilbert.o utils.o serf_driver.o
+DEMO_OBJ	=	btree.o db.o buffer.o page.o query.o columns.o hilbert.o morton.o curve.o utils.o demo.o
+SERF_OBJ    = 	btree.o db.o buffer.o page.o query.o columns.o hilbert.o morton.o curve.o utils.o serf_driver.o
+BENCH_OBJ   =	hilbert.o morton.o curve.o utils.o hilbert_bench.o
 #OBJECTSj	=	db.o buffer.o page.o utils.o testj.o
 #~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 #		TARGET DEFINITIONS
@@ -66,10 +68,12 @@ $(DEMO):	$(DEMO_OBJ)
 		$(COMPILER2) $(T_FLAGS) $(DEMO) $(DEMO_OBJ)
 $(SERF_DRIVER): $(SERF_OBJ)
 		$(COMPILER2) $(T_FLAGS) $(SERF_DRIVER) $(SERF_OBJ)
+$(HILBERT_BENCH): $(BENCH_OBJ)
+		$(COMPILER2) $(T_FLAGS) $(HILBERT_BENCH) $(BENCH_OBJ)
 #$(TARGETj):	$(OBJECTSj)
 #		$(COMPILER2) $(T_FLAGS) $(TARGETj) $(OBJECTSj)
 #All:$(TARGET1) $(TARGET2)
-All:$(DEMO) $(SERF_DRIVER)
+All:$(DEMO) $(SERF_DRIVER) $(HILBERT_BENCH)
 #~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 #		DEPENDENCIES
 #~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
@@ -83,14 +87,18 @@ All:$(DEMO) $(SERF_DRIVER)
 #		$(COMPILER) $(O_FLAGS) $(T_DIR)test2.cc
 #
 demo.o:		$(ROOT_DIR)gendefs.h $(B_DIR)btree.h $(U_DIR)utils.h \
-		$(D_DIR)db.h $(D_DIR)buffer.h $(D_DIR)page.h \
+		$(D_DIR)db.h $(D_DIR)buffer.h $(D_DIR)page.h $(H_DIR)hilbert.h $(H_DIR)curve.h \
 		$(T_DIR)demo.cc
 		$(COMPILER) $(O_FLAGS) $(T_DIR)demo.cc
 
 serf_driver.o:	$(ROOT_DIR)gendefs.h $(B_DIR)btree.h $(U_DIR)utils.h \
-		$(D_DIR)db.h $(D_DIR)buffer.h $(D_DIR)page.h \
+		$(D_DIR)db.h $(D_DIR)buffer.h $(D_DIR)page.h $(H_DIR)hilbert.h $(H_DIR)curve.h \
 		$(T_DIR)serf_driver.cc
 		$(COMPILER) $(O_FLAGS) $(T_DIR)serf_driver.cc
+
+hilbert_bench.o:	$(ROOT_DIR)gendefs.h $(H_DIR)hilbert.h $(H_DIR)curve.h \
+		$(T_DIR)hilbert_bench.cc
+		$(COMPILER) $(O_FLAGS) $(T_DIR)hilbert_bench.cc
 #
 #testj.o:	$(ROOT_DIR)gendefs.h $(U_DIR)utils.h \
 #		$(D_DIR)db.h buffer.h page.h \
@@ -101,22 +109,36 @@ btree.o:	$(ROOT_DIR)gendefs.h $(B_DIR)btree.h $(U_DIR)utils.h \
 		$(B_DIR)btree.cc
 		$(COMPILER) $(O_FLAGS) $(B_DIR)btree.cc
 #
-db.o:		$(ROOT_DIR)gendefs.h $(B_DIR)btree.h $(D_DIR)db.h $(D_DIR)db.cc
+db.o:		$(ROOT_DIR)gendefs.h $(B_DIR)btree.h $(D_DIR)db.h $(H_DIR)hilbert.h $(H_DIR)curve.h \
+		$(D_DIR)db.cc
 		$(COMPILER) $(O_FLAGS) $(D_DIR)db.cc
 #
-buffer.o:	$(ROOT_DIR)gendefs.h $(D_DIR)db.h $(D_DIR)buffer.h \
+buffer.o:	$(ROOT_DIR)gendefs.h $(D_DIR)db.h $(H_DIR)hilbert.h $(H_DIR)curve.h $(D_DIR)buffer.h \
 		$(D_DIR)page.h $(D_DIR)buffer.cc
 		$(COMPILER) $(O_FLAGS) $(D_DIR)buffer.cc
 #
-page.o:		$(ROOT_DIR)gendefs.h $(D_DIR)db.h $(D_DIR)page.h \
+page.o:		$(ROOT_DIR)gendefs.h $(D_DIR)db.h $(H_DIR)hilbert.h $(H_DIR)curve.h $(D_DIR)page.h \
 		$(D_DIR)page.cc
 		$(COMPILER) $(O_FLAGS) $(D_DIR)page.cc
 #
-query.o:	$(ROOT_DIR)gendefs.h $(D_DIR)db.h $(D_DIR)query.cc
+query.o:	$(ROOT_DIR)gendefs.h $(D_DIR)db.h $(H_DIR)hilbert.h $(H_DIR)curve.h $(U_DIR)utils.h \
+		$(D_DIR)columns.h $(D_DIR)query.cc
 		$(COMPILER) $(O_FLAGS) $(D_DIR)query.cc
 #
-hilbert.o:	$(ROOT_DIR)gendefs.h $(U_DIR)utils.h $(H_DIR)hilbert.cc
+columns.o:	$(ROOT_DIR)gendefs.h $(D_DIR)columns.h $(D_DIR)columns.cc
+		$(COMPILER) $(O_FLAGS) $(D_DIR)columns.cc
+#
+hilbert.o:	$(ROOT_DIR)gendefs.h $(U_DIR)utils.h $(H_DIR)hilbert.h \
+		$(H_DIR)hilbert.cc
 		$(COMPILER) $(O_FLAGS) $(H_DIR)hilbert.cc
 #
-utils.o:	$(ROOT_DIR)gendefs.h $(U_DIR)utils.cc
+morton.o:	$(ROOT_DIR)gendefs.h $(U_DIR)utils.h $(H_DIR)hilbert.h $(H_DIR)morton.h \
+		$(H_DIR)morton.cc
+		$(COMPILER) $(O_FLAGS) $(H_DIR)morton.cc
+#
+curve.o:	$(ROOT_DIR)gendefs.h $(H_DIR)hilbert.h $(H_DIR)morton.h $(H_DIR)curve.h \
+		$(H_DIR)curve.cc
+		$(COMPILER) $(O_FLAGS) $(H_DIR)curve.cc
+#
+utils.o:	$(ROOT_DIR)gendefs.h $(U_DIR)utils.h $(U_DIR)utils.cc
 		$(COMPILER) $(O_FLAGS) $(U_DIR)utils.cc
@@ -3,11 +3,18 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <iomanip>
+#include <vector>
+#include <algorithm>
 #include "btree.h"
 #ifdef __MSDOS__
 	#include "..\utils\utils.h"
 #else
 	#include "../utils/utils.h"
+	#define BT_MMAP
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <fcntl.h>
+	#include <unistd.h>
 #endif
 
 
@@ -20,13 +27,20 @@
 /*============================================================================*/
 /*                            BTnode::BTnode	                      	      */
 /*============================================================================*/
-// constructor
-BTnode::BTnode( int dims, int n_entries ) {
+// constructor: an inner node has room for owner->inner_entries entries
+BTnode::BTnode( int kwords, int n_entries, BTree *owner, bool inner ) {
 
-	dimensions = dims;
+	tree = owner;
+	flat_no = 0;
+	dirty = false;
+	key_words = kwords;
 	node_entries = n_entries;
-	node_entry_size = sizeof(U_int) * dimensions + sizeof(X);
-	int raw_data_bytes = node_entries * node_entry_size;
+	node_entry_size = BTnode::idxi_entry_size( key_words );
+	int slots = inner ? owner->inner_entries : node_entries;
+	// the header takes a whole no. of X's so that the X's are aligned
+	int hdr_bytes = (sizeof(BTnodehdr) + sizeof(X) - 1) / sizeof(X) * sizeof(X);
+	int raw_data_bytes = hdr_bytes + slots * sizeof(X) +
+		slots * sizeof(U_int) * (key_words + (key_words > 1 ? 1 : 0));
 
 	// the data block that makes up a node (excluding parent pointer)
 /*	raw_data = (unsigned char*)malloc( node_entries * node_entry_size );*/
@@ -34,40 +48,241 @@ BTnode::BTnode( int dims, int n_entries ) {
 	// initialise the raw_data
 	memset( raw_data, '\0', raw_data_bytes );
 
-	// the array of pointers to keys in a node
-/*	Hkey = (U_int**)malloc(sizeof(U_int*) * node_entries);*/
-//	Hkey = new (U_int*)[sizeof(U_int*) * node_entries];
-	Hkey = new U_int*[node_entries];
-
-	// the array of pointers to lpage (downptr) associated with a leaf (inner)
-/*	XX = (X**)malloc(sizeof(X*) * node_entries);*/
-//	XX = new (X*)[sizeof(X*) * node_entries];
-	XX = new X*[node_entries];
-
-	// setup the pointers into raw_data
-	// the number of U_ints in a node entry is dim + 1
-	// NB Hkey[0] and XX[0] are not used; they overlap with the BTnodehdr
-	// NB the BTnodehdr 'occupies' the same amount of space as a <Hkey,XX>
+	// the columns of the entries follow the header: the lpages (downptrs)
+	// associated with a leaf (inner), the keys, then their leading U_ints,
+	// unless they are the keys themselves
 	btnodehdr = (BTnodehdr*)raw_data;
-	for ( int i = 0; i < node_entries; i++ )
-	{
-		// Hkeys come before XX's in a node entry
-		Hkey[i] = (U_int*)raw_data + i * (dimensions + 1);
-		XX[i] = (X*)raw_data + i * (dimensions + 1) + dimensions;
-	}
+	XX.at = (X*)(raw_data + hdr_bytes);
+	XX.stride = 1;
+	Hkey.at = (U_int*)(XX.at + slots);
+	Hkey.stride = key_words;
+	lead = key_words > 1 ? Hkey.at + slots * key_words : Hkey.at;
 };
 
+/*============================================================================*/
+/*                            BTnode::idxi_entry_size	                      	      */
+/*============================================================================*/
+// the no. of bytes in a node element in the .idx file: a key followed by an X,
+// padded so that the X is aligned. Entry 0 holds the BTnodehdr so must be
+// large enough.
+int BTnode::idxi_entry_size( int kwords )
+{
+	int size = sizeof(U_int) * kwords;
+
+	size = (size + sizeof(X) - 1) / sizeof(X) * sizeof(X) + sizeof(X);
+	if (size < (int)sizeof(BTnodehdr))
+		size = (sizeof(BTnodehdr) + sizeof(X) - 1) / sizeof(X) * sizeof(X);
+	return size;
+}
+
 /*============================================================================*/
 /*                            BTnode::~BTnode	                          	      */
 /*============================================================================*/
 // destructor
 BTnode::~BTnode() {
 //	delete btnodehdr; not needed; this just points into 'data'
-	delete [] Hkey;
-	delete [] XX;
 	delete [] raw_data;
 }
 
+/*============================================================================*/
+/*                            idxi_touch				      */
+/*============================================================================*/
+// notes that the node has changed since it was written to the .idx file
+void BTnode::idxi_touch()
+{
+	if (dirty)
+		return;
+	dirty = true;
+	tree->dirty.insert( this );
+}
+
+/*============================================================================*/
+/*                            idxi_set_key				      */
+/*============================================================================*/
+// puts 'key' in 'slot' (along with its leading U_int)
+void BTnode::idxi_set_key( int slot, const HU_int *key )
+{
+	idxi_touch();
+	keycopy( Hkey[slot], key, key_words );
+	lead[slot] = key[key_words - 1];
+}
+
+/*============================================================================*/
+/*                            idxi_move_entries				      */
+/*============================================================================*/
+// moves 'n' entries (keys with their lpages or downptrs) from slot 'from' of
+// 'from_node' to slot 'to' of this node; they may overlap. Both nodes are
+// taken to have changed, as their sizes are about to.
+void BTnode::idxi_move_entries( int to, BTnode *from_node, int from, int n )
+{
+	idxi_touch();
+	from_node->idxi_touch();
+	if (n <= 0)
+		return;
+	memmove( XX[to], from_node->XX[from], sizeof(X) * n );
+	memmove( Hkey[to], from_node->Hkey[from], sizeof(U_int) * key_words * n );
+	if (key_words > 1)
+		memmove( lead + to, from_node->lead + from, sizeof(U_int) * n );
+}
+
+/*============================================================================*/
+/*                            idxi_from_file				      */
+/*============================================================================*/
+// sets the node up from 'entries', laid out as in an old .idx file
+void BTnode::idxi_from_file( const unsigned char *entries )
+{
+	memcpy( btnodehdr, entries, sizeof(BTnodehdr) );
+	for ( int i = 1; i < node_entries; i++ )
+	{
+		idxi_set_key( i, (const U_int*)(entries + i * node_entry_size) );
+		memcpy( XX[i], entries + (i + 1) * node_entry_size - sizeof(X), sizeof(X) );
+	}
+}
+
+/*============================================================================*/
+/*                            BT_count_below				      */
+/*============================================================================*/
+/* idxi_find_slot() first counts the keys in a node whose leading U_ints are
+   lower than that of the key sought. Since they are in order, this is where
+   a binary search of them would end; it is only carried on until a few
+   entries are left, which are counted several at a time (4 with SSE2, 8 with
+   AVX2), so that the last steps need no branches to be mispredicted. As
+   with the other SIMD code, that code is compiled for the instruction set
+   regardless of the compiler flags and only called when the CPU is found to
+   support it at run time. */
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+	#define BT_SIMD
+	#include <immintrin.h>
+#endif
+
+#ifdef BT_SIMD
+// returns the no. of the first 'done' U_ints that are below k
+__attribute__((target("sse2")))
+static int BT_count_below_sse2( const U_int *lead, int n, U_int k, int *done )
+{
+	// unsigned comparison as signed, having flipped the top bits
+	const __m128i	flip = _mm_set1_epi32( (int)0x80000000 );
+	__m128i		key = _mm_xor_si128( _mm_set1_epi32( (int)k ), flip ), x;
+	int		i, mask, count = 0;
+
+	for (i = 0; i + 4 <= n; i += 4)
+	{
+		x = _mm_xor_si128( _mm_loadu_si128( (const __m128i*)(lead + i) ), flip );
+		mask = _mm_movemask_ps( _mm_castsi128_ps( _mm_cmplt_epi32( x, key ) ) );
+		count += __builtin_popcount( mask );
+		if (mask != 0xf)	// the rest aren't below k
+		{
+			*done = n;
+			return count;
+		}
+	}
+	*done = i;
+	return count;
+}
+
+// returns the no. of the first 'done' U_ints that are below k
+__attribute__((target("avx2")))
+static int BT_count_below_avx2( const U_int *lead, int n, U_int k, int *done )
+{
+	const __m256i	flip = _mm256_set1_epi32( (int)0x80000000 );
+	__m256i		key = _mm256_xor_si256( _mm256_set1_epi32( (int)k ), flip ), x;
+	int		i, mask, count = 0;
+
+	for (i = 0; i + 8 <= n; i += 8)
+	{
+		x = _mm256_xor_si256( _mm256_loadu_si256( (const __m256i*)(lead + i) ), flip );
+		mask = _mm256_movemask_ps( _mm256_castsi256_ps( _mm256_cmpgt_epi32( key, x ) ) );
+		count += __builtin_popcount( mask );
+		if (mask != 0xff)	// the rest aren't below k
+		{
+			*done = n;
+			return count;
+		}
+	}
+	*done = i;
+	return count;
+}
+#endif
+
+// entries whose leading U_ints are counted, rather than binary searched
+#define BT_SEARCH_RUN	32
+
+// the no. of the 'n' U_ints, in ascending order, that are below k
+static int BT_count_below( const U_int *lead, int n, U_int k )
+{
+	int	done = 0, count = 0;
+
+#ifdef BT_SIMD
+	static const bool avx2 = __builtin_cpu_supports( "avx2" );
+
+	if (avx2)
+		count = BT_count_below_avx2( lead, n, k, &done );
+	else
+		count = BT_count_below_sse2( lead, n, k, &done );
+#endif
+	for (; done < n && lead[done] < k; done++)
+		count++;
+	return count;
+}
+
+/*============================================================================*/
+/*                            BT_find_slot					      */
+/*============================================================================*/
+// idxi_find_slot() for a node whose keys and their leading U_ints are
+// 'keys' and 'lead' (these may be in the flat index file)
+static int BT_find_slot( const U_int *lead, const U_int *keys, int key_words,
+		int size, const HU_int *key )
+{
+	int		low = 0, high = size, mid, below, i;
+	U_int	k = key[key_words - 1];
+
+	// narrow down, by leading U_int, to a few entries and count those below
+	while (high - low > BT_SEARCH_RUN)
+	{
+		mid = (high + low) / 2;
+		if (lead[mid + 1] < k)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+	below = low + BT_count_below( lead + 1 + low, high - low, k );
+
+	// the entries after 'below' with the same leading U_int decide it
+	for (i = below + 1; i <= size && lead[i] == k; i++)
+	{
+		int j = keycmp( key, keys + i * key_words, key_words );
+		if (j == 0)        /* they are equal */
+			return i;
+		if (j < 0)         /* key is lower */
+			break;
+		below = i;
+	}
+	/* key not found - return the next lower key's element as a negative no */
+	return -below;
+}
+
+/*============================================================================*/
+/*                            BT_separator				      */
+/*============================================================================*/
+/* The key in an inner node that leads to a child needn't be the lowest key
+   under it, only above every key under the child before it: 'sep' is set
+   to the key above 'low' and not above 'high' that has the most least
+   significant words 0 - 'high' with the words below the first one in which
+   they differ cleared - since those aren't held in the .idx file (see
+   BTree::idxi_trim()). A search for a key between 'sep' and 'high' is led
+   past the page it belongs to (see BTree::idxi_search_leaf()). */
+static void BT_separator( const HU_int *low, const HU_int *high, HU_int *sep,
+		int key_words )
+{
+	int	i;
+
+	for (i = key_words - 1; i > 0 && low[i] == high[i]; i--)
+		;
+	memset( sep, 0, sizeof(U_int) * i );
+	memcpy( sep + i, high + i, sizeof(U_int) * (key_words - i) );
+}
+
 /*============================================================================*/
 /*                            idxi_find_slot				      */
 /*============================================================================*/
@@ -86,46 +301,13 @@ BTnode::~BTnode() {
 */
 int BTnode::idxi_find_slot( HU_int *key )
 {
-	int		mid, i, j, low = 1, high = btnodehdr->size;
-	HU_int	*entry, *helement;	// no memory allocation needed
 #ifdef JKLDEBUGxxx
-	cout << "idxi_find_slot : high = " << high << " btnodehdr->size = " << btnodehdr->size ;
+	cout << "idxi_find_slot : btnodehdr->size = " << btnodehdr->size ;
 	if (in_HDR->flags & isROOT) cout << " - root\n"; else cout << " - not root\n";
 #endif
-	if (high < low)
+	if (btnodehdr->size < 1)
 		errorexit("ERROR in BTnode::idxi_find_slot()\n");
-
-	while (high >= low)
-	{
-		mid = (high + low) / 2;
-// CHECK CHECK CHECK !!! - just say 'helement = Hkey[mid]' ????
-		entry = Hkey[mid];	// point at an entry in the node
-		helement = entry;	// point at the first U_int in an entry
-#ifdef JKLDEBUGxxx
-	cout << "..." << *helement << "...\n";
-#endif
-		for (j = 0, i = dimensions - 1; i >= 0; i--)
-		{
-			if (key[i] == helement[i])
-				continue;
-			if (key[i] < helement[i])
-			{	j = -1; break;} /* a < b */
-			else
-			{	j = 1; break;}  /* a > b */
-		}
-		if (j == 0)        /* they are equal */
-			return mid;
-		if (j == -1)         /* key is lower */
-			high = mid - 1;
-		else
-			low = mid + 1;
-	}
-	/* key not found - return the next lower key's element as a negative no */
-	if (j == -1)
-		mid--;
-	if (mid > 0)
-		mid *= -1;
-	return mid;
+	return BT_find_slot( lead, Hkey.at, key_words, btnodehdr->size, key );
 }
 
 /*============================================================================*/
@@ -206,7 +388,7 @@ int BTnode::idxi_find_prev( HU_int *key, int lpage, BTnode *left )
 // called by the left node
 int BTnode::idxi_merge_nodes( BTnode *right )
 {
-	int i, nbytes, nobj, slot, isleaf;
+	int i, nobj, slot, isleaf;
 	BTnode *Parent;
 	HU_int *key;	// no memory allocation needed
 
@@ -222,23 +404,22 @@ int BTnode::idxi_merge_nodes( BTnode *right )
 
 	// remove entry for right node from parent
 	key = right->Hkey[1];
-	// find slot for right node in parent
+	// find slot for right node in parent (its key there needn't be 'key')
 	slot = Parent->idxi_find_slot( key );
-	if (!isleaf)
+	if (slot < 0)
 		slot *= -1;
 	if (slot < 1 || slot > Parent->in_HDR->size)
 		errorexit("ERROR 4 in idxi_merge_nodes(): lowest key in (right "
 				  "hand)\nnode to be merged not compatible with parent\n");
 
 	if (!isleaf) /* fill in key in first free slot in left */
-		keycopy ( Hkey[in_HDR->size + 1], Parent->Hkey[slot], dimensions );
+		idxi_set_key( in_HDR->size + 1, Parent->Hkey[slot] );
 //		left->X.ientry[left->X.in.size + 1].Hkey =
 //			parent->X.ientry[slot].Hkey;
 /*		BT->keycopy(&left->X.ientry[left->X.in.size + 1].Hkey,
 			&parent->X.ientry[slot].Hkey);*/
 	/* do the deletion in parent */
-	nbytes = (Parent->in_HDR->size - slot) * node_entry_size;
-	memmove( Parent->Hkey[slot], Parent->Hkey[slot + 1], nbytes );
+	Parent->idxi_move_entries( slot, Parent, slot + 1, Parent->in_HDR->size - slot );
 /*	memset(&parent->X.lentry[parent->X.lf.size], NULL, sizeof (innerENTRY));*/
 	Parent->lf_HDR->size--;
 
@@ -246,8 +427,7 @@ int BTnode::idxi_merge_nodes( BTnode *right )
 	nobj = right->in_HDR->size;
 	if (isleaf)
 	{
-		nbytes = nobj * node_entry_size;
-		memcpy( Hkey[lf_HDR->size + 1], right->Hkey[1], nbytes);
+		idxi_move_entries( lf_HDR->size + 1, right, 1, nobj );
 		lf_HDR->nextptr = right->lf_HDR->nextptr;
 		lf_HDR->size += nobj;
 	}
@@ -259,12 +439,11 @@ int BTnode::idxi_merge_nodes( BTnode *right )
 		for ( i = 1; i <= right->in_HDR->size; i++)
 			right->in_ENTRY[i]->downptr->in_HDR->parent = this;
 
-		nbytes = nobj * node_entry_size;
-		memcpy( Hkey[in_HDR->size + 2], right->Hkey[1], nbytes );
+		idxi_move_entries( in_HDR->size + 2, right, 1, nobj );
 		in_HDR->size += nobj + 1;
 	}
 
-	delete right;
+	tree->idxi_discard( right );
 	return 1;
 }
 
@@ -275,8 +454,9 @@ int BTnode::idxi_merge_nodes( BTnode *right )
 // right is the implied parameter
 int BTnode::idxi_shift_from_left( BTnode *left, BTnode *anchor )
 {
-	int i, slot, isleaf, lsize, rsize, numtomove, nbytes;
+	int i, slot, isleaf, lsize, rsize, numtomove;
 	HU_int *key;	// no memory allocation needed
+	HU_int sep[HKEY_MAX_WORDS];
 
 	if (!(left && this && anchor))
 		errorexit("ERROR 1 in idxi_shift_from_left(): at least one required "
@@ -297,22 +477,23 @@ int BTnode::idxi_shift_from_left( BTnode *left, BTnode *anchor )
 
 		key = Hkey[1];
 		slot = anchor->idxi_find_slot( key );
+		if (slot < 0)
+			slot *= -1;
 		if (slot < 1 || slot > anchor->in_HDR->size)
 			errorexit("ERROR 3 in idxi_shift_from_left(): lowest key in "
 					  "right hand node not\ncompatible with anchor node\n");
 		/* move all entries in right up to make room for left's values */
-		nbytes = node_entry_size * rsize;
-		memmove( Hkey[numtomove + 1],  Hkey[1], nbytes );
+		idxi_move_entries( numtomove + 1, this, 1, rsize );
 		/* move elements from left node to right */
-		nbytes = node_entry_size * numtomove;
-		memcpy( Hkey[1], left->Hkey[lsize - numtomove + 1], nbytes );
+		idxi_move_entries( 1, left, lsize - numtomove + 1, numtomove );
 /*		memset(&left->X.lentry[lsize - numtomove + 1], NULL, nbytes);*/
-		/* adjust anchor key value */
-		keycopy ( anchor->Hkey[slot], Hkey[1], dimensions );
-/*		BT->keycopy(&anchor->X.ientry[slot].Hkey, &right->X.lentry[1].Hkey);*/
 		/* adjust sizes */
 		left->lf_HDR->size -= numtomove;
 		lf_HDR->size += numtomove;
+		/* adjust anchor key value */
+		BT_separator( left->Hkey[left->lf_HDR->size], Hkey[1], sep, key_words );
+		anchor->idxi_set_key( slot, sep );
+/*		BT->keycopy(&anchor->X.ientry[slot].Hkey, &right->X.lentry[1].Hkey);*/
 	}
 	else
 	{
@@ -324,29 +505,27 @@ int BTnode::idxi_shift_from_left( BTnode *left, BTnode *anchor )
 		numtomove = (lsize - in_minFANOUT - 1) / 2;
 		key = Hkey[1];
 		slot = anchor->idxi_find_slot( key );
-		slot *= -1;
+		if (slot < 0)
+			slot *= -1;
 		if (slot < 1 || slot > anchor->in_HDR->size)
 			errorexit("ERROR 5 in idxi_shift_from_left(): lowest key in "
 					  "right hand node not\ncompatible with anchor node\n");
 		/* 1 move right entries to position numtomove + 2 */
-		nbytes = node_entry_size * rsize;
-		memmove( Hkey[numtomove + 2], Hkey[1], nbytes);
+		idxi_move_entries( numtomove + 2, this, 1, rsize );
 		/* 2 move anchor value to right node */
-		keycopy ( Hkey[numtomove + 1], anchor->Hkey[slot], dimensions );
+		idxi_set_key( numtomove + 1, anchor->Hkey[slot] );
 /*		BT->keycopy(&right->X.ientry[numtomove + 1].Hkey,
 				&anchor->X.ientry[slot].Hkey);*/
 		/* 3 move right's first pointer to numtomove+1 element */
 		in_ENTRY[numtomove + 1]->downptr =in_HDR->firstptr;
 		/* 4 move value from left to anchor */
-		keycopy ( anchor->Hkey[slot], left->Hkey[lsize - numtomove], dimensions );
+		anchor->idxi_set_key( slot, left->Hkey[lsize - numtomove] );
 /*		BT->keycopy(&anchor->X.ientry[slot].Hkey,
 				&left->X.ientry[lsize - numtomove].Hkey);*/
 		/* 5 move pointer from left to right's first */
 		in_HDR->firstptr = left->in_ENTRY[lsize - numtomove]->downptr;
 		// 6 move high entries in left to low end of right
-		nbytes = node_entry_size * numtomove;
-		memcpy( Hkey[1], left->Hkey[lsize - numtomove + 1], nbytes );
-		nbytes = node_entry_size * (numtomove + 1);		// ???? redundant????
+		idxi_move_entries( 1, left, lsize - numtomove + 1, numtomove );
 /*		memset(&left->X.ientry[lsize - numtomove], NULL, nbytes);*/
 		// adjust parents of imported elements' children
 		in_HDR->firstptr->in_HDR->parent = this;
@@ -369,8 +548,9 @@ int BTnode::idxi_shift_from_left( BTnode *left, BTnode *anchor )
 // left is the implied parameter
 int BTnode::idxi_shift_from_right( BTnode *right, BTnode *anchor )
 {
-	int i, slot, isleaf, lsize, rsize, numtomove, nbytes;
+	int i, slot, isleaf, lsize, rsize, numtomove;
 	HU_int *key;	// no memory allocation needed
+	HU_int sep[HKEY_MAX_WORDS];
 
 	if (!(this && right && anchor))
 		errorexit("ERROR 1 in idxi_shift_from_right(): at least one "
@@ -390,23 +570,23 @@ int BTnode::idxi_shift_from_right( BTnode *right, BTnode *anchor )
 
 		key = right->Hkey[1];
 		slot = anchor->idxi_find_slot( key );
+		if (slot < 0)
+			slot *= -1;
 		if (slot < 1 || slot > anchor->in_HDR->size)
 			errorexit("ERROR 3 in idxi_shift_from_right(): lowest key in "
 					  "right hand node not\ncompatible with anchor node\n");
 		// move elements from right to left
-		nbytes = node_entry_size * numtomove;
-		memcpy( Hkey[lsize + 1], right->Hkey[1], nbytes );
+		idxi_move_entries( lsize + 1, right, 1, numtomove );
 		// move high entries in right to low end (and empty vacated slots)
-		nbytes = node_entry_size * (rsize - numtomove);
-		memmove( right->Hkey[1], right->Hkey[numtomove + 1], nbytes );
-		nbytes = node_entry_size * numtomove;
+		right->idxi_move_entries( 1, right, numtomove + 1, rsize - numtomove );
 /*		memset(&right->X.lentry[rsize - numtomove + 1], NULL, nbytes);*/
-		// adjust anchor key value
-		keycopy ( anchor->Hkey[slot], right->Hkey[1], dimensions );
-/*		BT->keycopy(&anchor->X.ientry[slot].Hkey, &right->X.lentry[1].Hkey);*/
 		// adjust sizes
 		lf_HDR->size += numtomove;
 		right->lf_HDR->size -= numtomove;
+		// adjust anchor key value
+		BT_separator( Hkey[lf_HDR->size], right->Hkey[1], sep, key_words );
+		anchor->idxi_set_key( slot, sep );
+/*		BT->keycopy(&anchor->X.ientry[slot].Hkey, &right->X.lentry[1].Hkey);*/
 	}
 	else
 	{
@@ -419,28 +599,26 @@ int BTnode::idxi_shift_from_right( BTnode *right, BTnode *anchor )
 
 		key = right->Hkey[1];
 		slot = anchor->idxi_find_slot( key );
-		slot *= -1;
+		if (slot < 0)
+			slot *= -1;
 		if (slot < 1 || slot > anchor->in_HDR->size)
 			errorexit("ERROR 5 in idxi_shift_from_right(): lowest key in "
 					  "right hand node not\ncompatible with anchor node\n");
 		// move anchor value to left node
-		keycopy ( Hkey[lsize + 1], anchor->Hkey[slot], dimensions );
+		idxi_set_key( lsize + 1, anchor->Hkey[slot] );
 /*		BT->keycopy(&left->X.ientry[lsize + 1].Hkey, &anchor->X.ientry[slot].Hkey);*/
 		// move right's first pointer to left
 		in_ENTRY[lsize + 1]->downptr = right->in_HDR->firstptr;
 		// assign new pointer to right's first
 		right->in_HDR->firstptr = right->in_ENTRY[numtomove + 1]->downptr;
 		// move value from right to anchor
-		keycopy( anchor->Hkey[slot], right->Hkey[numtomove + 1], dimensions );
+		anchor->idxi_set_key( slot, right->Hkey[numtomove + 1] );
 /*		BT->keycopy(&anchor->X.ientry[slot].Hkey,
 				&right->X.ientry[numtomove + 1].Hkey);*/
 		// move elements from right to left
-		nbytes = node_entry_size * numtomove;
-		memcpy( Hkey[lsize + 2], right->Hkey[1], nbytes );
+		idxi_move_entries( lsize + 2, right, 1, numtomove );
 		// move high entries in right to low end (and empty vacated slots)
-		nbytes = node_entry_size * (rsize - numtomove - 1);
-		memmove( right->Hkey[1], right->Hkey[numtomove + 2], nbytes );
-		nbytes = node_entry_size * (numtomove + 1);	// ???? redundant ????
+		right->idxi_move_entries( 1, right, numtomove + 2, rsize - numtomove - 1 );
 /*		memset(&right->X.ientry[rsize - numtomove], NULL, nbytes);*/
 		// adjust parents of imported elements' children: BEFORE size mods
 		for (i = 1; i <= numtomove + 1; i++)
@@ -528,8 +706,9 @@ int BTnode::idxi_delete_from_node( HU_int *key, int lpage,
 				BTnode *left, BTnode *right,
 				BTnode *LAnchor, BTnode *RAnchor )
 {
-	int slot, tempslot, nbytes;
+	int slot, tempslot;
 	BTnode *newnode, *myleft, *myright, *myLA, *myRA;
+	HU_int sep[HKEY_MAX_WORDS];
 
 	slot = idxi_find_slot( key );
 
@@ -587,19 +766,26 @@ int BTnode::idxi_delete_from_node( HU_int *key, int lpage,
 					  "to delete a\nnon-existent page entry\n");
 
 		/* Update index entry in LAnchor - if necessary
-		   A copy of a key which is the first one in any leaf always exists
-			 as a key in some higher level node (if any), specifically, the
-			 leaf's LAnchor.
-		   If the first key in a leaf is deleted the copy in the LAnchor
-			 must be updated so it becomes the new first entry in the leaf.*/
+		   A key not above the first one in any leaf (see BT_separator())
+			 always exists as a key in some higher level node (if any),
+			 specifically, the leaf's LAnchor.
+		   If the first key in a leaf is deleted the key in the LAnchor
+			 is updated so it separates the new first entry in the leaf
+			 from the last one in the leaf before, 'left'.*/
 		if (slot == 1 && LAnchor != NULL)
 		{
 			tempslot = LAnchor->idxi_find_slot( key );
+			if (tempslot < 0)
+				tempslot *= -1;
 			if (tempslot < 1 || tempslot > LAnchor->in_HDR->size)
 				errorexit("ERROR 3 in idxi_delete_from_node(): "
 						  "key not in anchor\n");
 
-			keycopy ( LAnchor->Hkey[tempslot], Hkey[2], dimensions ) ;
+			if (left)
+				BT_separator( left->Hkey[left->lf_HDR->size], Hkey[2], sep, key_words );
+			else
+				keycopy( sep, Hkey[2], key_words );
+			LAnchor->idxi_set_key( tempslot, sep );
 /*			BT->keycopy(&LAnchor->X.ientry[tempslot].Hkey,
 					  &thisnode->X.ientry[2].Hkey);*/
 		/* As a deletion in a leaf may cause cascading of deletions upwards,
@@ -607,12 +793,11 @@ int BTnode::idxi_delete_from_node( HU_int *key, int lpage,
 			 but it won't be there - unless we also modify the search key,
 			 which, since it is a pointer, will take effect in all other
 			 function calls. */
-			keycopy ( key, Hkey[2], dimensions );
+			keycopy ( key, Hkey[2], key_words );
 /*			BT->keycopy(key, &thisnode->X.ientry[2].Hkey);*/
 		}
 
-		nbytes = node_entry_size * (lf_HDR->size - slot);
-		memmove( Hkey[slot], Hkey[slot + 1], nbytes );
+		idxi_move_entries( slot, this, slot + 1, lf_HDR->size - slot );
 /*		memset(&thisnode->X.lentry[thisnode->X.lf.size], NULL,
 			sizeof (thisnode->X.lentry[0]));*/
 		lf_HDR->size--;
@@ -742,21 +927,24 @@ int BTnode::idxi_setup_nextptrs()
 /*                            idxi_read_file				      */
 /*============================================================================*/
 // this is assuming that the file contains at least one node - what if it doesn't?!!
-BTnode* BTnode::idxi_read_file(fstream& f, int dims, int n_entries, int n_entry_size )
+BTnode* BTnode::idxi_read_file(fstream& f, int kwords, int n_entries, int n_entry_size,
+		unsigned char *entries, BTree *tree )
 {
 	int i;
-/*	BTnode *node = static_cast<BTnode*>(getstorage(sizeof(BTnode)));*/
-	BTnode *node = new BTnode(dims, n_entries );
 
-	f.read( reinterpret_cast<char*>(node->raw_data), n_entries * n_entry_size );
+	f.read( reinterpret_cast<char*>(entries), n_entries * n_entry_size );
 	if (! f)
 		errorexit("ERROR in idxi_read_file()\n");
+/*	BTnode *node = static_cast<BTnode*>(getstorage(sizeof(BTnode)));*/
+	BTnode *node = new BTnode(kwords, n_entries, tree,
+		!(((BTnodehdr*)entries)->flags & isLEAF) );
+	node->idxi_from_file( entries );
 
 	if (!(node->in_HDR->flags & isLEAF))
 	{
-		node->in_HDR->firstptr = idxi_read_file( f, dims, n_entries, n_entry_size );
+		node->in_HDR->firstptr = idxi_read_file( f, kwords, n_entries, n_entry_size, entries, tree );
 		for (i = 1; i <= node->in_HDR->size; i++)
-			node->in_ENTRY[i]->downptr = idxi_read_file( f, dims, n_entries, n_entry_size );
+			node->in_ENTRY[i]->downptr = idxi_read_file( f, kwords, n_entries, n_entry_size, entries, tree );
 	}
 	return node;
 }
@@ -794,19 +982,37 @@ void BTnode::idxi_free_btree()
 // constructor
 BTree::BTree()
 {
+	root = NULL;
+	flat = NULL;
+	changes = 0;
+	inner_entries = 0;
+	memset( &flat_hdr, 0, sizeof flat_hdr );
 }
 
 /*============================================================================*/
 /*                            BTree::BTree	                          	      */
 /*============================================================================*/
 // constructor
-BTree::BTree( string db_name, int dims, int n_entries )
+BTree::BTree( string db_name, int kwords, int n_entries )
 {
 	name = db_name;
 	root = NULL;
-	dimensions = dims;
+	key_words = kwords;
 	node_entries = n_entries;
-	node_entry_size = sizeof(U_int) * dimensions + sizeof(X);
+	node_entry_size = BTnode::idxi_entry_size( key_words );
+	flat_node_bytes = sizeof(BTflatnode) + sizeof(U_int) * node_entries *
+		(1 + key_words + (key_words > 1 ? 1 : 0));
+	flat_node_bytes = (flat_node_bytes + BT_FLAT_ALIGN - 1) / BT_FLAT_ALIGN * BT_FLAT_ALIGN;
+	// as many entries as an inner node could hold in the .idx file, were
+	// its keys to differ in only one word (see idxi_fits())
+	inner_entries = (flat_node_bytes - sizeof(BTflatnode) - sizeof(U_int)) /
+		(2 * sizeof(U_int)) + 1;
+	if (inner_entries < node_entries)
+		inner_entries = node_entries;
+	flat = NULL;
+	flat_bytes = 0;
+	changes = 0;
+	memset( &flat_hdr, 0, sizeof flat_hdr );
 
 //	idxfile = NULL;
 }
@@ -820,6 +1026,7 @@ BTree::~BTree()
 	if (root)
 		root->idxi_free_btree();
 	root = NULL;
+	idxi_unmap_file();
 }
 
 /*============================================================================*/
@@ -831,19 +1038,23 @@ void BTree::free_root()
 	if (root)
 		root->idxi_free_btree();
 	root = NULL;
+	idxi_unmap_file();
+	dirty.clear();
+	freed.clear();
+	changes++;
 }
 
 /*============================================================================*/
 /*                            idxi_make_new_root			      */
 /*============================================================================*/
-// creates a new root which points at 2 children
+// creates a new root which points at 2 children, separated by 'newkey'
 void BTree::idxi_make_new_root( BTnode *right, HU_int *newkey )
 {
 	BTnode	*left;
 
 	left = root;
 
-	root = new BTnode( dimensions, node_entries );
+	root = new BTnode( key_words, node_entries, this, true );
 	
 	root->in_HDR->parent = NULL;
 	root->in_HDR->flags = isROOT;
@@ -851,18 +1062,10 @@ void BTree::idxi_make_new_root( BTnode *right, HU_int *newkey )
 	root->in_HDR->firstptr = left;
 	root->in_ENTRY[1]->downptr = right;
 	left->lf_HDR->flags &= ~isROOT;
-	if (left->lf_HDR->flags & isLEAF)
-	{
-		keycopy ( root->Hkey[1], right->Hkey[1], dimensions );
-		left->lf_HDR->parent = right->lf_HDR->parent = root ;
-/*		BT->keycopy(&BT->root->X.ientry[1].Hkey, &right->X.lentry[1].Hkey);*/
-	}
-	else
-	{
-		keycopy ( root->Hkey[1], newkey, dimensions );
+	left->idxi_touch();
+	root->idxi_set_key( 1, newkey );
 /*		BT->keycopy(&BT->root->X.ientry[1].Hkey, newkey);*/
-		left->in_HDR->parent = right->in_HDR->parent = root;
-	}
+	left->in_HDR->parent = right->in_HDR->parent = root;
 }
 
 /*============================================================================*/
@@ -874,10 +1077,11 @@ void BTree::idxi_make_new_root( BTnode *right, HU_int *newkey )
 void BTree::idxi_split_leaf( BTnode *p )
 {
 	BTnode *New;
-	int numtomove, nbytes, size;
+	int numtomove, size;
+	HU_int sep[HKEY_MAX_WORDS];
 
 	/* make new node */
-	New = new BTnode( dimensions, node_entries );
+	New = new BTnode( key_words, node_entries, this );
 	New->lf_HDR->flags = isLEAF;
 	New->lf_HDR->nextptr = p->lf_HDR->nextptr;
 	New->lf_HDR->parent = p->lf_HDR->parent;
@@ -888,8 +1092,7 @@ void BTree::idxi_split_leaf( BTnode *p )
 	memmove(&New->X.lentry[1], &p->X.lentry[split], nbytes); */
 	size = p->lf_HDR->size;
 	numtomove = size / 2;
-	nbytes = node_entry_size * numtomove;
-	memcpy( New->Hkey[1], p->Hkey[size - numtomove + 1], nbytes );
+	New->idxi_move_entries( 1, p, size - numtomove + 1, numtomove );
 		/* erase data from p */
 /*	memset(&p->X.lentry[split], NULL, nbytes); */
 /*	memset(&p->X.lentry[size - numtomove + 1], NULL, nbytes);*/
@@ -900,13 +1103,14 @@ void BTree::idxi_split_leaf( BTnode *p )
 	p->lf_HDR->size -= numtomove;
 
 	/* insert new key into parent: p & New parents get adjusted as reqd.*/
+	BT_separator( p->Hkey[p->lf_HDR->size], New->Hkey[1], sep, key_words );
 	if (p->lf_HDR->flags & isROOT)
 	{
-		idxi_make_new_root( New, NULL );
+		idxi_make_new_root( New, sep );
 	}
 	else
 	{
-		idxi_insert_in_node( p->lf_HDR->parent, New->Hkey[1], 0, New );
+		idxi_insert_in_node( p->lf_HDR->parent, sep, 0, New );
 	}
 }
 
@@ -915,28 +1119,28 @@ void BTree::idxi_split_leaf( BTnode *p )
 /*============================================================================*/
 /* Splits a full inner node into 2, inserts new key into parent.
    New node takes the higher values of p and is the same size as p or
-	 one smaller. */
+	 one smaller. Either is split again if it still doesn't fit a node of
+	 the .idx file. */
 // calls idxi_make_new_root() - OK
 void BTree::idxi_split_inner( BTnode *p )
 {
-	BTnode *New = new BTnode( dimensions, node_entries );
-	int promotee, nbytes, i;
-	HU_int *promkey = new U_int[dimensions];
+	BTnode *New = new BTnode( key_words, node_entries, this, true );
+	int promotee, i;
+	HU_int promkey[HKEY_MAX_WORDS];
 
 	/* make new node */
 	New->in_HDR->flags = 0;
 	New->in_HDR->parent = p->in_HDR->parent;
 
 	promotee = p->in_HDR->size / 2 + 1;
-	keycopy ( promkey, p->Hkey[promotee], dimensions );
+	keycopy ( promkey, p->Hkey[promotee], key_words );
 /*	BT->keycopy(&promkey, &p->X.ientry[promotee].Hkey);*/
 	New->in_HDR->firstptr = p->in_ENTRY[promotee]->downptr;
 
 	/* deal with 'data' */
-	nbytes = node_entry_size * (p->in_HDR->size - promotee);
-	memcpy (New->Hkey[1], p->Hkey[promotee + 1], nbytes );
+	New->idxi_move_entries( 1, p, promotee + 1, p->in_HDR->size - promotee );
 		/* erase data from p */
-/*	memset(&p->X.ientry[promotee], NULL, nbytes + sizeof (p->X.ientry[0]));*/
+/*	memset(&p->X.ientry[promotee], NULL, sizeof (p->X.ientry[0]) * (size + 1 - promotee));*/
 		/* adjust sizes - MUST deal with New first! */
 	New->in_HDR->size = p->in_HDR->size - promotee;
 	p->in_HDR->size = promotee - 1;
@@ -954,6 +1158,11 @@ void BTree::idxi_split_inner( BTnode *p )
 	New->in_HDR->firstptr->in_HDR->parent = New;
 	for ( i = 1; i <= New->in_HDR->size; i++ )
 		New->in_ENTRY[i]->downptr->in_HDR->parent = New;
+
+	if (!idxi_fits( p ))
+		idxi_split_inner( p );
+	if (!idxi_fits( New ))
+		idxi_split_inner( New );
 }
 
 /*============================================================================*/
@@ -974,7 +1183,7 @@ void BTree::idxi_split_inner( BTnode *p )
 // calls idxi_split_inner() and idxi_split_leaf() - OK
 void BTree::idxi_insert_in_node( BTnode *p, HU_int *key, int lpage, BTnode *q )
 {
-	int slot, nbytes;
+	int slot;
 
 /*
 	void idx_dump(BTree *);
@@ -1006,11 +1215,11 @@ void BTree::idxi_insert_in_node( BTnode *p, HU_int *key, int lpage, BTnode *q )
 	slot++; /* this is where the new entry goes */
 
 	/* else it's an inner node */
-	nbytes = node_entry_size * (p->btnodehdr->size - slot + 1);
-	memmove( p->Hkey[slot + 1], p->Hkey[slot], nbytes );
+	// (Hkey[slot + 1] may be beyond the last element)
+	p->idxi_move_entries( slot + 1, p, slot, p->btnodehdr->size - slot + 1 );
 /*	memset(&p->X.ientry[slot], NULL, sizeof (p->X.ientry[0]));*/
 	/* insert entry */
-	keycopy ( p->Hkey[slot], key, dimensions );
+	p->idxi_set_key( slot, key );
 /*	BT->keycopy(&p->X.ientry[slot].Hkey, key);*/
 	p->btnodehdr->size++;
 
@@ -1023,30 +1232,545 @@ void BTree::idxi_insert_in_node( BTnode *p, HU_int *key, int lpage, BTnode *q )
 	else
 	{
 		p->in_ENTRY[slot]->downptr = q;
-		if (p->in_HDR->size > in_FANOUT)
+		if (p->in_HDR->size > in_FANOUT || !idxi_fits( p ))
 			idxi_split_inner( p );
 	}
 }
 
 /*============================================================================*/
-/*                            idxi_write_file				      */
+/*                            idxi_trim					      */
 /*============================================================================*/
-/* For writing a btree to file:
-   traverses btree depth first, writing nodes to file as it goes */
-int BTree::idxi_write_file( BTnode *node )
+// the no. of most significant words that all of inner node p's keys share,
+// and the no. of words of each that are left once those and the least
+// significant words that are 0 in all of them are dropped (at least 1):
+// what the .idx file holds of them
+void BTree::idxi_trim( BTnode *p, int *pre, int *width ) const
 {
-	int i;
+	int	size = p->in_HDR->size, low, w, i;
+
+	for (*pre = 0; *pre < key_words - 1; (*pre)++)
+	{
+		w = key_words - 1 - *pre;
+		for (i = 2; i <= size && p->Hkey[i][w] == p->Hkey[1][w]; i++)
+			;
+		if (i <= size)
+			break;
+	}
+	for (low = 0; low < key_words - *pre - 1; low++)
+	{
+		for (i = 1; i <= size && p->Hkey[i][low] == 0; i++)
+			;
+		if (i <= size)
+			break;
+	}
+	*width = key_words - *pre - low;
+}
+
+/*============================================================================*/
+/*                            idxi_inner_bytes				      */
+/*============================================================================*/
+// the no. of bytes an inner node takes in the .idx file (see idxi_trim())
+int BTree::idxi_inner_bytes( int size, int pre, int width ) const
+{
+	return sizeof(BTflatnode) + sizeof(U_int) *
+		(1 + pre + (size + 1) * (1 + width + (width > 1 ? 1 : 0)));
+}
+
+/*============================================================================*/
+/*                            idxi_fits					      */
+/*============================================================================*/
+/* Whether node p fits a node of the .idx file. A leaf always does. An inner
+   node is split when it doesn't, as well as when it has more than in_FANOUT
+   keys, so how many it holds depends on how many words its keys differ in.
+   One with no more keys than a leaf always fits, so nodes merged when
+   others underflow do; any that a rebalancing leaves too big are split
+   before the index is written (see idxi_split_unfit()). */
+bool BTree::idxi_fits( BTnode *p ) const
+{
+	int	pre, width;
+
+	if (p->lf_HDR->flags & isLEAF)
+		return true;
+	idxi_trim( p, &pre, &width );
+	return idxi_inner_bytes( p->in_HDR->size, pre, width ) <= flat_node_bytes;
+}
+
+/*============================================================================*/
+/*                            idxi_split_unfit				      */
+/*============================================================================*/
+// splits the inner nodes changed since the index was written that no longer
+// fit a node of the .idx file
+void BTree::idxi_split_unfit()
+{
+	vector<BTnode*>	changed;
+	bool			split;
+	size_t			i;
+
+	do
+	{
+		split = false;
+		changed.assign( dirty.begin(), dirty.end() );
+		for (i = 0; i < changed.size(); i++)
+			if (!idxi_fits( changed[i] ))
+			{
+				idxi_split_inner( changed[i] );
+				split = true;
+				changes++;
+			}
+	} while (split);
+}
+
+/*============================================================================*/
+/*                            idxi_node_to_flat				      */
+/*============================================================================*/
+// lays node p out as it is in the .idx file, in 'node'; the nodes it refers
+// to must have been given their numbers
+void BTree::idxi_node_to_flat( BTnode *p, unsigned char *node )
+{
+	BTflatnode	*h = (BTflatnode*)node;
+	U_int		*ref = (U_int*)(h + 1);
+	U_int		*keys = ref + node_entries, *lead;
+	int			i, pre, width, low;
+
+	memset( node, '\0', flat_node_bytes );
+	h->flags = p->btnodehdr->flags;
+	h->size = p->btnodehdr->size;
+	if (p->lf_HDR->flags & isLEAF)
+	{
+		memcpy( keys, p->Hkey.at, sizeof(U_int) * node_entries * key_words );
+		if (key_words > 1)
+			memcpy( keys + node_entries * key_words, p->lead, sizeof(U_int) * node_entries );
+		for (i = 1; i <= p->lf_HDR->size; i++)
+			ref[i] = p->lf_ENTRY[i]->lpage;
+		h->link = p->lf_HDR->nextptr ? p->lf_HDR->nextptr->flat_no : 0;
+		return;
+	}
+
+	// an inner node holds only the words its keys differ in
+	idxi_trim( p, &pre, &width );
+	if (idxi_inner_bytes( h->size, pre, width ) > flat_node_bytes)
+		errorexit( "ERROR in idxi_node_to_flat(): inner node too big\n" );
+	low = key_words - pre - width;
+	ref[0] = pre << 8 | width;
+	memcpy( ref + 1, p->Hkey[1] + low + width, sizeof(U_int) * pre );
+	ref += 1 + pre;
+	keys = ref + h->size + 1;
+	lead = width > 1 ? keys + (h->size + 1) * width : keys;
+	h->link = p->in_HDR->firstptr->flat_no;
+	for (i = 1; i <= p->in_HDR->size; i++)
+	{
+		ref[i] = p->in_ENTRY[i]->downptr->flat_no;
+		memcpy( keys + i * width, p->Hkey[i] + low, sizeof(U_int) * width );
+		lead[i] = p->Hkey[i][low + width - 1];
+	}
+}
+
+/*============================================================================*/
+/*                            idxi_write_node				      */
+/*============================================================================*/
+// writes 'node' as node n of the .idx file
+void BTree::idxi_write_node( U_int n, const unsigned char *node )
+{
+	idxfile.seekp( (streamoff)n * flat_node_bytes );
+	idxfile.write( reinterpret_cast<const char*>(node), flat_node_bytes );
+}
+
+/*============================================================================*/
+/*                            idxi_write_flat				      */
+/*============================================================================*/
+/* For writing a whole btree to a new .idx file:
+   traverses btree breadth first, writing nodes to file as it goes; a node's
+   children are numbered as they are queued, so they are known when it is
+   written, and so is the next leaf of a leaf, since the leaves, the last
+   level, are queued before any of them is written */
+int BTree::idxi_write_flat()
+{
+	unsigned char	*node = new unsigned char[flat_node_bytes];
+	vector<BTnode*>	queue;
+	BTnode			*p;
+	int				i;
+
+	flat_hdr.magic = BT_FLAT_MAGIC;
+	flat_hdr.key_words = key_words;
+	flat_hdr.node_entries = node_entries;
+	flat_hdr.node_bytes = flat_node_bytes;
+	flat_hdr.free = 0;
+
+	if (root)
+	{
+		queue.push_back( root );
+		root->flat_no = 1;
+	}
+	for (size_t n = 0; n < queue.size(); n++)
+	{
+		p = queue[n];
+		if (!(p->in_HDR->flags & isLEAF))
+		{
+			queue.push_back( p->in_HDR->firstptr );
+			p->in_HDR->firstptr->flat_no = queue.size();
+			for (i = 1; i <= p->in_HDR->size; i++)
+			{
+				queue.push_back( p->in_ENTRY[i]->downptr );
+				p->in_ENTRY[i]->downptr->flat_no = queue.size();
+			}
+		}
+		idxi_node_to_flat( p, node );
+		idxi_write_node( n + 1, node );
+		p->dirty = false;
+	}
+	dirty.clear();
+	freed.clear();
+	flat_hdr.nodes = queue.size() + 1;
+	flat_hdr.root = root ? 1 : 0;
+
+	memset( node, '\0', flat_node_bytes );
+	memcpy( node, &flat_hdr, sizeof flat_hdr );
+	idxi_write_node( 0, node );
+	delete [] node;
+	return idxfile ? 1 : 0;
+}
+
+/*============================================================================*/
+/*                            idxi_flat_order				      */
+/*============================================================================*/
+// for sorting nodes into the order they are in the .idx file
+bool BTree::idxi_flat_order( const BTnode *a, const BTnode *b )
+{
+	return a->flat_no < b->flat_no;
+}
+
+
+/*============================================================================*/
+/*                            idxi_write_changes			      */
+/*============================================================================*/
+/* For bringing the .idx file the btree was read from or last written to up
+   to date: only the nodes changed since then are written, to their own
+   places in the file. New nodes take the numbers of discarded ones, or are
+   added to the end of the file; any discarded ones left over are chained to
+   the free list. The header, which points at the root, is written last. */
+int BTree::idxi_write_changes()
+{
+	unsigned char	*node = new unsigned char[flat_node_bytes];
+	BTflatnode		*h = (BTflatnode*)node;
+	vector<BTnode*>	changed( dirty.begin(), dirty.end() );
+	size_t			i;
+
+	// number the new nodes
+	for (i = 0; i < changed.size(); i++)
+	{
+		if (changed[i]->flat_no != 0)
+			continue;
+		if (!freed.empty())
+		{
+			changed[i]->flat_no = freed.back();
+			freed.pop_back();
+		}
+		else if (flat_hdr.free != 0)
+		{
+			changed[i]->flat_no = flat_hdr.free;
+			idxfile.seekg( (streamoff)flat_hdr.free * flat_node_bytes );
+			idxfile.read( reinterpret_cast<char*>(h), sizeof(BTflatnode) );
+			flat_hdr.free = h->link;
+		}
+		else
+			changed[i]->flat_no = flat_hdr.nodes++;
+	}
+
+	// free the rest of the discarded nodes
+	memset( node, '\0', flat_node_bytes );
+	for (i = 0; i < freed.size(); i++)
+	{
+		h->link = flat_hdr.free;
+		idxi_write_node( freed[i], node );
+		flat_hdr.free = freed[i];
+	}
+	freed.clear();
+
+	// write the changed nodes, in file order
+	sort( changed.begin(), changed.end(), idxi_flat_order );
+	for (i = 0; i < changed.size(); i++)
+	{
+		idxi_node_to_flat( changed[i], node );
+		idxi_write_node( changed[i]->flat_no, node );
+		changed[i]->dirty = false;
+	}
+	dirty.clear();
+
+	flat_hdr.magic = BT_FLAT_MAGIC;		// it may have been older
+	flat_hdr.root = root ? root->flat_no : 0;
+	memset( node, '\0', flat_node_bytes );
+	memcpy( node, &flat_hdr, sizeof flat_hdr );
+	idxi_write_node( 0, node );
+	delete [] node;
+	return idxfile ? 1 : 0;
+}
+
+/*============================================================================*/
+/*                            idxi_discard				      */
+/*============================================================================*/
+// deletes a node that is no longer in the btree, freeing its no. in the
+// .idx file
+void BTree::idxi_discard( BTnode *p )
+{
+	if (p->flat_no != 0)
+		freed.push_back( p->flat_no );
+	dirty.erase( p );
+	delete p;
+}
 
-	if (!node)
+/*============================================================================*/
+/*                            idxi_map_file				      */
+/*============================================================================*/
+/* Maps a flat index file into memory, where it is searched until the index
+   is changed (see idxi_materialise()); nothing else is read, so this takes
+   the same time however large the index is. Returns the number of leaf node
+   entries (ie the number of pages in the database). */
+int BTree::idxi_map_file( string filename )
+{
+	const BTflathdr	*hdr;
+
+#ifdef BT_MMAP
+	struct stat	st;
+	void		*m;
+	int			fd = open( filename.c_str(), O_RDONLY );
+
+	if (fd < 0 || fstat( fd, &st ) != 0)
+		errorexit( "ERROR 1 in idxi_map_file(): opening index file\n" );
+	flat_bytes = st.st_size;
+	m = mmap( NULL, flat_bytes, PROT_READ, MAP_SHARED, fd, 0 );
+	close( fd );
+	if (m == MAP_FAILED)
+		errorexit( "ERROR 2 in idxi_map_file(): mapping index file\n" );
+	flat = (const unsigned char*)m;
+#else
+	// no mmap(): the file is read whole, but still not unpacked
+	unsigned char	*buf;
+
+	idxfile.open( filename.c_str(), ios::in | ios::binary );
+	idxfile.seekg( 0, ios::end );
+	flat_bytes = idxfile.tellg();
+	idxfile.seekg( 0 );
+	buf = new unsigned char[flat_bytes];
+	idxfile.read( reinterpret_cast<char*>(buf), flat_bytes );
+	if (! idxfile)
+		errorexit( "ERROR 1 in idxi_map_file(): reading index file\n" );
+	idxfile.close();
+	flat = buf;
+#endif
+	flat_name = filename;
+	dirty.clear();
+	freed.clear();
+
+	hdr = (const BTflathdr*)flat;
+	if (flat_bytes < sizeof(BTflathdr) || (int)hdr->key_words != key_words ||
+			(int)hdr->node_entries != node_entries ||
+			(int)hdr->node_bytes != flat_node_bytes ||
+			flat_bytes != (size_t)hdr->nodes * flat_node_bytes)
+		errorexit( "ERROR 3 in idxi_map_file(): index file not compatible\n" );
+	flat_hdr = *hdr;
+	if (hdr->root == 0)
+	{
+		idxi_unmap_file();
 		return 0;
-	idxfile.write(reinterpret_cast<char*>(node->raw_data), node_entries * node_entry_size);
-	if (!(node->in_HDR->flags & isLEAF))
+	}
+	return hdr->leaf_entries;
+}
+
+/*============================================================================*/
+/*                            idxi_unmap_file				      */
+/*============================================================================*/
+void BTree::idxi_unmap_file()
+{
+	if (!flat)
+		return;
+#ifdef BT_MMAP
+	munmap( const_cast<unsigned char*>(flat), flat_bytes );
+#else
+	delete [] flat;
+#endif
+	flat = NULL;
+	flat_bytes = 0;
+}
+
+/*============================================================================*/
+/*                            idxi_materialise				      */
+/*============================================================================*/
+/* Builds the btree in memory from the mapped index file, before the index
+   is changed or walked node by node; searches don't need this. */
+void BTree::idxi_materialise()
+{
+	BTnode	*last_leaf = NULL;
+
+	if (!flat)
+		return;
+	root = idxi_flat_to_node( flat_hdr.root, NULL, &last_leaf );
+	idxi_unmap_file();
+	changes++;
+}
+
+/*============================================================================*/
+/*                            idxi_flat_to_node				      */
+/*============================================================================*/
+// builds the subtree whose root is node n of the mapped index file,
+// depth first, so that its leaves are chained to 'last_leaf' in order
+BTnode* BTree::idxi_flat_to_node( U_int n, BTnode *parent, BTnode **last_leaf )
+{
+	const U_int			*ref, *keys, *lead, *prefix;
+	const BTflatnode	*h = idxi_flat_node( n, &ref, &keys, &lead );
+	BTnode				*node = new BTnode( key_words, node_entries, this,
+							!(h->flags & isLEAF) );
+	U_int				*key;
+	int					i, low, width;
+
+	node->flat_no = n;
+	node->btnodehdr->flags = h->flags;
+	node->btnodehdr->size = h->size;
+	node->btnodehdr->parent = parent;
+	if (h->flags & isLEAF)
 	{
-		idxi_write_file(node->in_HDR->firstptr);
-		for (i = 1; i <= node->in_HDR->size; i++)
-			idxi_write_file(node->in_ENTRY[i]->downptr);
+		memcpy( node->Hkey.at, keys, sizeof(U_int) * node_entries * key_words );
+		if (key_words > 1)
+			memcpy( node->lead, lead, sizeof(U_int) * node_entries );
+		for (i = 1; i <= h->size; i++)
+			node->lf_ENTRY[i]->lpage = ref[i];
+		node->lf_HDR->nextptr = NULL;
+		if (*last_leaf)
+			(*last_leaf)->lf_HDR->nextptr = node;
+		*last_leaf = node;
 	}
-	return 1;
+	else
+	{
+		// the words of the keys that were dropped (see idxi_node_to_flat())
+		idxi_flat_inner( h, &ref, &keys, &lead, &prefix, &low, &width );
+		for (i = 1; i <= h->size; i++)
+		{
+			key = node->Hkey[i];
+			memset( key, 0, sizeof(U_int) * low );
+			memcpy( key + low, keys + i * width, sizeof(U_int) * width );
+			memcpy( key + low + width, prefix, sizeof(U_int) * (key_words - low - width) );
+			node->lead[i] = key[key_words - 1];
+		}
+		node->in_HDR->firstptr = idxi_flat_to_node( h->link, node, last_leaf );
+		for (i = 1; i <= h->size; i++)
+			node->in_ENTRY[i]->downptr = idxi_flat_to_node( ref[i], node, last_leaf );
+	}
+	return node;
+}
+
+/*============================================================================*/
+/*                            idxi_flat_node				      */
+/*============================================================================*/
+// node n of the mapped index file, and its columns, if it is a leaf (see
+// idxi_flat_inner() for an inner node)
+const BTflatnode* BTree::idxi_flat_node( U_int n, const U_int **ref,
+	const U_int **keys, const U_int **lead ) const
+{
+	const BTflatnode *h = (const BTflatnode*)(flat + (size_t)n * flat_node_bytes);
+
+	*ref = (const U_int*)(h + 1);
+	*keys = *ref + node_entries;
+	*lead = key_words > 1 ? *keys + node_entries * key_words : *keys;
+	return h;
+}
+
+/*============================================================================*/
+/*                            idxi_flat_inner				      */
+/*============================================================================*/
+// the columns of inner node h of the mapped index file, whose keys hold
+// words 'low' to 'low' + 'width' - 1 of each key, the words above those
+// being 'prefix' and those below 0 (see idxi_node_to_flat())
+void BTree::idxi_flat_inner( const BTflatnode *h, const U_int **ref,
+	const U_int **keys, const U_int **lead, const U_int **prefix, int *low,
+	int *width ) const
+{
+	const U_int	*body = (const U_int*)(h + 1);
+	int			pre;
+
+	if (body[0] == 0)
+	{
+		// laid out as a leaf is (an older file)
+		*prefix = body;
+		*low = 0;
+		*width = key_words;
+		*ref = body;
+		*keys = *ref + node_entries;
+		*lead = key_words > 1 ? *keys + node_entries * key_words : *keys;
+		return;
+	}
+	pre = body[0] >> 8;
+	*width = body[0] & 0xff;
+	*low = key_words - pre - *width;
+	*prefix = body + 1;
+	*ref = *prefix + pre;
+	*keys = *ref + h->size + 1;
+	*lead = *width > 1 ? *keys + (h->size + 1) * *width : *keys;
+}
+
+/*============================================================================*/
+/*                            idxi_flat_inner_slot			      */
+/*============================================================================*/
+// idxi_find_slot() for inner node h of the mapped index file, and its column
+// of child node nos.
+int BTree::idxi_flat_inner_slot( const BTflatnode *h, HU_int *key,
+	const U_int **ref ) const
+{
+	const U_int	*keys, *lead, *prefix;
+	int			low, width, i;
+
+	idxi_flat_inner( h, ref, &keys, &lead, &prefix, &low, &width );
+	// a key without the node's leading words is below or above all of its
+	// keys; with them, it is compared by the words the node holds, and if
+	// they are the same it isn't below that key, whose lower words are 0
+	i = keycmp( key + low + width, prefix, key_words - low - width );
+	if (i != 0)
+		return i < 0 ? 0 : -h->size;
+	return BT_find_slot( lead, keys, width, h->size, key + low );
+}
+
+/*============================================================================*/
+/*                            idxi_flat_find_leaf			      */
+/*============================================================================*/
+// idxi_search_leaf() in the mapped index file: returns the leaf which may
+// contain 'key', with the slot for 'key' in it
+const BTflatnode* BTree::idxi_flat_find_leaf( HU_int *key, int *slot,
+	const U_int **ref, const U_int **keys ) const
+{
+	const U_int			*lead, *prefix;
+	const BTflatnode	*h;
+	U_int				n = flat_hdr.root, before = 0;
+	int					i, low, width;
+
+	for (;;)
+	{
+		h = (const BTflatnode*)(flat + (size_t)n * flat_node_bytes);
+		if (h->size < 1)
+			errorexit( "ERROR in idxi_flat_find_leaf()\n" );
+		if (h->flags & isLEAF)
+			break;
+		i = idxi_flat_inner_slot( h, key, ref );
+		if (i < 0)
+			i *= -1;
+		if (i > 0)
+			before = i == 1 ? h->link : (*ref)[i - 1];
+		n = i == 0 ? h->link : (*ref)[i];
+	}
+	h = idxi_flat_node( n, ref, keys, &lead );
+	*slot = BT_find_slot( lead, *keys, key_words, h->size, key );
+	if (*slot != 0 || before == 0)
+		return h;
+
+	// the key lies below the leaf's first, but above the key leading to it:
+	// its page is the last of the leaf before
+	for (n = before; ; n = (*ref)[h->size])
+	{
+		h = (const BTflatnode*)(flat + (size_t)n * flat_node_bytes);
+		if (h->flags & isLEAF)
+			break;
+		idxi_flat_inner( h, ref, keys, &lead, &prefix, &low, &width );
+	}
+	h = idxi_flat_node( n, ref, keys, &lead );
+	*slot = -h->size;
+	return h;
 }
 
 /*============================================================================*/
@@ -1055,9 +1779,11 @@ int BTree::idxi_write_file( BTnode *node )
 // Don't call this function if the index is empty!
 // Returns the number of leaf node entries
 // (ie the number of pages in the database)
+// A flat index file is mapped rather than read (see idxi_map_file()).
 int BTree::idx_read( string fname )
 {
  	string filename;
+	U_int magic = 0;
 
 	if ( fname == "" )
 		filename = name + ".idx";
@@ -1066,11 +1792,29 @@ int BTree::idx_read( string fname )
 
 //	string filename = name + ".idx";
 
+	idxi_unmap_file();
+	changes++;
 	idxfile.open( filename.c_str(), ios::in | ios::binary );
 	if (! idxfile)
 		errorexit( "ERROR 1 in idx_read(): writing index to file \n" );
 
-	root = root->idxi_read_file( idxfile, dimensions, node_entries, node_entry_size );
+	idxfile.read( reinterpret_cast<char*>(&magic), sizeof magic );
+	if (idxfile && (magic == BT_FLAT_MAGIC || magic == BT_FLAT_MAGIC_1))
+	{
+		idxfile.close();
+		return idxi_map_file( filename );
+	}
+	// an old index file, written node by node, depth first: it will be
+	// replaced by a flat one when the index is written
+	idxfile.clear();
+	idxfile.seekg( 0 );
+	flat_name = "";
+	dirty.clear();
+	freed.clear();
+
+	unsigned char *entries = new unsigned char[node_entries * node_entry_size];
+	root = root->idxi_read_file( idxfile, key_words, node_entries, node_entry_size, entries, this );
+	delete [] entries;
 
 	if (! idxfile)
 		errorexit( "ERROR 1 in idx_read(): reading index file\n" );
@@ -1083,6 +1827,7 @@ int BTree::idx_read( string fname )
 
 	root->idxi_setup_parents();
 	int i = root->idxi_setup_nextptrs();
+	flat_hdr.leaf_entries = i;
 
 	return i;
 }
@@ -1101,11 +1846,37 @@ int BTree::idx_write( string fname )
 	else
 		filename = fname;
 
+	// the index hasn't changed since it was mapped from this file
+	if (flat && filename == flat_name)
+		return 1;
+	if (!flat)
+		idxi_split_unfit();
+
+	// only the changes need writing to the file the index came from
+	if (filename == flat_name)
+	{
+		idxfile.open( filename.c_str(), ios::in | ios::out | ios::binary );
+		if (idxfile)
+		{
+			if (! idxi_write_changes())
+				errorexit("ERROR in idx_write(): writing index to file \n");
+			idxfile.close();
+			return 1;
+		}
+		idxfile.clear();
+	}
+
 	idxfile.open( filename.c_str(), ios::out | ios::binary );
 
-	idxi_write_file( root );
-//	if (idxfile.ferror())  ????		????
-//		errorexit("ERROR in idx_write(): writing index to file \n");
+	if (flat)
+		idxfile.write( reinterpret_cast<const char*>(flat), flat_bytes );
+	else
+	{
+		idxi_write_flat();
+		flat_name = filename;
+	}
+	if (! idxfile)
+		errorexit("ERROR in idx_write(): writing index to file \n");
 
 	idxfile.close();
 	return 1;
@@ -1116,6 +1887,7 @@ int BTree::idx_write( string fname )
 /*============================================================================*/
 int BTree::idx_get_last_page()
 {
+	idxi_materialise();
 	BTnode *p = root;
 
 	while(!(p->in_HDR->flags & isLEAF))
@@ -1135,6 +1907,7 @@ int BTree::idx_get_next( HU_int *key, int lpage )
 	BTnode *p;
 	int slot;
 
+	idxi_materialise();
 	if (!root || root->lf_HDR->size == 0)
 		return -1;
 
@@ -1165,6 +1938,24 @@ HU_int* BTree::idx_get_next_key( HU_int *key, int lpage )
 	BTnode *p;
 	int slot;
 
+	if (flat)
+	{
+		const U_int			*ref, *keys, *lead;
+		const BTflatnode	*h = idxi_flat_find_leaf( key, &slot, &ref, &keys );
+
+		if (slot < 1)
+			errorexit("ERROR 1 in idx_get_next_key(): key not in index\n");
+		if (lpage != (int)ref[slot])
+			errorexit("ERROR 2 in idx_get_next_key(): key-page mismatch\n");
+		if (slot == h->size)
+		{
+			if (h->link == 0)
+				return key;  /* this is the last page in the database */
+			idxi_flat_node( h->link, &ref, &keys, &lead );
+			slot = 0;
+		}
+		return const_cast<HU_int*>(keys + (slot + 1) * key_words);
+	}
 	if (!root || root->lf_HDR->size == 0)
 		return key;
 
@@ -1186,6 +1977,51 @@ HU_int* BTree::idx_get_next_key( HU_int *key, int lpage )
 	return p->Hkey[slot + 1];
 }
 
+/*============================================================================*/
+/*                            idx_search_next_key			      */
+/*============================================================================*/
+/* Returns the key of the page after the one that idx_search() finds for
+	 'key' - or NULL if that is the last page in the database. */
+HU_int* BTree::idx_search_next_key( HU_int *key )
+{
+	BTnode *p;
+	int slot;
+
+	if (flat)
+	{
+		const U_int			*ref, *keys, *lead;
+		const BTflatnode	*h = idxi_flat_find_leaf( key, &slot, &ref, &keys );
+
+		if (slot == 0)
+			errorexit("ERROR in idx_search_next_key(): key is lower than any key in the database\n");
+		if (slot < 0)
+			slot *= -1;
+		if (slot == h->size)
+		{
+			if (h->link == 0)
+				return NULL;  /* this is the last page in the database */
+			idxi_flat_node( h->link, &ref, &keys, &lead );
+			slot = 0;
+		}
+		return const_cast<HU_int*>(keys + (slot + 1) * key_words);
+	}
+	if (!root || root->lf_HDR->size == 0)
+		return NULL;
+
+	p = idxi_search_leaf( key, &slot );
+	if (slot == 0)
+		errorexit("ERROR in idx_search_next_key(): key is lower than any key in the database\n");
+	if (slot < 0)
+		slot *= -1;
+	if (slot == p->lf_HDR->size)
+	{
+		if (p->lf_HDR->nextptr == NULL)
+			return NULL;  /* this is the last page in the database */
+		return p->lf_HDR->nextptr->Hkey[1];
+	}
+	return p->Hkey[slot + 1];
+}
+
 /*============================================================================*/
 /*                            idx_get_prev				      */
 /*============================================================================*/
@@ -1194,6 +2030,7 @@ HU_int* BTree::idx_get_next_key( HU_int *key, int lpage )
 	 or -1 if there is no lower key in the index. */
 int BTree::idx_get_prev( HU_int *key, int lpage )
 {
+	idxi_materialise();
 	if (!root || root->lf_HDR->size == 0)
 		return -1;
 	return root->idxi_find_prev( key, lpage, NULL );
@@ -1208,24 +2045,184 @@ int BTree::idx_insert_key( HU_int *key, int lpage )
 {
 	BTnode *p;
 
+	idxi_materialise();
+	changes++;
 	if (!root)
 	{
 /*		root = static_cast<BTnode*>(getstorage(sizeof(BTnode)));*/
-		root = new BTnode( dimensions, node_entries );
+		root = new BTnode( key_words, node_entries, this );
 		root->lf_HDR->flags = (isROOT | isLEAF);
 		root->lf_HDR->size = 1;
-		keycopy ( root->Hkey[1], key, dimensions );
+		root->idxi_set_key( 1, key );
 /*		BT->keycopy(&BT->root->X.lentry[1].Hkey, key);*/
 		root->lf_ENTRY[1]->lpage = lpage;
 		root->lf_HDR->nextptr = root->lf_HDR->parent = NULL;
+		flat_hdr.leaf_entries = 1;
 		return 1;
 	}
 	p = root->idxi_find_leaf( key );
 
 	idxi_insert_in_node( p, key, lpage, NULL );
+	flat_hdr.leaf_entries++;
 	return 1;
 }
 
+/*============================================================================*/
+/*                            BT_level_nodes				      */
+/*============================================================================*/
+// the no. of nodes that 'num' entries are spread over, evenly, if each is to
+// have about 'per_node' of them but none fewer than 'min_size'
+static int BT_level_nodes( int num, int per_node, int min_size )
+{
+	int n = (num + per_node - 1) / per_node;
+
+	if (n > 1 && num / n < min_size)
+		n = num / min_size;
+	return n < 1 ? 1 : n;
+}
+
+/*============================================================================*/
+/*                            idx_bulk_load				      */
+/*============================================================================*/
+/* Builds the btree from 'num' keys, in ascending order, and the lpages of
+   their pages, replacing any index there already is. The leaves are filled
+   left to right, then each level of inner nodes above them, so no key is
+   searched for and no node is split. 'fill' is the percentage of each node
+   that is used: the leaves are filled evenly and none is left less than
+   half full; an inner node is given keys while they take no more than that
+   much of a node of the .idx file (see idxi_fits()), and the last of a
+   level is evened out with the one before it if it is left less than half
+   full. The index will be written whole the next time. Returns the number
+   of keys loaded. */
+int BTree::idx_bulk_load( const HU_int *keys, const int *lpages, int num, int fill )
+{
+	vector<BTnode*>	level, above;
+	vector<int>		first, above_first;	// the index of the lowest key under each node
+	vector<int>		starts;
+	vector<U_int>	seps;
+	BTnode			*p;
+	const HU_int	*sep;
+	int				per_node, max_keys, max_bytes, nodes, pre, low, pre_k, low_k, t, w;
+	int				i, j, k;
+
+	if (fill < 1 || fill > 100)
+		errorexit( "ERROR 1 in idx_bulk_load(): fill factor out of range\n" );
+	for (i = 1; i < num; i++)
+		if (keycmp( keys + (i - 1) * key_words, keys + i * key_words, key_words ) >= 0)
+			errorexit( "ERROR 2 in idx_bulk_load(): keys not in ascending order\n" );
+
+	free_root();
+	flat_name = "";
+	flat_hdr.leaf_entries = num;
+	if (num == 0)
+		return 0;
+
+	// the leaves
+	per_node = lf_FANOUT * fill / 100;
+	nodes = BT_level_nodes( num, per_node < 1 ? 1 : per_node, lf_minFANOUT );
+	for (i = j = 0; j < nodes; j++)
+	{
+		p = new BTnode( key_words, node_entries, this );
+		p->lf_HDR->flags = isLEAF;
+		p->lf_HDR->size = (int)((long long)num * (j + 1) / nodes) - i;
+		p->lf_HDR->nextptr = NULL;
+		for (k = 1; k <= p->lf_HDR->size; k++, i++)
+		{
+			p->idxi_set_key( k, keys + i * key_words );
+			p->lf_ENTRY[k]->lpage = lpages[i];
+		}
+		if (!level.empty())
+			level.back()->lf_HDR->nextptr = p;
+		level.push_back( p );
+		first.push_back( i - p->lf_HDR->size );
+	}
+
+	// the inner levels: a node with n keys has n + 1 children, and the key
+	// leading to each child after the first is the shortest separator of the
+	// keys either side of it (see BT_separator())
+	max_keys = in_FANOUT * fill / 100;
+	if (max_keys < in_minFANOUT)
+		max_keys = in_minFANOUT;
+	if (max_keys < 1)
+		max_keys = 1;
+	max_bytes = flat_node_bytes * fill / 100;
+	while (level.size() > 1)
+	{
+		seps.assign( level.size() * key_words, 0 );
+		for (j = 1; j < (int)level.size(); j++)
+			BT_separator( keys + (first[j] - 1) * key_words, keys + first[j] * key_words,
+				&seps[j * key_words], key_words );
+
+		// where each node starts: it has at least in_minFANOUT keys, then
+		// as many as keep it within max_keys and max_bytes once trimmed
+		starts.clear();
+		for (i = 0; i < (int)level.size(); i += k + 1)
+		{
+			starts.push_back( i );
+			pre = key_words;
+			low = key_words;
+			for (k = 0; i + k + 1 < (int)level.size(); k++)
+			{
+				sep = &seps[(i + k + 1) * key_words];
+				for (pre_k = 0; pre_k < key_words
+					&& sep[key_words - 1 - pre_k] == seps[(i + 1) * key_words + key_words - 1 - pre_k]; pre_k++)
+					;
+				for (low_k = 0; low_k < key_words && sep[low_k] == 0; low_k++)
+					;
+				pre_k = pre_k < pre ? pre_k : pre;
+				low_k = low_k < low ? low_k : low;
+				if (k >= in_minFANOUT)
+				{
+					// as idxi_trim() would trim the node's keys
+					t = pre_k < key_words - 1 ? pre_k : key_words - 1;
+					w = key_words - t - (low_k < key_words - t - 1 ? low_k : key_words - t - 1);
+					if (k + 1 > max_keys || idxi_inner_bytes( k + 1, t, w ) > max_bytes)
+						break;
+				}
+				pre = pre_k;
+				low = low_k;
+			}
+		}
+		if (starts.size() > 1 && (int)level.size() - 1 - starts.back() < in_minFANOUT)
+		{
+			// the last node would be less than half full: if it and the
+			// one before fit in one they are merged, otherwise evened out
+			if ((int)level.size() - 1 - starts[starts.size() - 2] - 1 <= node_entries - 2)
+				starts.pop_back();
+			else
+				starts.back() = (int)level.size() - in_minFANOUT - 1;
+		}
+
+		nodes = starts.size();
+		above.clear();
+		above_first.clear();
+		for (j = 0; j < nodes; j++)
+		{
+			i = starts[j];
+			p = new BTnode( key_words, node_entries, this, true );
+			p->in_HDR->flags = 0;
+			p->in_HDR->size = (j + 1 < nodes ? starts[j + 1] : (int)level.size()) - i - 1;
+			p->in_HDR->firstptr = level[i];
+			level[i]->in_HDR->parent = p;
+			above_first.push_back( first[i++] );
+			for (k = 1; k <= p->in_HDR->size; k++, i++)
+			{
+				p->idxi_set_key( k, &seps[i * key_words] );
+				p->in_ENTRY[k]->downptr = level[i];
+				level[i]->in_HDR->parent = p;
+			}
+			above.push_back( p );
+		}
+		level.swap( above );
+		first.swap( above_first );
+	}
+
+	root = level[0];
+	root->in_HDR->flags |= isROOT;
+	root->in_HDR->parent = NULL;
+	return num;
+}
+
 /*============================================================================*/
 /*                            idx_delete_key				      */
 /*============================================================================*/
@@ -1233,26 +2230,61 @@ int BTree::idx_delete_key( HU_int *key, int lpage )
 {
 	int i;
 
+	idxi_materialise();
+	changes++;
 	if (!root || /* g_BTroot->X.lf.flags & isLEAF && */
 			root->lf_HDR->size == 0)
 		errorexit("ERROR in idx_delete_key(): database is empty\n");
 	i = root->idxi_delete_from_node( key, lpage, NULL, NULL, NULL, NULL );
+	flat_hdr.leaf_entries--;
 	if (i == 0) /* we need to collapse root */
 	{
 		root = root->in_HDR->firstptr;
 		root->in_HDR->flags |= isROOT;
-		delete root->in_HDR->parent;
+		root->idxi_touch();
+		idxi_discard( root->in_HDR->parent );
 		root->in_HDR->parent = NULL;
 	}
 	if (root->lf_HDR->flags & isLEAF)
 		if (root->lf_HDR->size == 0)
 		{   /* root is an empty leaf */
-			delete root;
+			idxi_discard( root );
 			root = NULL;
 		}
 	return 1;
 }
 
+/*============================================================================*/
+/*                            idxi_search_leaf				      */
+/*============================================================================*/
+/* idxi_find_leaf() and idxi_find_slot() for a key that needn't be in the
+   index: returns the leaf whose page may contain 'key', with the slot for
+   'key' in it (0 only if 'key' is lower than any key in the index). As the
+   key leading to a leaf may be below its first (see BT_separator()), a key
+   between them is found in the leaf before. */
+BTnode* BTree::idxi_search_leaf( HU_int *key, int *slot )
+{
+	BTnode	*p = root, *before = NULL;
+	int		i;
+
+	while (!(p->btnodehdr->flags & isLEAF))
+	{
+		i = p->idxi_find_slot( key );
+		if (i < 0)
+			i *= -1;
+		if (i > 0)
+			before = i == 1 ? p->in_HDR->firstptr : p->in_ENTRY[i - 1]->downptr;
+		p = i == 0 ? p->in_HDR->firstptr : p->in_ENTRY[i]->downptr;
+	}
+	*slot = p->idxi_find_slot( key );
+	if (*slot != 0 || before == NULL)
+		return p;
+	for (p = before; !(p->btnodehdr->flags & isLEAF); )
+		p = p->in_ENTRY[p->in_HDR->size]->downptr;
+	*slot = -p->lf_HDR->size;
+	return p;
+}
+
 /*============================================================================*/
 /*                            idx_search				      */
 /*============================================================================*/
@@ -1262,14 +2294,21 @@ int BTree::idx_search( HU_int *key )
 	BTnode *p;
 	int slot;
 
+	if (flat)
+	{
+		const U_int	*ref, *keys;
+
+		idxi_flat_find_leaf( key, &slot, &ref, &keys );
+		if (slot == 0)
+			errorexit( "ERROR in idx_search : key is lower than any key in the database" );
+		return ref[slot < 0 ? -slot : slot];
+	}
 	if (root == NULL || root->lf_HDR->size == 0)
 	{
 		printf("Database is empty\n");
 		return 0;
 	}
-	p = root->idxi_find_leaf( key );
-	/* search the LEAF page */
-	slot = p->idxi_find_slot( key );
+	p = idxi_search_leaf( key, &slot );
 	if (slot == 0)
 		errorexit( "ERROR in idx_search : key is lower than any key in the database" );
 //		return -1; key is lower than any key in the database
@@ -1289,7 +2328,7 @@ int BTree::idx_search( HU_int *key )
 void BTree::idx_dump( string filename )
 {
 	int		i, j;
-	BTnode		*p = root;
+	BTnode		*p = idx_root();
 	U_int		*h;
 	fstream		f;
 
@@ -1311,7 +2350,7 @@ void BTree::idx_dump( string filename )
 		{
 			f << "PAGE NO.: " << p->lf_ENTRY[i]->lpage << endl;
 			f << "KEY : ";
-			for (j = dimensions - 1, h = p->Hkey[i]; j >= 0; j--)
+			for (j = key_words - 1, h = p->Hkey[i]; j >= 0; j--)
 				f << setw(15) << h[j];
 			f << endl;
 		}
@@ -1320,3 +2359,299 @@ void BTree::idx_dump( string filename )
 
 	f.close();
 }
+
+/*============================================================================*/
+/*                            idx_root					      */
+/*============================================================================*/
+// the root of the btree in memory, for walking it node by node: it is built
+// from the index file first if that is mapped
+BTnode* BTree::idx_root()
+{
+	idxi_materialise();
+	return root;
+}
+
+/*============================================================================*/
+/*                            		                          	      */
+/*                            BTreeCursor	                          	      */
+/*                            		                          	      */
+/*============================================================================*/
+
+/*============================================================================*/
+/*                            BTreeCursor::BTreeCursor	                      */
+/*============================================================================*/
+// constructor
+BTreeCursor::BTreeCursor( BTree *bt )
+{
+	tree = bt;
+	positioned = false;
+	leaf = NULL;
+	flat_leaf = 0;
+	slot = 0;
+	changes = 0;
+}
+
+/*============================================================================*/
+/*                            curi_leaf					      */
+/*============================================================================*/
+// the keys of the leaf the cursor is on, their leading U_ints and how many
+void BTreeCursor::curi_leaf( const U_int **keys, const U_int **lead,
+	int *size ) const
+{
+	const U_int	*ref;
+
+	if (tree->flat)
+		*size = tree->idxi_flat_node( flat_leaf, &ref, keys, lead )->size;
+	else
+	{
+		*keys = leaf->Hkey.at;
+		*lead = leaf->lead;
+		*size = leaf->lf_HDR->size;
+	}
+}
+
+/*============================================================================*/
+/*                            curi_next_leaf				      */
+/*============================================================================*/
+// the lowest key of the leaf after the cursor's; NULL if there is none
+const U_int* BTreeCursor::curi_next_leaf() const
+{
+	const U_int	*ref, *keys, *lead;
+
+	if (tree->flat)
+	{
+		U_int link = tree->idxi_flat_node( flat_leaf, &ref, &keys, &lead )->link;
+
+		if (link == 0)
+			return NULL;
+		tree->idxi_flat_node( link, &ref, &keys, &lead );
+		return keys + tree->key_words;
+	}
+	if (leaf->lf_HDR->nextptr == NULL)
+		return NULL;
+	return leaf->lf_HDR->nextptr->Hkey[1];
+}
+
+/*============================================================================*/
+/*                            curi_to_next_leaf				      */
+/*============================================================================*/
+// moves the cursor to the leaf after its own (there must be one)
+void BTreeCursor::curi_to_next_leaf()
+{
+	const U_int	*ref, *keys, *lead;
+
+	if (tree->flat)
+		flat_leaf = tree->idxi_flat_node( flat_leaf, &ref, &keys, &lead )->link;
+	else
+		leaf = leaf->lf_HDR->nextptr;
+}
+
+/*============================================================================*/
+/*                            curi_moved				      */
+/*============================================================================*/
+// notes the key in the slot the cursor has been moved to
+void BTreeCursor::curi_moved()
+{
+	const U_int	*keys, *lead;
+	int			size;
+
+	curi_leaf( &keys, &lead, &size );
+	keycopy( at, keys + slot * tree->key_words, tree->key_words );
+}
+
+/*============================================================================*/
+/*                            curi_descend				      */
+/*============================================================================*/
+// positions the cursor, from the root, on the entry for the page which may
+// contain 'key'; false (leaving it where it was) if the index is empty or
+// 'key' is lower than any key in it
+bool BTreeCursor::curi_descend( HU_int *key )
+{
+	BTnode	*p = NULL;
+	U_int	n = 0;
+	int		s;
+
+	if (tree->flat)
+	{
+		const U_int	*ref, *keys;
+		const BTflatnode *h = tree->idxi_flat_find_leaf( key, &s, &ref, &keys );
+
+		n = ((const unsigned char*)h - tree->flat) / tree->flat_node_bytes;
+	}
+	else
+	{
+		if (tree->root == NULL || tree->root->lf_HDR->size == 0)
+			return false;
+		p = tree->idxi_search_leaf( key, &s );
+	}
+	if (s == 0)
+		return false;
+	leaf = p;
+	flat_leaf = n;
+	slot = s < 0 ? -s : s;
+	changes = tree->changes;
+	positioned = true;
+	curi_moved();
+	return true;
+}
+
+/*============================================================================*/
+/*                            curi_check				      */
+/*============================================================================*/
+// puts the cursor back on the key it was on if the tree has been changed
+// since it was positioned
+void BTreeCursor::curi_check()
+{
+	if (!positioned)
+		errorexit( "ERROR in BTreeCursor: cursor not positioned\n" );
+	if (changes != tree->changes && !curi_descend( at ))
+		errorexit( "ERROR in BTreeCursor: key no longer in index\n" );
+}
+
+/*============================================================================*/
+/*                            cur_seek					      */
+/*============================================================================*/
+/* Positions the cursor on the page which may contain 'key' and returns its
+   lpage, as idx_search() does. If 'key' is not below the cursor's key, the
+   leaf that it is on and the next few are looked at first. */
+int BTreeCursor::cur_seek( HU_int *key )
+{
+	const U_int	*keys, *lead, *next;
+	int			size, hops, s, kw = tree->key_words;
+
+	if (positioned && changes == tree->changes && keycmp( key, at, kw ) >= 0)
+	{
+		for (hops = 0; ; hops++)
+		{
+			// the leaf's lowest key isn't above 'key': is its highest?
+			curi_leaf( &keys, &lead, &size );
+			if (keycmp( key, keys + size * kw, kw ) < 0)
+			{
+				s = BT_find_slot( lead, keys, kw, size, key );
+				slot = s < 0 ? -s : s;
+				curi_moved();
+				return cur_lpage();
+			}
+			next = curi_next_leaf();
+			if (next == NULL || keycmp( key, next, kw ) < 0)
+			{
+				slot = size;
+				curi_moved();
+				return cur_lpage();
+			}
+			if (hops == BT_CURSOR_HOPS)
+				break;
+			curi_to_next_leaf();
+		}
+	}
+
+	if (!curi_descend( key ))
+	{
+		if (!tree->flat && (tree->root == NULL || tree->root->lf_HDR->size == 0))
+		{
+			printf("Database is empty\n");
+			return 0;
+		}
+		errorexit( "ERROR in cur_seek : key is lower than any key in the database" );
+	}
+	return cur_lpage();
+}
+
+/*============================================================================*/
+/*                            cur_next					      */
+/*============================================================================*/
+// moves the cursor on to the next page and returns its lpage; -1 (and the
+// cursor isn't moved) if it is on the last page
+int BTreeCursor::cur_next()
+{
+	const U_int	*keys, *lead;
+	int			size;
+
+	curi_check();
+	curi_leaf( &keys, &lead, &size );
+	if (slot < size)
+		slot++;
+	else
+	{
+		if (curi_next_leaf() == NULL)
+			return -1;
+		curi_to_next_leaf();
+		slot = 1;
+	}
+	curi_moved();
+	return cur_lpage();
+}
+
+/*============================================================================*/
+/*                            cur_prev					      */
+/*============================================================================*/
+// moves the cursor back to the previous page and returns its lpage; -1 (and
+// the cursor isn't moved) if it is on the first page. Out of a leaf, this is
+// a descent for the key one below the cursor's.
+int BTreeCursor::cur_prev()
+{
+	HU_int	below[HKEY_MAX_WORDS];
+	int		i, kw = tree->key_words;
+
+	curi_check();
+	if (slot > 1)
+	{
+		slot--;
+		curi_moved();
+		return cur_lpage();
+	}
+	keycopy( below, at, kw );
+	for (i = 0; i < kw && below[i]-- == 0; i++)
+		;
+	if (i == kw || !curi_descend( below ))
+		return -1;
+	return cur_lpage();
+}
+
+/*============================================================================*/
+/*                            cur_lpage					      */
+/*============================================================================*/
+// the lpage of the page the cursor is on
+int BTreeCursor::cur_lpage()
+{
+	const U_int	*ref, *keys, *lead;
+
+	curi_check();
+	if (tree->flat)
+	{
+		tree->idxi_flat_node( flat_leaf, &ref, &keys, &lead );
+		return ref[slot];
+	}
+	return leaf->lf_ENTRY[slot]->lpage;
+}
+
+/*============================================================================*/
+/*                            cur_key					      */
+/*============================================================================*/
+// the key of the page the cursor is on
+HU_int* BTreeCursor::cur_key()
+{
+	const U_int	*keys, *lead;
+	int			size;
+
+	curi_check();
+	curi_leaf( &keys, &lead, &size );
+	return const_cast<HU_int*>(keys + slot * tree->key_words);
+}
+
+/*============================================================================*/
+/*                            cur_next_key				      */
+/*============================================================================*/
+// the key of the page after the one the cursor is on (which isn't moved);
+// NULL if it is on the last page
+HU_int* BTreeCursor::cur_next_key()
+{
+	const U_int	*keys, *lead;
+	int			size;
+
+	curi_check();
+	curi_leaf( &keys, &lead, &size );
+	if (slot < size)
+		return const_cast<HU_int*>(keys + (slot + 1) * tree->key_words);
+	return const_cast<HU_int*>(curi_next_leaf());
+}
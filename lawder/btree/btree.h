@@ -3,6 +3,8 @@
 #ifndef _BTREE_H
 #define _BTREE_H
 
+#include <set>
+
 #ifdef DEV
 #ifdef __MSDOS__
 	#include "..\gendefs.h"
@@ -14,6 +16,8 @@
 #endif
 
 class BTnode;
+class BTree;
+class BTreeCursor;
 
 /* used by idxi_setup_nextptrs() */
 typedef struct ListNode {
@@ -36,7 +40,7 @@ typedef struct ListNode {
 #define	isROOT			0x2
 
 #define lf_FANOUT		(node_entries - 2)
-#define in_FANOUT		(node_entries - 2)
+#define in_FANOUT		(inner_entries - 2)		// (see BTree::idxi_fits())
 #define lf_minFANOUT	((node_entries - 2) / 2)
 #define in_minFANOUT	((node_entries - 2) / 2)
 
@@ -51,14 +55,29 @@ typedef struct {
 	BTnode  	*btnodeptr;		// aliased to nextptr (leaf) and firstptr (inner)
 } BTnodehdr;
 
-// NB the size of one of these is assumed to be the size of a U_int
-// and if it isn't this is a problem!!!
+// NB one of these may be larger than a U_int: node entries in an old .idx
+// file are padded so that it is aligned (see BTnode::idxi_entry_size())
 typedef union {
 	int		lpage;
 	BTnode		*downptr;
 } X;
 
-/* this comment is out of date
+// a column of a node's entries, used as if it were an array of pointers to
+// them: entry i is at + i * stride (for keys, the stride is key_words)
+template <class T> struct BTslots {
+	T* operator[]( int i ) const { return at + i * stride; }
+	T	*at;
+	int	stride;
+};
+
+/* In memory, a node's entries are held a column at a time after its header:
+   the X's, then the keys one after another, then, if a key takes more than
+   one U_int, a column of their leading (most significant) U_ints, which is
+   what a search looks at first. In an old .idx file (before the flat one
+   below), each entry is a key followed by its X, and the header takes the
+   place of entry 0.
+
+   this comment is out of date
 
  One of these occupies a page of size idx_PAGE_SIZE (or a little less)
    ientry[] elements 1 to inFANOUT are used for storing Hcodes.
@@ -66,26 +85,36 @@ typedef union {
    ientry[MAX_INNER - 1] is for overflow data: as soon as it is filled,
 	 in.size exceeds inFANOUT and a node split is triggered */
 
-// Hkey[0] points at btnodehdr.
+// Hkey[0] and XX[0] aren't used.
 // when an entry is placed in Hkey[node_entries - 1], this triggers a split
 // - ie, this element doesn't normally hold an entry.
 class BTnode {
 	friend class BTree;
+	friend class BTreeCursor;
 public:
-	BTnode( int dims, int n_entries );		// constructor
+	BTnode( int kwords, int n_entries, BTree *owner, bool inner = false );	// constructor
 	~BTnode();					// destructor
 
 	BTnodehdr	*btnodehdr;		// aliased to lf_HDR and in_HDR
-	X 			**XX;			// aliased to lf_ENTRY and in_ENTRY
+	BTslots<X>	XX;				// aliased to lf_ENTRY and in_ENTRY
 	BTnode* idxi_find_leaf( HU_int *key );
+	static int idxi_entry_size( int kwords );
 
 private:
-	U_int		**Hkey;
-	int dimensions;
+	BTslots<U_int>	Hkey;
+	U_int		*lead;			// lead[i] is the leading U_int of Hkey[i]
+	int key_words;				// no. of U_ints in a key
 	int node_entries;			// no. of elements in a node (inc. header)
-	int node_entry_size;		// no. of bytes in a node element
+	int node_entry_size;		// no. of bytes in a node element in the .idx file
 	unsigned char *raw_data;
+	BTree *tree;				// the btree the node is in
+	U_int flat_no;				// the node's no. in the .idx file; 0 if it has none yet
+	bool dirty;					// changed since it was written to the .idx file
 
+	void idxi_touch();
+	void idxi_set_key( int slot, const HU_int *key );
+	void idxi_move_entries( int to, BTnode *from_node, int from, int n );
+	void idxi_from_file( const unsigned char *entries );
 	int idxi_find_slot( HU_int *key );
 	int idxi_find_prev( HU_int *key, int lpage, BTnode *left );
 	int idxi_merge_nodes( BTnode *right );	// called by left node
@@ -93,7 +122,7 @@ private:
 	int idxi_shift_from_right( BTnode *right, BTnode *anchor );
 	int idxi_process_underflow( BTnode *left, BTnode *right, BTnode *LAnchor, BTnode *RAnchor );
 	int idxi_delete_from_node( HU_int *key, int lpage, BTnode *left, BTnode *right, BTnode *LAnchor, BTnode *RAnchor );
-	BTnode* idxi_read_file( fstream&, int, int, int );
+	BTnode* idxi_read_file( fstream&, int, int, int, unsigned char*, BTree* );
 	void idxi_append( ListNode *tail );
 	int idxi_setup_parents();
 	int idxi_setup_nextptrs();
@@ -101,18 +130,68 @@ private:
 } ;
 
 
+/*============================================================================*/
+/*                            flat index file	                      	      */
+/*============================================================================*/
+
+/* The .idx file (see BTree::idx_write()) is made up of nodes that are all
+   flat_node_bytes long, so that node n begins n * flat_node_bytes into it.
+   Node 0 holds a BTflathdr. The others are a BTflatnode followed by their
+   columns, as in a BTnode: the lpages (leaf) or child node nos. (inner), the
+   keys, then their leading U_ints if a key takes more than one U_int. A node
+   refers to others by number, not address, so the file can be searched where
+   it is mapped into memory (see BTree::idx_read()).
+   A node keeps its number while it is in the index, so that only the nodes
+   changed since the file was written need to be written again; the numbers
+   of nodes that have been discarded are chained through their links, from
+   'free', for reuse.
+   An inner node holds only the words of its keys that differ: its first
+   U_int (where a leaf's unused lpage 0 is) is the no. of most significant
+   words that all of its keys share, shifted up 8 bits, plus the no. of
+   words left of each key once those and the least significant words that
+   are 0 in all of them (see BT_separator()) are dropped. The shared words
+   follow it, then the child node nos., the keys' remaining words and their
+   leading U_ints, each column size + 1 long. So an inner node holds many
+   more entries than a leaf (see BTree::idxi_fits()). In a file written
+   before this (BT_FLAT_MAGIC_1) that U_int is 0 and inner nodes are laid
+   out as leaves are. */
+
+#define BT_FLAT_MAGIC	0x3242544c	// "LTB2"
+#define BT_FLAT_MAGIC_1	0x4c425446	// "FTBL"
+#define BT_FLAT_ALIGN	64			// flat nodes are a whole no. of cache lines
+
+typedef struct {
+	U_int		magic;
+	U_int		key_words;
+	U_int		node_entries;
+	U_int		node_bytes;
+	U_int		nodes;			// inc. node 0
+	U_int		root;			// 0 if the index is empty
+	U_int		leaf_entries;	// the no. of pages indexed
+	U_int		free;			// the first free node; 0 if none
+} BTflathdr;
+
+typedef struct {
+	u2BYTES 	flags;
+	u2BYTES 	size;
+	U_int		link;			// the next leaf (leaf) or first child (inner); 0 if none
+} BTflatnode;
+
 /*============================================================================*/
 /*                            BTree	                          	      */
 /*============================================================================*/
 
 class BTree {
+	friend class BTnode;
+	friend class BTreeCursor;
 public:
 	BTree();
-	BTree( string name, int dims, int n_entries );			// constructor
+	BTree( string name, int kwords, int n_entries );			// constructor
 	~BTree();							// destructor
-	BTnode	*root;
+	BTnode	*root;						// NULL while the index is mapped (see idx_root())
 	
 	int idx_insert_key( HU_int *key, int lpage );
+	int idx_bulk_load( const HU_int *keys, const int *lpages, int num, int fill = 100 );
 	int idx_delete_key( HU_int *key, int lpage );
 	int idx_search( HU_int *key );
 	void idx_dump( string );
@@ -122,20 +201,96 @@ public:
 	int idx_get_next( HU_int *key, int lpage );
 	int idx_get_prev( HU_int *key, int lpage );
 	HU_int* idx_get_next_key( HU_int *key, int lpage );
+	HU_int* idx_search_next_key( HU_int *key );
+	BTnode* idx_root();
 
 private:
 	string name;
-	int dimensions;
-	int node_entries;					// no. of elements in a node (inc. header)
-	int node_entry_size;				// no. of bytes in a node element
+	int key_words;						// no. of U_ints in a key
+	int node_entries;					// no. of elements in a leaf (inc. header)
+	int inner_entries;					// and in an inner node
+	int node_entry_size;				// no. of bytes in a node element in an old .idx file
+	int flat_node_bytes;				// no. of bytes in a node in the .idx file
 	fstream idxfile;
+	const unsigned char *flat;			// the .idx file, while it is mapped
+	size_t flat_bytes;
+	string flat_name;					// the .idx file that the nodes' flat_no's refer to
+	BTflathdr flat_hdr;					// and its header
+	set<BTnode*> dirty;					// nodes changed since it was written
+	vector<U_int> freed;				// its nodes discarded since it was written
+	unsigned long changes;				// counts changes that move entries (see BTreeCursor)
 
 	void idxi_make_new_root( BTnode *right, HU_int *newkey );
 	void idxi_split_leaf( BTnode *p );
 	void idxi_split_inner( BTnode *p );
 	void idxi_insert_in_node( BTnode *p, HU_int *key, int lpage, BTnode *q );
-	int idxi_write_file( BTnode *node );
+	int idxi_write_flat();
+	int idxi_write_changes();
+	void idxi_node_to_flat( BTnode *p, unsigned char *node );
+	void idxi_write_node( U_int n, const unsigned char *node );
+	void idxi_discard( BTnode *p );
+	void idxi_trim( BTnode *p, int *pre, int *width ) const;
+	int idxi_inner_bytes( int size, int pre, int width ) const;
+	bool idxi_fits( BTnode *p ) const;
+	void idxi_split_unfit();
+	BTnode* idxi_search_leaf( HU_int *key, int *slot );
+	static bool idxi_flat_order( const BTnode *a, const BTnode *b );
+	int idxi_map_file( string filename );
+	void idxi_unmap_file();
+	void idxi_materialise();
+	BTnode* idxi_flat_to_node( U_int n, BTnode *parent, BTnode **last_leaf );
+	const BTflatnode* idxi_flat_node( U_int n, const U_int **ref, const U_int **keys,
+		const U_int **lead ) const;
+	void idxi_flat_inner( const BTflatnode *h, const U_int **ref, const U_int **keys,
+		const U_int **lead, const U_int **prefix, int *low, int *width ) const;
+	int idxi_flat_inner_slot( const BTflatnode *h, HU_int *key, const U_int **ref ) const;
+	const BTflatnode* idxi_flat_find_leaf( HU_int *key, int *slot, const U_int **ref,
+		const U_int **keys ) const;
 	int idx_get_last_page();
 };
 
+/*============================================================================*/
+/*                            BTreeCursor	                      	      */
+/*============================================================================*/
+
+/* A position on an entry (a page) in a leaf of a BTree, in memory or in the
+   mapped index file, from which the pages around it are found without a
+   descent from the root. cur_next() and cur_prev() step along the leaf and
+   on to the next leaf by its nextptr (its link in the file); leaves have no
+   pointer back, so stepping back out of a leaf is a descent. cur_seek() for
+   a key above the current one looks at the current leaf and the
+   BT_CURSOR_HOPS leaves that follow it before descending. Once the tree is
+   changed, the cursor is put back on the key it was on the next time it is
+   used. */
+
+#define BT_CURSOR_HOPS	2
+
+class BTreeCursor {
+public:
+	BTreeCursor( BTree *bt );			// constructor
+
+	int cur_seek( HU_int *key );		// as idx_search()
+	int cur_next();						// -1 if on the last page
+	int cur_prev();						// -1 if on the first page
+	int cur_lpage();
+	HU_int* cur_key();
+	HU_int* cur_next_key();				// NULL if on the last page
+
+private:
+	BTree	*tree;
+	bool	positioned;
+	BTnode	*leaf;						// the leaf it is on, in memory...
+	U_int	flat_leaf;					// ...or in the mapped index file
+	int		slot;
+	unsigned long changes;				// tree->changes when it was positioned
+	HU_int	at[HKEY_MAX_WORDS];			// the key in 'slot'
+
+	void curi_check();
+	bool curi_descend( HU_int *key );
+	void curi_leaf( const U_int **keys, const U_int **lead, int *size ) const;
+	const U_int* curi_next_leaf() const;
+	void curi_to_next_leaf();
+	void curi_moved();
+};
+
 #endif // _BTREE_H
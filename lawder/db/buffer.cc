@@ -8,43 +8,83 @@
 	#include "../utils/utils.h"
 #endif
 #include <stdio.h>
+#ifdef DIRECT_IO
+	#include <unistd.h>	// for pread(), pwrite()
+#endif
 
 using namespace std;
 
 
 #define debug 1
 
-// db flags
-#define		ALREADY_PRESENT		-1
-#define		NOT_PRESENT		-1
+// counted since the database was opened (see db.cc)
+extern int	Pages_retrieved, Disk_reads;
 
 // work needs to be done to allow this to be set to 1
 // BUFF_PAGE's would need access to DBASE* (or possibly just Ret_sets)
 // Ret_sets would ideally want to know lpages - but they do know buffslots
 #define		ALLOW_UPDATES		0
 
+// BUFFER::b_ascending is a fraction out of ASCEND_ONE, each insertion
+// having a weight of 1 / ASCEND_WEIGHT
+#define		ASCEND_ONE		1024
+#define		ASCEND_WEIGHT		16
+
 /*============================================================================*/
 /*                     BUFF_PAGE::BUFF_PAGE				    */
 /*============================================================================*/
-BUFF_PAGE::BUFF_PAGE( int dims, int p_entries, MED *m )
-	: BPage( dims, p_entries, m )
+// frame_bytes - see PAGE::PAGE()
+BUFF_PAGE::BUFF_PAGE( int dims, int order, const SF_CURVE *curve, bool keys,
+	int p_entries, MED *m, int frame_bytes )
+	: BPage( dims, order, curve, keys, p_entries, m, frame_bytes )
 {
 	dimensions = dims;
-	bp_page_entry_bytes = sizeof(U_int) * dimensions;
+	bp_page_entry_bytes = BPage.p_page_entry_size;
 	mod = fix = query = false;	// not needed?
 	lru = 0;				// not needed?
+	columns = NULL;			// see bp_columns()
+	cols_valid = false;
 }
 
 /*============================================================================*/
 /*                     BUFF_PAGE::~BUFF_PAGE				    */
 /*============================================================================*/
-// BUFF_PAGE::~BUFF_PAGE(){}
+BUFF_PAGE::~BUFF_PAGE()
+{
+	delete [] columns;
+}
+
+/*============================================================================*/
+/***                   BUFF_PAGE::bp_columns				    ***/
+/*============================================================================*/
+// the page's coordinates, column by column; the columns are only allocated
+// once they are first needed, as range queries only filter by column if
+// DBASE::db_range_columns() has been turned on
+const PU_int* BUFF_PAGE::bp_columns()
+{
+	int	i, d, stride = BPage.p_page_entries;
+
+	if (columns == NULL)
+	{
+		columns = new PU_int[dimensions * stride];
+		cols_valid = false;
+	}
+	if (!cols_valid)
+	{
+		for (i = 1; i <= BPage.page_hdr->size; i++)
+			for (d = 0; d < dimensions; d++)
+				columns[d * stride + i] = BPage.data[i][d];
+		cols_valid = true;
+	}
+	return columns;
+}
 
 /*============================================================================*/
 /***                   BUFF_PAGE::bp_insert_on_page			    ***/
 /*============================================================================*/
 //int BUFF_PAGE::bp_insert_on_page(DBASE & DB, Point& DATA)
-int BUFF_PAGE::bp_insert_on_page( const PU_int * const DATA )
+// 'key' is DATA's hcode, if known; it is kept on pages that keep hcodes
+int BUFF_PAGE::bp_insert_on_page( const PU_int * const DATA, const HU_int * const key )
 {
 	int pageslot, nobj;
 
@@ -56,12 +96,21 @@ int BUFF_PAGE::bp_insert_on_page( const PU_int * const DATA )
 	pageslot *= -1;
 
 	nobj = bp_page_entry_bytes * (BPage.page_hdr->size - pageslot + 1);
-	memmove(BPage.data[pageslot + 1], BPage.data[pageslot], nobj);
+	if (nobj > 0)	// data[pageslot + 1] may be beyond the last element
+		memmove(BPage.data[pageslot + 1], BPage.data[pageslot], nobj);
 	keycopy ( BPage.data[pageslot], DATA, dimensions );
+	if (BPage.keys)
+	{
+		if (key != NULL)
+			keycopy( BPage.p_key( pageslot ), key, BPage.key_words );
+		else
+			BPage.curve->encode( BPage.p_key( pageslot ), DATA, dimensions, BPage.order );
+	}
 
 	BPage.page_hdr->size++;
 
 	mod = true; // CHANGED;
+	cols_valid = false;
 
 #if ALLOW_UPDATES
 // ..................need to make 'query' boolean and Ret_set visiblee
@@ -94,12 +143,16 @@ int BUFF_PAGE::bp_delete_from_page( PU_int *DATA )
 
 	pageslot = BPage.p_find_pageslot(DATA);  //@@@
 	if (pageslot < 1)
+	{
+		fix = query; // finished with it
 		return NOT_PRESENT;
+	}
 
 	nobj = bp_page_entry_bytes * (BPage.page_hdr->size - pageslot);
 	memmove(BPage.data[pageslot], BPage.data[pageslot + 1], nobj);
 	BPage.page_hdr->size--;
 	mod = true; // CHANGED;
+	cols_valid = false;
 	fix = query; // finished with it
 
 #if ALLOW_UPDATES
@@ -124,8 +177,13 @@ int BUFF_PAGE::bp_delete_from_page( PU_int *DATA )
 /*============================================================================*/
 /*                    BUFFER::BUFFER				    */
 /*============================================================================*/
-BUFFER::BUFFER( int dims, int b_slots, int p_entries, DBASE *db )
+// if 'packed', pages are packed on disk (see PAGE::p_pack()); if 'aligned',
+// they are padded on disk to a power of two multiple of PAGE_ALIGN bytes
+BUFFER::BUFFER( int dims, int order, const SF_CURVE *curve, bool keys,
+	bool packed, bool aligned, int split, int b_slots, int p_entries, DBASE *db )
 {
+	int	frame;
+
 	DB =	db;
 
 	if ( THRESHOLD + EXTRA_RECORDS > p_entries )
@@ -133,9 +191,22 @@ BUFFER::BUFFER( int dims, int b_slots, int p_entries, DBASE *db )
 		p_entries = THRESHOLD + EXTRA_RECORDS;
 	}
 
+	if (packed)
+		b_page_bytes = PACKED_PAGE_BYTES( dims, order, keys, p_entries );
+	else
+		b_page_bytes = PAGE_BYTES( dims, keys ? HKEY_WORDS( dims, order ) : 0, p_entries );
+	if (aligned)
+	{
+		for (frame = PAGE_ALIGN; frame < b_page_bytes; frame *= 2)
+			;
+		b_page_bytes = frame;
+	}
+
+	// unpacked pages are read and written straight from their buffer slots
 	for ( int i = 0; i < b_slots; i++ )
 	{
-		BSlot.push_back( new BUFF_PAGE( dims, p_entries, &DB->dbMED ) );
+		BSlot.push_back( new BUFF_PAGE( dims, order, curve, keys, p_entries, &DB->dbMED,
+			aligned && !packed ? b_page_bytes : 0 ) );
 	}
 
 	dimensions = dims;
@@ -143,7 +214,20 @@ BUFFER::BUFFER( int dims, int b_slots, int p_entries, DBASE *db )
 	// (b_slots - 1) because num_Bslots are numbered in the range [ 0 .. num_Bslots-1 ]
 	free_Bslots = b_slots-1;
 	LRU = 0;
-	b_page_bytes = sizeof(pageheader_t) + p_entries * sizeof(U_int) * dimensions;
+
+	// an empty page on disk (all zeroes, packed or not) and, if pages are
+	// packed, a packed page, each in a frame that's aligned if pages are.
+	// +1: PAGE::p_unpack() reads one U_int beyond the page
+	frame = b_page_bytes + (aligned ? PAGE_ALIGN : sizeof(U_int));
+	b_frames = new unsigned char[2 * frame + PAGE_ALIGN - 1];
+	b_empty = aligned ? ALIGN_UP( b_frames ) : b_frames;
+	memset( b_empty, 0, 2 * frame );
+	b_packed = packed ? reinterpret_cast<U_int*>(b_empty + frame) : NULL;
+	b_split = split;
+	b_key_words = HKEY_WORDS( dims, order );
+	b_last_key = new HU_int[b_key_words];
+	memset( b_last_key, 0, sizeof(HU_int) * b_key_words );
+	b_ascending = ASCEND_ONE / 2;
 }
 
 /*============================================================================*/
@@ -153,6 +237,8 @@ BUFFER::~BUFFER()
 {
 	for (int i = BSlot.size() - 1; i >= 0; i--)
 		delete BSlot[i];
+	delete [] b_frames;
+	delete [] b_last_key;
 
 /* not needed  ????
 
@@ -255,7 +341,8 @@ void BUFFER::Buff_idx_erase(int lpage, int buffslot)
 /*============================================================================*/
 /***                   BUFFER::b_get_buffer_slot	  		    ***/
 /*============================================================================*/
-/* returns a free buffer slot, swapping a page out if necessary */
+/* returns a free buffer slot, swapping a page out if necessary; the slot is
+   about to receive a page so any columns it holds are out of date */
 inline int BUFFER::b_get_buffer_slot()
 {
 	int buffslot;
@@ -274,6 +361,7 @@ inline int BUFFER::b_get_buffer_slot()
 #endif
 		buffslot = FreeBufferList.top();
 		FreeBufferList.pop();
+		BSlot[buffslot]->cols_valid = false;
 		return buffslot;
 	}
 
@@ -290,13 +378,16 @@ inline int BUFFER::b_get_buffer_slot()
 //			errorexit( "ERROR in b_get_buffer_slot()\n" );
 		buffslot = free_Bslots;
 		free_Bslots--;
+		BSlot[buffslot]->cols_valid = false;
 		return buffslot;
 	}
 #ifdef JKLDEBUGxxx
 	cout << "Calling b_swapout" << endl;
 #endif
 
-	return b_swapout();
+	buffslot = b_swapout();
+	BSlot[buffslot]->cols_valid = false;
+	return buffslot;
 }
 
 /*============================================================================*/
@@ -315,11 +406,7 @@ int BUFFER::b_swapout()
 	int buffslot = iter->second;
 	if (true == BSlot[buffslot]->mod)
 	{
-		int offset = BSlot[buffslot]->BPage.page_hdr->lpage * b_page_bytes;
-
-		DB->fDB.seekp( offset, ios::beg );
-		DB->fDB.write( reinterpret_cast<char*>(BSlot[buffslot]->BPage.raw_data), b_page_bytes );
-		if (! DB->fDB)
+		if (! b_write_page( buffslot ))
 			errorexit("ERROR 2 in b_swapout(): writing to database\n");
 
 //		BSlot[buffslot]->mod = BSlot[buffslot]->query = 0; - do in page_retrieve()
@@ -331,12 +418,90 @@ int BUFFER::b_swapout()
 	return buffslot;
 }
 
+/*============================================================================*/
+/***                   BUFFER::b_write_page				    ***/
+/*============================================================================*/
+// writes the page in 'buffslot' to the database, packing it if pages are
+// packed; returns false if the write failed
+bool BUFFER::b_write_page( int buffslot )
+{
+	PAGE	&P = BSlot[buffslot]->BPage;
+	char	*out = reinterpret_cast<char*>(P.raw_data);
+
+	if (b_packed != NULL)
+	{
+		P.p_pack( b_packed );
+		out = reinterpret_cast<char*>(b_packed);
+	}
+	return b_write( out, P.page_hdr->lpage );
+}
+
+/*============================================================================*/
+/***                   BUFFER::b_write_empty_page			    ***/
+/*============================================================================*/
+// writes an empty page to page 'lpage' of the database, eg at its end
+bool BUFFER::b_write_empty_page( int lpage )
+{
+	return b_write( reinterpret_cast<char*>(b_empty), lpage );
+}
+
+/*============================================================================*/
+/***                   BUFFER::b_write					    ***/
+/*============================================================================*/
+// writes a page on disk, 'out', to page 'lpage' of the database: directly, if
+// the database was opened for direct I/O (see DBASE::db_direct_io())
+bool BUFFER::b_write( const char *out, int lpage )
+{
+#ifdef DIRECT_IO
+	if (DB->fdDB >= 0)
+		return pwrite( DB->fdDB, out, b_page_bytes,
+			(off_t)lpage * b_page_bytes ) == b_page_bytes;
+#endif
+	DB->fDB.seekp( (long)lpage * b_page_bytes, ios::beg );
+	DB->fDB.write( out, b_page_bytes );
+	return DB->fDB.good();
+}
+
+/*============================================================================*/
+/***                   BUFFER::b_read					    ***/
+/*============================================================================*/
+// reads page 'lpage' of the database, as it is on disk, into 'in'
+bool BUFFER::b_read( char *in, int lpage )
+{
+#ifdef DIRECT_IO
+	if (DB->fdDB >= 0)
+		return pread( DB->fdDB, in, b_page_bytes,
+			(off_t)lpage * b_page_bytes ) == b_page_bytes;
+#endif
+	DB->fDB.seekg( (long)lpage * b_page_bytes, ios::beg );
+	DB->fDB.read( in, b_page_bytes );
+	return DB->fDB.good();
+}
+
+/*============================================================================*/
+/***                   BUFFER::b_read_page				    ***/
+/*============================================================================*/
+// reads page 'lpage' from the database into 'buffslot', unpacking it if
+// pages are packed; returns false if the read failed
+bool BUFFER::b_read_page( int buffslot, int lpage )
+{
+	PAGE	&P = BSlot[buffslot]->BPage;
+	char	*in = b_packed != NULL ? reinterpret_cast<char*>(b_packed)
+				: reinterpret_cast<char*>(P.raw_data);
+
+	if (! b_read( in, lpage ))
+		return false;
+	if (b_packed != NULL)
+		P.p_unpack( b_packed );
+	return true;
+}
+
 /*============================================================================*/
 /***                   BUFFER::b_page_retrieve				    ***/
 /*============================================================================*/
 int BUFFER::b_page_retrieve( int lpage )
 {
-	int offset, buffslot = in_Buffer(lpage);
+	int buffslot = in_Buffer(lpage);
 
 	if (buffslot > -1)
 		BSlot[buffslot]->lru = inc_LRU(buffslot);
@@ -345,12 +510,7 @@ int BUFFER::b_page_retrieve( int lpage )
 		buffslot = b_get_buffer_slot();
 
 		/* read the page in and insert in buffer index */
-		offset = lpage * b_page_bytes;
-
-		DB->fDB.seekg( offset, ios::beg );
-		DB->fDB.read( reinterpret_cast<char*>(BSlot[buffslot]->BPage.raw_data),
-			b_page_bytes );
-		if (! DB->fDB)
+		if (! b_read_page( buffslot, lpage ))
 			errorexit("ERROR 1 in page_retrieve(): "
 				"reading database\n");
 
@@ -362,11 +522,11 @@ int BUFFER::b_page_retrieve( int lpage )
 		BSlot[buffslot]->BPage.page_hdr->lpage = lpage;
 		BSlot[buffslot]->mod = BSlot[buffslot]->query = false;
 
-//		Disk_reads++;
+		Disk_reads++;
 	}
 	BSlot[buffslot]->fix = true; // FIXED;
 
-//	Pages_retrieved++;
+	Pages_retrieved++;
 
 	return buffslot;
 }
@@ -374,7 +534,8 @@ int BUFFER::b_page_retrieve( int lpage )
 /*============================================================================*/
 /***                   BUFFER::b_data_insert				    ***/
 /*============================================================================*/
-int BUFFER::b_data_insert( PU_int *data, int lpage )
+// 'key' is the hcode of 'data', if known
+int BUFFER::b_data_insert( PU_int *data, int lpage, const HU_int * const key )
 {
 	int i, buffslot = b_page_retrieve( lpage );
 
@@ -404,7 +565,18 @@ int BUFFER::b_data_insert( PU_int *data, int lpage )
 	}
 #endif
 
-	i = BSlot[buffslot]->bp_insert_on_page( data );
+	i = BSlot[buffslot]->bp_insert_on_page( data, key );
+	if (i != ALREADY_PRESENT)
+		DB->dbi_page_mbr_extend( lpage, data );
+	if (i != ALREADY_PRESENT && key != NULL)
+	{
+		// a moving average of how often the hcodes of insertions go up
+		if (keycmp( key, b_last_key, b_key_words ) > 0)
+			b_ascending += (ASCEND_ONE - b_ascending) / ASCEND_WEIGHT;
+		else
+			b_ascending -= b_ascending / ASCEND_WEIGHT;
+		keycopy( b_last_key, key, b_key_words );
+	}
 
 //	if (i == MAX_DATA)
 	if (i == BSlot[buffslot]->BPage.p_page_entries - 1)
@@ -435,7 +607,7 @@ int BUFFER::b_data_insert( PU_int *data, int lpage )
 int BUFFER::b_data_delete( PU_int *data, int lpage )
 {
 	int buffslot = b_page_retrieve( lpage );
-	int MIN_DAT = (int)((double)(BSlot[0]->BPage.p_page_entries - 1) * 4 / 10);
+	int MIN_DAT = b_min_records();
 
 #if ALLOW_UPDATES
 	if (true == BSlot[buffslot]->query && BSlot[buffslot]->BPage.page_hdr->size <= MIN_DAT)
@@ -473,7 +645,7 @@ int BUFFER::b_data_delete( PU_int *data, int lpage )
 		b_process_underflow( buffslot );        /* deals with flags */
 
 //#if debug
-	if ((int)Buff_idx.size() != num_Bslots - free_Bslots - 1)
+	if ((int)Buff_idx.size() != num_Bslots - free_Bslots - 1 - (int)FreeBufferList.size())
 	{
 		cout << "Buff_idx.size(): " << Buff_idx.size()
 			<< " num_Bslots: " << num_Bslots
@@ -512,7 +684,10 @@ int BUFFER::b_process_overflow( int oflowslot )
 	newlpage = DB->dbi_get_new_page();
 
 // 	split oflowslot between newleft & newright - this also assigns with page nos. & page keys
-	BSlot[oflowslot]->BPage.p_split_page( BSlot[newleft]->BPage, BSlot[newright]->BPage, newlpage );
+	BSlot[oflowslot]->BPage.p_split_page( BSlot[newleft]->BPage, BSlot[newright]->BPage, newlpage,
+		b_split_share( oflowslot ) );
+	DB->dbi_page_mbr( BSlot[newleft]->BPage );
+	DB->dbi_page_mbr( BSlot[newright]->BPage );
 
 //	release oflowslot - MUST be done before insertions into the indexes
 	Buff_idx_erase( BSlot[oflowslot]->BPage.page_hdr->lpage, oflowslot ); // deals with LRU_idx too
@@ -538,6 +713,44 @@ int BUFFER::b_process_overflow( int oflowslot )
 	return newright;
 }
 
+/*============================================================================*/
+/***                   BUFFER::b_split_share				    ***/
+/*============================================================================*/
+/* the percentage of a full page's records that are to stay on the left page
+   when it's split, according to the split policy. When records are inserted
+   in ascending hcode order, the left page gets no more of them, so it may as
+   well be left nearly full (and the right page when they descend) */
+int BUFFER::b_split_share( int oflowslot )
+{
+	switch (b_split)
+	{
+	case SPLIT_APPEND:
+		// only the last page is appended to
+		if (BSlot[oflowslot]->BPage.page_hdr->lpage == DB->LastPage)
+			return 90;
+		return 50;
+	case SPLIT_ADAPTIVE:
+		// from 10% when the hcodes of recent insertions have only gone down
+		// to 90% when they have only gone up
+		return 10 + 80 * b_ascending / ASCEND_ONE;
+	default:
+		return 50;
+	}
+}
+
+/*============================================================================*/
+/***                   BUFFER::b_min_records				    ***/
+/*============================================================================*/
+/* the no. of records at or below which a page underflows: MIN_OCCUPANCY
+   percent of a full page's, or SKEW_MIN_OCCUPANCY percent under a policy whose
+   splits may leave fewer than MIN_OCCUPANCY percent on a page, so that the
+   first deletion from a page just split doesn't undo the split */
+int BUFFER::b_min_records()
+{
+	return (int)((double)(BSlot[0]->BPage.p_page_entries - 1) *
+		(b_split == SPLIT_MEDIAN ? MIN_OCCUPANCY : SKEW_MIN_OCCUPANCY) / 100);
+}
+
 /*============================================================================*/
 /***                   BUFFER::b_process_underflow			    ***/
 /*============================================================================*/
@@ -575,9 +788,10 @@ int BUFFER::b_process_underflow( int uflowslot )
 		}
 	}
 
-	/* get prev page's lpage */
+	/* get prev page's lpage: page 0, the first, may be one but (never being
+	   merged into its left) it's never a next page */
 	PageLeft = DB->BT.idx_get_prev( BSlot[uflowslot]->BPage.index, uflowpage );
-	if (PageLeft > 0)
+	if (PageLeft >= 0)
 	{
 		left++;  // a left hand page exists
 
@@ -601,8 +815,11 @@ int BUFFER::b_process_underflow( int uflowslot )
 	}
 
 	if (left == 0 && right == 0) // this is the only page in the database
+	{
 		if (DB->nextPID - DB->NumFreePages > 1)
 			errorexit("ERROR 1 in b_process_underflow(): cannot find page to merge with\n");
+		return -1;	// which may hold any no. of records
+	}
 
 
 // second priority: SHIFT from a page that's ALREADY in the buffer
@@ -676,6 +893,7 @@ int BUFFER::b_merge_pages( int left, int right )
 				  "part in\nmerge swapped out.of buffer\n");
 
 	BSlot[newleft]->BPage.p_merge_pages( BSlot[left]->BPage, BSlot[right]->BPage );
+	DB->dbi_page_mbr( BSlot[newleft]->BPage );
 
 // NB currently the following situation can't happen as it's prevented within b_process_underflow()
 #if ALLOW_UPDATES  // make this into a separate function at some point
@@ -778,7 +996,13 @@ int BUFFER::b_shift_from_left( int left, int right )
 
 	if (BSlot[left]->BPage.p_shift_from_left( BSlot[right]->BPage,
 			BSlot[newleft]->BPage, BSlot[newright]->BPage ))
-		return 1; // the median was found on the right page instead of the left
+	{
+		// the median was found on the right page instead of the left: nothing
+		// moves, so the new slots aren't needed
+		FreeBufferList.push( newleft );
+		FreeBufferList.push( newright );
+		return 1;
+	}
 
 	return b_admin( left, right, newleft, newright ); // update buffer, index, etc
 }
@@ -820,7 +1044,13 @@ int BUFFER::b_shift_from_right( int left, int right )
 
 	if (BSlot[left]->BPage.p_shift_from_right(BSlot[right]->BPage,
 			BSlot[newleft]->BPage, BSlot[newright]->BPage))
-		return 1; // the median was found on the left page instead of the right
+	{
+		// the median was found on the left page instead of the right: nothing
+		// moves, so the new slots aren't needed
+		FreeBufferList.push( newright );
+		FreeBufferList.push( newleft );
+		return 1;
+	}
 
 	return b_admin( left, right, newleft, newright ); // update buffer, index, etc
 }
@@ -831,6 +1061,9 @@ int BUFFER::b_shift_from_right( int left, int right )
 // tidy up after shift_from_left or shift_from_right
 int BUFFER::b_admin( int left, int right, int newleft, int newright )
 {
+	DB->dbi_page_mbr( BSlot[newleft]->BPage );
+	DB->dbi_page_mbr( BSlot[newright]->BPage );
+
 //	release vacated buffer slots
 	Buff_idx_erase( BSlot[left]->BPage.page_hdr->lpage, left );
 	Buff_idx_erase( BSlot[right]->BPage.page_hdr->lpage, right );
@@ -18,6 +18,10 @@
 
 #include "page.h"
 
+// db flags
+#define		ALREADY_PRESENT		-1
+#define		NOT_PRESENT		-1
+
 class DBASE;
 class MED;
 
@@ -32,20 +36,30 @@ class BUFF_PAGE {
 
 private:
 
-	BUFF_PAGE( int dims, int p_entries, MED *m );
-//	~BUFF_PAGE(); not needed
+	BUFF_PAGE( int dims, int order, const SF_CURVE *curve, bool keys, int p_entries, MED *m,
+		int frame_bytes = 0 );
+	~BUFF_PAGE();
 
 	bool	mod, fix, query;
 	U_int	lru;
 	PAGE	BPage;
 	
-	int bp_insert_on_page( const PU_int* const );
+	int bp_insert_on_page( const PU_int* const, const HU_int* const key = NULL );
 	int bp_delete_from_page( PU_int* );
+	const PU_int* bp_columns();
 
 //private:	
 	
 	int	dimensions;
 	int	bp_page_entry_bytes;
+
+	// the coordinates of the page's records held column by column, for range
+	// queries' filtering: coordinate d of the record in slot i is
+	// columns[d * BPage.p_page_entries + i]. They are copied from the page
+	// when first needed after the page last changed, and NULL until they are
+	// first needed
+	PU_int	*columns;
+	bool	cols_valid;
 };
 
 /*============================================================================*/
@@ -60,14 +74,15 @@ class BUFFER {
 
 private:
 	
-	BUFFER( int dims, int b_slots, int p_entries, DBASE* );
+	BUFFER( int dims, int order, const SF_CURVE *curve, bool keys, bool packed,
+		bool aligned, int split, int b_slots, int p_entries, DBASE* );
 	~BUFFER();
 	
 	int			num_Bslots;
 	vector<BUFF_PAGE*>	BSlot;
 
 	int b_page_retrieve( int );
-	int b_data_insert( PU_int*, int );
+	int b_data_insert( PU_int*, int, const HU_int* const key = NULL );
 	int b_data_delete( PU_int*, int );
 
 // private:		
@@ -76,7 +91,14 @@ private:
 	int		dimensions;
 	U_int		LRU;
 	int		free_Bslots;	// available buffslots; in the range 0-numBslots-1
-	int		b_page_bytes;	// no. of bytes in a page
+	int		b_page_bytes;	// no. of bytes in a page on disk
+	unsigned char	*b_frames;	// what b_empty and b_packed were allocated from
+	unsigned char	*b_empty;	// an empty page on disk
+	U_int		*b_packed;		// a packed page, if pages are packed on disk
+	int		b_split;		// the split policy, eg SPLIT_MEDIAN (see db.h)
+	int		b_key_words;	// no. of U_ints in an hcode
+	HU_int		*b_last_key;	// the hcode of the last record inserted
+	int		b_ascending;	// see b_split_share()
 	
 	stack<int>	FreeBufferList;	// free buffer slot list
 	map<U_int, int>	LRU_idx;	// < lru, buffslot >
@@ -89,9 +111,16 @@ private:
 	U_int inc_LRU( int );
 
 	int b_process_overflow( int );
+	int b_split_share( int );
+	int b_min_records();
 	int b_process_underflow( int );
 
 	inline int b_get_buffer_slot();
+	bool b_write_page( int );
+	bool b_read_page( int, int );
+	bool b_write_empty_page( int );
+	bool b_write( const char*, int );
+	bool b_read( char*, int );
 	int b_swapout();
 
 	int b_merge_pages( int, int );
@@ -0,0 +1,134 @@
+// db/columns.cc
+
+/*----------------------------------------------------------------------------*/
+/*	THIS FILE CONTAINS THE FILTER APPLIED BY RANGE QUERIES TO THE	      */
+/*	COORDINATES OF A PAGE HELD COLUMN BY COLUMN (SEE BUFF_PAGE)	      */
+/*----------------------------------------------------------------------------*/
+
+#ifdef __MSDOS__
+	#include "..\gendefs.h"
+#else
+	#include "../gendefs.h"
+#endif
+#include "columns.h"
+
+using namespace std;
+
+/* Records are tested a block at a time, a dimension at a time, and a block
+   whose records have all failed is not tested against the remaining
+   dimensions. Where the processor supports AVX2 (SSE4.1) a block is 8 (4)
+   records, compared at once; as with the other SIMD code, that code is
+   compiled for the instruction set regardless of the compiler flags and only
+   called when the CPU is found to support it at run time. */
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+	#define COL_SIMD
+	#include <immintrin.h>
+#endif
+
+/*============================================================================*/
+/*                            COL_filter_scalar				      */
+/*============================================================================*/
+// records first + done to last
+static void COL_filter_scalar( const PU_int *columns, int stride, int dims,
+		int first, int done, int last, const PU_int *LB, const PU_int *UB,
+		U_int *matches )
+{
+	int		i, d;
+	PU_int	x;
+
+	for (i = first + done; i <= last; i++)
+	{
+		for (d = 0; d < dims; d++)
+		{
+			x = columns[d * stride + i];
+			if (x < LB[d] || x > UB[d])
+				break;
+		}
+		if (d == dims)
+			matches[(i - first) / WORDBITS] |= (U_int)1 << ((i - first) % WORDBITS);
+	}
+}
+
+#ifdef COL_SIMD
+/*============================================================================*/
+/*                            COL_filter_sse4				      */
+/*============================================================================*/
+// returns the no. of records tested
+__attribute__((target("sse4.1")))
+static int COL_filter_sse4( const PU_int *columns, int stride, int dims,
+		int first, int last, const PU_int *LB, const PU_int *UB, U_int *matches )
+{
+	int		i, d, n, mask;
+	__m128i	x, in;
+
+	for (n = 0; first + n + 3 <= last; n += 4)
+	{
+		i = first + n;
+		mask = 0xf;
+		for (d = 0; d < dims && mask; d++)
+		{
+			x = _mm_loadu_si128( (const __m128i*)(columns + d * stride + i) );
+			// LB <= x <= UB, unsigned: max( x, LB ) == x && min( x, UB ) == x
+			in = _mm_and_si128(
+				_mm_cmpeq_epi32( _mm_max_epu32( x, _mm_set1_epi32( (int)LB[d] ) ), x ),
+				_mm_cmpeq_epi32( _mm_min_epu32( x, _mm_set1_epi32( (int)UB[d] ) ), x ) );
+			mask &= _mm_movemask_ps( _mm_castsi128_ps( in ) );
+		}
+		matches[n / WORDBITS] |= (U_int)mask << (n % WORDBITS);
+	}
+	return n;
+}
+
+/*============================================================================*/
+/*                            COL_filter_avx2				      */
+/*============================================================================*/
+// returns the no. of records tested
+__attribute__((target("avx2")))
+static int COL_filter_avx2( const PU_int *columns, int stride, int dims,
+		int first, int last, const PU_int *LB, const PU_int *UB, U_int *matches )
+{
+	int		i, d, n, mask;
+	__m256i	x, in;
+
+	for (n = 0; first + n + 7 <= last; n += 8)
+	{
+		i = first + n;
+		mask = 0xff;
+		for (d = 0; d < dims && mask; d++)
+		{
+			x = _mm256_loadu_si256( (const __m256i*)(columns + d * stride + i) );
+			in = _mm256_and_si256(
+				_mm256_cmpeq_epi32( _mm256_max_epu32( x, _mm256_set1_epi32( (int)LB[d] ) ), x ),
+				_mm256_cmpeq_epi32( _mm256_min_epu32( x, _mm256_set1_epi32( (int)UB[d] ) ), x ) );
+			mask &= _mm256_movemask_ps( _mm256_castsi256_ps( in ) );
+		}
+		matches[n / WORDBITS] |= (U_int)mask << (n % WORDBITS);
+	}
+	return n;
+}
+#endif
+
+/*============================================================================*/
+/*                            COL_range_filter				      */
+/*============================================================================*/
+void COL_range_filter( const PU_int *columns, int stride, int dims, int first,
+		int last, const PU_int *LB, const PU_int *UB, U_int *matches )
+{
+	int done = 0;
+
+	if (last < first)
+		return;
+	memset( matches, 0, sizeof(U_int) * ((last - first) / WORDBITS + 1) );
+
+#ifdef COL_SIMD
+	static const bool avx2 = __builtin_cpu_supports( "avx2" );
+	static const bool sse4 = __builtin_cpu_supports( "sse4.1" );
+
+	if (avx2)
+		done = COL_filter_avx2( columns, stride, dims, first, last, LB, UB, matches );
+	else if (sse4)
+		done = COL_filter_sse4( columns, stride, dims, first, last, LB, UB, matches );
+#endif
+	COL_filter_scalar( columns, stride, dims, first, done, last, LB, UB, matches );
+}
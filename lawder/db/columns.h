@@ -0,0 +1,12 @@
+// db/columns.h
+
+#ifndef _COLUMNS_H
+#define _COLUMNS_H
+
+// sets bit (i - first) of 'matches' for each record i, first <= i <= last,
+// whose coordinates all lie within [LB, UB], and clears the other bits;
+// coordinate d of record i is columns[d * stride + i]
+void COL_range_filter( const PU_int *columns, int stride, int dims, int first,
+		int last, const PU_int *LB, const PU_int *UB, U_int *matches );
+
+#endif
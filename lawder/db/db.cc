@@ -1,5 +1,7 @@
 // Copyright (C) Jonathan Lawder 2001-2011
 
+#include <algorithm>	// for sort()
+#include <chrono>	// for the MBRs' generation
 #include <iomanip>
 #include "db.h"
 #ifdef __MSDOS__
@@ -11,6 +13,10 @@
 #endif
 #include <stdio.h> // for db_getquery()
 #include <stdlib.h> // for db_getquery()
+#ifdef DIRECT_IO
+	#include <fcntl.h>	// for open(), O_DIRECT
+	#include <unistd.h>	// for close()
+#endif
 
 #define		MAX_PAGES		UINT_MAX
 
@@ -31,114 +37,25 @@ fstream fjunk3;
 int		Pages_retrieved, Disk_reads;
 unsigned short SEED[] = {3000,1000,2000};
 
+// the split policies' names, eg for SPLIT_MEDIAN
+static const char	*split_name[] = {"median", "append", "adaptive"};
+
 
 /*============================================================================*/
 /***                   MED::constructor					    ***/
 /*============================================================================*/
-MED::MED( int dims, int p_entries )
+// the workspace is allocated once, for two pages' records
+MED::MED( int kwords, int p_entries )
 {
-	dimensions = dims;
+	key_words = kwords;
 
 	if ( THRESHOLD + EXTRA_RECORDS > p_entries )
 	{
 		p_entries = THRESHOLD + EXTRA_RECORDS;
 	}
 
-	#define MAX_DAT		(p_entries - 1)
-	#define MIN_DAT		MAX_DAT / 2 - MAX_DAT / 10
-
-	int i = p_median_calc_workspace( MAX_DAT + MIN_DAT + 10 ); // +10 for safety
-
-	for ( int j = 0; j < i; j++ )
-	{
-		Hcode h( dimensions );	// can this go outside the for loop?
-		MEDdata.push_back( h );
-	}
-
-#ifdef xJKLDEBUGxxxx
-	cout << "(in MED::MED) Contents of MEDdata :\n";
-	for ( int j = 0; j < i; j++ )
-	{
-		for (int i = 0; i < dims; i++)
-			cout << MEDdata[j].hcode[i]<< " ";
-		cout << j << endl;
-	}
-#endif
-
-	MEDmap.resize( MAX_DAT );
-	p_shuffle_medmap( MAX_DAT );
-
-
-#ifdef xJKLDEBUGxxxx
-	cout << "RAND_MAX = " << RAND_MAX << endl;
-	cout << "(in MED::MED) Contents of MEDmap :\n";
-	for (int i = 0; i < MEDmap.size(); i++)
-		cout << MEDmap[i] << " ";
-	cout << endl;
-#endif
-
-	#undef MAX_DAT
-	#undef MIN_DAT
-}
-
-/*============================================================================*/
-/***                   MED::p_median_calc_workspace			    ***/
-/*============================================================================*/
-/* How to calculate how much space is required for the original data and
-	 for the intermediate and final results when calculating the median
-	 of medians */
-int MED::p_median_calc_workspace(int numentries)
-{
-	int num;
-
-	if (numentries == 0)
-		return 0;
-	if (numentries <= MEDIAN)
-		return numentries + 1;
-	num = numentries / MEDIAN;
-	if (numentries % MEDIAN)
-		num++;
-	return numentries + p_median_calc_workspace(num);
-}
-
-/*============================================================================*/
-/***                   MED:p_shuffle_medmap				    ***/
-/*============================================================================*/
-/* this sets up an array with numbers 0 - MAX_DATA-1 which is then shuffled
-   it's supposed to help with finding medians of medians which are more
-   consistently close to the true median */
-void MED::p_shuffle_medmap( int size )
-{
-	int i, a, b, temp;
-	double da, db;
-
-	seed48(SEED);
-
-	for (i = 0, a = size; i < a; i++)
-		MEDmap[i] = i;
-
-	for (i = 0; i < 10000; i++)
-	{
-// not all random number generators produce the same numbers on different platforms
-
-//		da = static_cast<double>(rand()); //		da = da / RAND_MAX * size;
-//		db = static_cast<double>(rand());
-//		db = db / RAND_MAX * size;
-
-//		da = drand48() * size;
-//		cout << da << " ";
-//		db = drand48() * size;
-
-		da = static_cast<double>(lrand48()) / (U_int)(1 << 31 ) * size;
-		db = static_cast<double>(lrand48()) / (U_int)(1 << 31 ) * size;
-
-		a  = static_cast<int>(da);
-		b  = static_cast<int>(db);
-		temp = MEDmap[a];
-		MEDmap[a] = MEDmap[b];
-		MEDmap[b] = temp;
-	}
-//	cout << endl;
+	MEDkeys = new HU_int[2 * (p_entries - 1) * key_words];
+	MEDidx = new int[2 * (p_entries - 1)];
 }
 
 /*============================================================================*/
@@ -146,19 +63,28 @@ void MED::p_shuffle_medmap( int size )
 /*============================================================================*/
 MED::~MED()
 {
-// not needed?????
-	MEDmap.erase( MEDmap.begin(), MEDmap.end() );
-	MEDdata.erase( MEDdata.begin(), MEDdata.end() );
+	delete [] MEDkeys;
+	delete [] MEDidx;
 }
 
 /*============================================================================*/
 /*                            DBASE::DBASE	                          	      */
 /*============================================================================*/
-DBASE::DBASE( string db_name, int dims, int bt_n_entries, int b_slots, int p_entries )
+// 'ord' is the order of the curve, ie the no. of bits of each coordinate
+// that are used, and 'crv' the curve itself (see curve.h); if 'keys' then each
+// record's hcode is kept on its page, so that pages are split without encoding
+// their records; if 'pack' then pages are packed on disk to 'ord' bits per
+// coordinate (see PAGE::p_pack()). All four are recorded in the .inf file, as
+// are 'spl', the way in which full pages are split (eg SPLIT_MEDIAN), and
+// 'align': if set, pages are padded on disk to a power of two multiple of
+// PAGE_ALIGN bytes and held in the buffer at addresses that are multiples of
+// it, so that they can be read and written directly (see db_direct_io())
+DBASE::DBASE( string db_name, int dims, int bt_n_entries, int b_slots, int p_entries,
+		int ord, int crv, bool keys, bool pack, int spl, bool align )
 	:
-	BT( db_name, dims, bt_n_entries ),
-	dbMED( dims, p_entries ),
-	Buffer( dims, b_slots, p_entries, this )
+	BT( db_name, HKEY_WORDS( dims, ord ), bt_n_entries ),
+	dbMED( HKEY_WORDS( dims, ord ), p_entries ),
+	Buffer( dims, ord, SF_curve( crv ), keys, pack, align, spl, b_slots, p_entries, this )
 {
 /*	BT = BTree( db_name, dims, bt_n_entries );*/
 /*	BT = BTree(  );*/
@@ -168,11 +94,35 @@ DBASE::DBASE( string db_name, int dims, int bt_n_entries, int b_slots, int p_ent
 		cout << "using minimum default of " << THRESHOLD + EXTRA_RECORDS << endl;
 		p_entries = THRESHOLD + EXTRA_RECORDS;
 	}
+	if ( ord < 1 || ord > NUMBITS )
+		errorexit( "ERROR in DBASE::DBASE(): curve order out of range\n" );
+	if ( dims < 1 || dims > MAXDIMS )
+		errorexit( "ERROR in DBASE::DBASE(): no. of dimensions out of range\n" );
+	if ( SF_curve( crv ) == NULL )
+		errorexit( "ERROR in DBASE::DBASE(): unknown curve\n" );
+	if ( spl < SPLIT_MEDIAN || spl > SPLIT_ADAPTIVE )
+		errorexit( "ERROR in DBASE::DBASE(): unknown split policy\n" );
 	dbname			= db_name;
 	dimensions		= dims;
+	order			= ord;
+	curve_no		= crv;
+	curve			= SF_curve( crv );
+	page_keys		= keys;
+	packed			= pack;
+	split			= spl;
+	aligned			= align;
+	direct			= false;
+	fdDB			= -1;
+	key_words		= HKEY_WORDS( dims, ord );
+	record_words	= dims + (keys ? key_words : 0);
+	columns			= false;
+	// NB the largest U_int is reserved for _UNSPECIFIED_
+	max_coord		= ord == NUMBITS ? MAXTOKEN : ((PU_int)1 << ord) - 1;
 	page_entries	= p_entries;
 	bt_node_entries = bt_n_entries;
 	num_Bslots		= b_slots;
+	generation		= 0;
+	mbr_changed		= false;
 }
 
 /*============================================================================*/
@@ -294,6 +244,147 @@ void DBASE::db_freepagelist_dump()
 	cout << "\nNumber of free pages: " << NumFreePages << endl;
 }
 
+/*============================================================================*/
+/***                   DBASE::dbi_mbr_setup				    ***/
+/*============================================================================*/
+/* on opening a db:
+   read the pages' MBRs from the .mbr file; if it's missing or out of step
+   with the db (eg it was created before MBRs were kept, or its header's
+   generation or no. of pages isn't the db's) they are found from the
+   pages themselves */
+void DBASE::dbi_mbr_setup()
+{
+	int	lpage, buffslot, n = 2 * dimensions * nextPID;
+	U_int	hdr[MBR_HDR_SIZE];
+	string	fname = dbname + ".mbr";
+	fstream f;
+
+	PageMBR.assign( n, 0 );
+	mbr_changed = false;
+	f.open( fname.c_str(), ios::in | ios::binary );
+	if (f)
+	{
+		f.read( reinterpret_cast<char*>(hdr), sizeof hdr );
+		if (f && hdr[0] == MBR_MAGIC && hdr[1] == (U_int)generation &&
+			hdr[2] == (U_int)nextPID)
+			f.read( reinterpret_cast<char*>(&PageMBR[0]), sizeof(PU_int) * n );
+		else
+			f.setstate( ios::failbit );
+		if (f && f.gcount() == (int)sizeof(PU_int) * n)
+		{
+			/* make sure there's nothing more to read */
+			(void) f.get();
+			if (f.eof())
+				return;
+		}
+	}
+
+	vector<bool> free( nextPID, false );
+	stack<int> fpl = FreePageList;
+
+	for ( ; !fpl.empty(); fpl.pop())
+		free[fpl.top()] = true;
+	for (lpage = 0; lpage < nextPID; lpage++)
+	{
+		dbi_mbr_empty( lpage );
+		if (free[lpage])
+			continue;
+		buffslot = Buffer.b_page_retrieve( lpage );
+		dbi_page_mbr( Buffer.BSlot[buffslot]->BPage );
+		Buffer.BSlot[buffslot]->fix = Buffer.BSlot[buffslot]->query; // finished with it
+	}
+	// they're as the pages are, so their generation needn't move on
+	mbr_changed = false;
+}
+
+/*============================================================================*/
+/***                   DBASE::dbi_mbr_save				    ***/
+/*============================================================================*/
+/* on closing a db:
+   write the pages' MBRs to file, after a header of their generation and
+   the no. of pages */
+void DBASE::dbi_mbr_save()
+{
+	U_int	hdr[MBR_HDR_SIZE] = { MBR_MAGIC, (U_int)generation, (U_int)nextPID };
+	string	fname = dbname + ".mbr";
+	fstream f;
+
+	f.open( fname.c_str(), ios::out | ios::binary );
+	if (! f)
+		errorexit("ERROR 1 in dbi_mbr_save()\n");
+	f.write( reinterpret_cast<char*>(hdr), sizeof hdr );
+	f.write( reinterpret_cast<char*>(&PageMBR[0]),
+		sizeof(PU_int) * 2 * dimensions * nextPID );
+	if (! f)
+		errorexit("ERROR 2 in dbi_mbr_save()\n");
+	f.close();
+}
+
+/*============================================================================*/
+/***                   DBASE::dbi_mbr_empty				    ***/
+/*============================================================================*/
+// gives page 'lpage' the MBR of an empty page, which meets no query
+void DBASE::dbi_mbr_empty( int lpage )
+{
+	mbr_changed = true;
+	if ((int)PageMBR.size() < 2 * dimensions * (lpage + 1))
+		PageMBR.resize( 2 * dimensions * (lpage + 1) );
+
+	PU_int	*lo = &PageMBR[2 * dimensions * lpage], *hi = lo + dimensions;
+
+	for (int d = 0; d < dimensions; d++)
+	{
+		lo[d] = _UNSPECIFIED_;
+		hi[d] = MINTOKEN;
+	}
+}
+
+/*============================================================================*/
+/***                   DBASE::dbi_page_mbr				    ***/
+/*============================================================================*/
+// finds the MBR of 'page' from its records
+void DBASE::dbi_page_mbr( PAGE &page )
+{
+	int	i, lpage = page.page_hdr->lpage;
+
+	dbi_mbr_empty( lpage );
+	for (i = 1; i <= page.page_hdr->size; i++)
+		dbi_page_mbr_extend( lpage, page.data[i] );
+}
+
+/*============================================================================*/
+/***                   DBASE::dbi_page_mbr_extend			    ***/
+/*============================================================================*/
+// extends the MBR of page 'lpage' to cover 'data', which is added to it
+void DBASE::dbi_page_mbr_extend( int lpage, const PU_int *data )
+{
+	PU_int	*lo = &PageMBR[2 * dimensions * lpage], *hi = lo + dimensions;
+
+	mbr_changed = true;
+	for (int d = 0; d < dimensions; d++)
+	{
+		if (data[d] < lo[d])
+			lo[d] = data[d];
+		if (data[d] > hi[d])
+			hi[d] = data[d];
+	}
+}
+
+/*============================================================================*/
+/***                   DBASE::dbi_mbr_meets				    ***/
+/*============================================================================*/
+// whether the MBR of page 'lpage' meets the box from LB to UB, ie whether the
+// page may hold a point within it
+bool DBASE::dbi_mbr_meets( int lpage, const PU_int *LB, const PU_int *UB )
+{
+	const PU_int	*lo = &PageMBR[2 * dimensions * lpage], *hi = lo + dimensions;
+
+	for (int d = 0; d < dimensions; d++)
+		if (lo[d] > UB[d] || hi[d] < LB[d])
+			return false;
+	return true;
+}
+
 /*============================================================================*/
 /***                   DBASE::dbi_get_last_value			    ***/
 /*============================================================================*/
@@ -346,11 +437,16 @@ bool DBASE::dbi_create_info()
 	info[3]  =  dimensions;
 	info[4]  =  page_entries;
 	info[5]  =  bt_node_entries;
-
-	if ( INF_SIZE != 6 )
+	info[6]  =  order;
+	info[7]  =  curve_no;
+	info[8]  =  page_keys;
+	info[9]  =  packed;
+	info[10] =  split;
+	info[11] =  aligned;
+	info[12] =  generation;
+
+	if ( INF_SIZE != 13 )
 		errorexit("ERROR 1 in dbi_create_info()\n");
-//	info[15] = CURVE;
-//	info[16] = ORDER;
 //	info[17] = NON_KEY_INFO;
 //	info[18] = NO_EXTRA_TOKENS;
 //	info[19] = LTC;
@@ -390,7 +486,17 @@ bool DBASE::dbi_open_info()
 		errorexit("ERROR 1 in dbi_open_info(): opening .inf file\n");
 
 	f.read(reinterpret_cast<char*>(info), sizeof (info[0]) * INF_SIZE);
-	if (! f)
+	if (! f && f.gcount() >= (int)sizeof (info[0]) * 6 &&
+		f.gcount() % sizeof (info[0]) == 0)
+	{
+		// written by an earlier version: settings added since then take
+		// their defaults, ie hilbert (0), unkeyed, unpacked and unaligned
+		// pages split at their medians, and MBRs of generation 0
+		if (f.gcount() == sizeof (info[0]) * 6)
+			info[6] = NUMBITS;	// written before the order was recorded
+		f.clear();
+	}
+	else if (! f)
 		errorexit("ERROR 2 in dbi_open_info(): .inf file inconsistent\n");
 
 	/* make sure there's nothing more to read */
@@ -406,8 +512,7 @@ bool DBASE::dbi_open_info()
 		errorexit("ERROR 4 in dbi_open_info(): .inf file inconsistent\n");
 
 	LastPage = info[2];
-
-/* elements 3 - 11 available for future use */
+	generation = info[12];
 
 	if (info[3] != dimensions)
 	{
@@ -430,6 +535,48 @@ bool DBASE::dbi_open_info()
 		cout << "ERROR in dbi_open_info(): incompatible no. of bt_node_entries\n";
 		errors = 1;
 	}
+	if (info[6] != order)
+	{
+		cout << "Curve Order: Database: " << info[6]
+			<< ", Executable: " << order << "\n";
+		cout << "ERROR in dbi_open_info(): incompatible curve order\n";
+		errors = 1;
+	}
+	if (info[7] != curve_no)
+	{
+		cout << "Curve: Database: "
+			<< (SF_curve( info[7] ) ? SF_curve( info[7] )->name : "unknown")
+			<< ", Executable: " << curve->name << "\n";
+		cout << "ERROR in dbi_open_info(): incompatible curve\n";
+		errors = 1;
+	}
+	if (info[8] != page_keys)
+	{
+		cout << "Hcodes kept on pages: Database: " << (info[8] ? "yes" : "no")
+			<< ", Executable: " << (page_keys ? "yes" : "no") << "\n";
+		errors++;
+	}
+	if (info[9] != packed)
+	{
+		cout << "Pages packed on disk: Database: " << (info[9] ? "yes" : "no")
+			<< ", Executable: " << (packed ? "yes" : "no") << "\n";
+		cout << "ERROR in dbi_open_info(): incompatible page format\n";
+		errors = 1;
+	}
+	if (info[10] != split)
+		// not an error: pages split from now on follow the executable's
+		// policy, which db_close() records
+		cout << "Split policy: Database: "
+			<< (info[10] >= SPLIT_MEDIAN && info[10] <= SPLIT_ADAPTIVE ?
+				split_name[info[10]] : "unknown")
+			<< ", Executable: " << split_name[split] << "\n";
+	if (info[11] != aligned)
+	{
+		cout << "Pages aligned on disk: Database: " << (info[11] ? "yes" : "no")
+			<< ", Executable: " << (aligned ? "yes" : "no") << "\n";
+		cout << "ERROR in dbi_open_info(): incompatible page format\n";
+		errors = 1;
+	}
 /*
 	if (info[17] != NON_KEY_INFO)
 	{
@@ -485,27 +632,25 @@ bool DBASE::db_create()
 	if (! fDB)
 		errorexit("ERROR 2 in db_create(), can't create db\n");
 
-	// create first page - as it's local it'll be destroyed when this func. finishes
-	PAGE	page1( dimensions, page_entries );
-	int		page_size = sizeof(pageheader_t) + page_entries * sizeof(U_int) * dimensions;
-
-	fDB.write( reinterpret_cast<char*>(page1.raw_data), page_size );
-	if (! fDB)
+	// create first page
+	if (! Buffer.b_write_empty_page( 0 ))
 		errorexit("ERROR 3 in db_create(): writing to .db file\n");
 
 	fDB.close();
 
 	// insert first page into index: key = 0, lpage = 0
-	HU_int *key = new HU_int[dimensions];
+	HU_int *key = new HU_int[key_words];
 	// initialise key
-	memset( key, 0, sizeof(U_int) * dimensions );
+	memset( key, 0, sizeof(U_int) * key_words );
 	BT.idx_insert_key( key, 0 );
 	delete [] key;
 	BT.idx_write();
 	// delete the BTree since we'll read it from file when we open the database
 	BT.free_root();
 
-	// write info to .inf file
+	// write info to .inf file, the MBRs' generation being when it's created
+	// (to the clock's resolution, so that rebuilds a moment apart differ)
+	generation = (int)chrono::system_clock::now().time_since_epoch().count();
 	dbi_create_info();
 
 	// create free page list file: empty
@@ -517,6 +662,11 @@ bool DBASE::db_create()
 		errorexit("ERROR 4 in db_create(), creating .fpl file\n");
 	f.close();
 
+	// create MBR file: the first page is empty
+	nextPID = 1;
+	dbi_mbr_empty( 0 );
+	dbi_mbr_save();
+
 	return true;
 }
 
@@ -546,6 +696,22 @@ fjunk3.open("fjunk3.txt", ios::out);
 	// read data from .inf file
 	dbi_open_info();
 
+	if (direct && ! aligned)
+		cout << "WARNING in db_open(): pages aren't aligned, "
+			"so direct I/O isn't used\n";
+#ifdef DIRECT_IO
+	else if (direct)
+	{
+		fdDB = open( fname.c_str(), O_RDWR | O_DIRECT );
+		if (fdDB < 0)
+			cout << "WARNING in db_open(): can't open " << fname
+				<< " for direct I/O, so it isn't used\n";
+	}
+#else
+	else if (direct)
+		cout << "WARNING in db_open(): direct I/O isn't supported\n";
+#endif
+
 	// read btree index into memory
 	if (nextPID > NumFreePages)
 		i = BT.idx_read();
@@ -557,6 +723,9 @@ fjunk3.open("fjunk3.txt", ios::out);
 	if (NumFreePages > 0)
 		dbi_freepagelist_setup();
 
+	// and the pages' MBRs
+	dbi_mbr_setup();
+
 /*	This is now dealt with by dbi_open_info()
 	LastPage = (u2BYTES)idx_get_last_page(BT);*/
 
@@ -571,10 +740,10 @@ fjunk3.open("fjunk3.txt", ios::out);
 /*============================================================================*/
 bool DBASE::db_close()
 {
-	int		i, offset;
+	int		i;
 	fstream	f;
+	streamoff	inf_size;
 	string	fname;
-	int		page_size = sizeof(pageheader_t) + page_entries * sizeof(U_int) * dimensions;
 
 
 #ifdef xJKLDEBUGxxxx
@@ -588,13 +757,8 @@ fjunk3.close();
 		if (Buffer.BSlot[i]->mod)
 		{
 //			offset = Buffer.BSlot[i]->BPage.page_hdr->lpage * sizeof(PAGE);
-			offset = Buffer.BSlot[i]->BPage.page_hdr->lpage * page_size;
 //printf("offset = %i\n",offset);
-
-			fDB.seekp(offset, ios::beg);
-			fDB.write(reinterpret_cast<char*>(Buffer.BSlot[i]->BPage.raw_data),
-				page_size);
-			if (! fDB)
+			if (! Buffer.b_write_page( i ))
 				errorexit("ERROR in db_close(): writing to database\n");
 		}
 
@@ -607,6 +771,23 @@ fjunk3.close();
 	f.write(reinterpret_cast<char*>(&nextPID), sizeof nextPID);
 	f.write(reinterpret_cast<char*>(&NumFreePages), sizeof NumFreePages);
 	f.write(reinterpret_cast<char*>(&LastPage), sizeof LastPage);
+	// and the split policy, unless the file predates it
+	f.seekg(0, ios::end);
+	inf_size = f.tellg();
+	if (inf_size > (streamoff)(sizeof (int) * 10))
+	{
+		f.seekp(sizeof (int) * 10);
+		f.write(reinterpret_cast<char*>(&split), sizeof split);
+	}
+	// and the MBRs' generation, moved on if any has changed, unless the file
+	// predates the settings before it (it then stays at 0)
+	if (inf_size >= (streamoff)(sizeof (int) * 12))
+	{
+		if (mbr_changed)
+			generation++;
+		f.seekp(sizeof (int) * 12);
+		f.write(reinterpret_cast<char*>(&generation), sizeof generation);
+	}
 
 	if (! f)
 		errorexit("ERROR in db_close(): re-writing to .inf in db_close\n");
@@ -615,10 +796,18 @@ fjunk3.close();
 	// write out index
 	BT.idx_write();
 
+	// write out the pages' MBRs
+	dbi_mbr_save();
+
 	// write out free page list (this also frees storage)
 	dbi_freepagelist_save();
 
 	fDB.close();
+#ifdef DIRECT_IO
+	if (fdDB >= 0)
+		close( fdDB );
+	fdDB = -1;
+#endif
 
 	// don't free index, buffer and MED - this is done by DBASE destructor
 
@@ -635,9 +824,16 @@ bool DBASE::db_data_present( PU_int *data )
 //	long	offset;
 	int	buffslot, pageslot;
 	int	lpage;
-	HU_int	*key = new HU_int[dimensions];
+	HU_int	*key = new HU_int[key_words];
 
-	key = ENCODE( key, data, dimensions );
+	for (int i = 0; i < dimensions; i++)
+		if (data[i] > max_coord)
+		{
+			delete [] key;
+			return false;
+		}
+
+	key = curve->encode( key, data, dimensions, order );
 	lpage = BT.idx_search( key );
 	buffslot = Buffer.b_page_retrieve( lpage );
 	if (lpage != Buffer.BSlot[buffslot]->BPage.page_hdr->lpage)
@@ -654,6 +850,7 @@ bool DBASE::db_data_present( PU_int *data )
 		errorexit("ERROR 1 in db_data_present(): index inconsistent\n");
 	}
 	pageslot = Buffer.BSlot[buffslot]->BPage.p_find_pageslot( data ); //@@@
+	Buffer.BSlot[buffslot]->fix = Buffer.BSlot[buffslot]->query; // finished with it
 	delete [] key;
 	if (pageslot > 0) // data is present
 	{
@@ -670,20 +867,191 @@ int DBASE::db_data_insert( PU_int* data )
 {
 //	int		buffslot;
 	int	lpage;
-	HU_int*	key = new HU_int[dimensions];
+	HU_int*	key = new HU_int[key_words];
 
 	for (int i = 0; i < dimensions; i++)
 		if (data[i] == _UNSPECIFIED_)
 		{
 			cout << "Coordinate " << i << " is unspecified: not allowed!" << endl;
+			delete [] key;
+			return false;
+		}
+		else if (data[i] > max_coord)
+		{
+			cout << "Coordinate " << i << " exceeds " << max_coord
+				<< ", the maximum for a curve of order " << order << endl;
+			delete [] key;
 			return false;
 		}
 
-	key = ENCODE( key, data, dimensions );
+	key = curve->encode( key, data, dimensions, order );
 	lpage = BT.idx_search( key );
+	int result = Buffer.b_data_insert( data, lpage, key );
 	delete [] key;
 
-	return Buffer.b_data_insert( data, lpage );
+	return result;
+}
+
+/*============================================================================*/
+/***                   DBASE::db_data_insert_batch			    ***/
+/*============================================================================*/
+// Inserts 'num' points held contiguously in 'data', encoding them all at once.
+// Returns the number of points inserted (ie not already present)
+int DBASE::db_data_insert_batch( PU_int* data, int num )
+{
+	int	lpage, i, inserted = 0;
+	HU_int*	keys = new HU_int[num * key_words];
+
+	for (i = 0; i < num * dimensions; i++)
+		if (data[i] == _UNSPECIFIED_)
+		{
+			cout << "Coordinate " << i % dimensions << " of point " <<
+				i / dimensions << " is unspecified: not allowed!" << endl;
+			delete [] keys;
+			return 0;
+		}
+		else if (data[i] > max_coord)
+		{
+			cout << "Coordinate " << i % dimensions << " of point " <<
+				i / dimensions << " exceeds " << max_coord <<
+				", the maximum for a curve of order " << order << endl;
+			delete [] keys;
+			return 0;
+		}
+
+	curve->encode_batch( data, num, keys, dimensions, order );
+
+	// the index is searched for each point in turn since earlier insertions
+	// may have split pages
+	for (i = 0; i < num; i++)
+	{
+		lpage = BT.idx_search( keys + i * key_words );
+		if (Buffer.b_data_insert( data + i * dimensions, lpage,
+				keys + i * key_words ) != ALREADY_PRESENT)
+			inserted++;
+	}
+	delete [] keys;
+
+	return inserted;
+}
+
+/*============================================================================*/
+/***                   DBASE::db_data_load				    ***/
+/*============================================================================*/
+// Loads 'num' points held contiguously in 'data' into an empty database. They
+// are sorted by hcode and laid out in that order, 'fill' percent of a page's
+// records to a page, and the index is then built bottom-up over the pages by
+// BTree::idx_bulk_load(): no page is split and no key searched for. Points
+// already in the database (it must be empty) or repeated in 'data' are loaded
+// once. 'fill' must leave pages far enough above the occupancy at which a
+// deletion makes them underflow (see BUFFER::b_min_records()), eg 40% under
+// SPLIT_MEDIAN, that the first deletion from one doesn't, and no page is
+// given fewer records than that even when there are too few points to fill
+// the pages 'fill' implies. Returns the number of points loaded
+int DBASE::db_data_load( PU_int* data, int num, int fill )
+{
+	int	i, j, lpage, buffslot, per_page, min_page, pages, first, last, loaded;
+	HU_int	*keys, *pkeys;
+	int	*order_idx, *lpages;
+
+	if (fill < 1 || fill > 100)
+		errorexit("ERROR 1 in db_data_load(): fill factor out of range\n");
+	// a page loaded with fewer than this would be merged or topped up by the
+	// first deletion from it, so the fill asked for would be lost
+	min_page = Buffer.b_min_records() + 2;
+	per_page = (page_entries - 2) * fill / 100;
+	if (per_page < min_page)
+		errorexit("ERROR 2 in db_data_load(): fill factor below the minimum "
+			"occupancy of a page\n");
+	if (nextPID != 1 || NumFreePages != 0)
+	{
+		cout << "Can't load data: the database isn't empty" << endl;
+		return 0;
+	}
+	buffslot = Buffer.b_page_retrieve( 0 );
+	i = Buffer.BSlot[buffslot]->BPage.page_hdr->size;
+	Buffer.BSlot[buffslot]->fix = Buffer.BSlot[buffslot]->query; // finished with it
+	if (i != 0)
+	{
+		cout << "Can't load data: the database isn't empty" << endl;
+		return 0;
+	}
+	if (num <= 0)
+		return 0;
+
+	for (i = 0; i < num * dimensions; i++)
+		if (data[i] == _UNSPECIFIED_)
+		{
+			cout << "Coordinate " << i % dimensions << " of point " <<
+				i / dimensions << " is unspecified: not allowed!" << endl;
+			return 0;
+		}
+		else if (data[i] > max_coord)
+		{
+			cout << "Coordinate " << i % dimensions << " of point " <<
+				i / dimensions << " exceeds " << max_coord <<
+				", the maximum for a curve of order " << order << endl;
+			return 0;
+		}
+
+	keys = new HU_int[num * key_words];
+	order_idx = new int[num];
+	curve->encode_batch( data, num, keys, dimensions, order );
+	for (i = 0; i < num; i++)
+		order_idx[i] = i;
+	sort( order_idx, order_idx + num, KEY_LESS( keys, key_words ) );
+
+	// drop repeated points, which share an hcode
+	for (i = j = 1; i < num; i++)
+		if (keycmp( keys + order_idx[i] * key_words,
+				keys + order_idx[j - 1] * key_words, key_words ) != 0)
+			order_idx[j++] = order_idx[i];
+	loaded = j;
+
+	// a page overflows on reaching p_page_entries - 1 records, so no more than
+	// page_entries - 2 are put on one. The points are spread evenly over the
+	// pages, and there are few enough pages that each gets at least min_page
+	// (fewer than 2 * min_page go on one, which still fits)
+	pages = (loaded + per_page - 1) / per_page;
+	if (pages > loaded / min_page)
+		pages = loaded / min_page > 0 ? loaded / min_page : 1;
+
+	pkeys = new HU_int[pages * key_words];
+	lpages = new int[pages];
+	for (j = 0; j < pages; j++)
+	{
+		first = (int)((long)loaded * j / pages);
+		last = (int)((long)loaded * (j + 1) / pages);
+
+		// page 0 is the database's first page and keeps its index key of 0
+		lpage = j == 0 ? 0 : dbi_get_new_page();
+		buffslot = Buffer.b_page_retrieve( lpage );
+		PAGE	&page = Buffer.BSlot[buffslot]->BPage;
+
+		if (j == 0)
+			keycopy( pkeys, page.index, key_words );
+		else
+		{
+			keycopy( page.index, keys + order_idx[first] * key_words, key_words );
+			keycopy( pkeys + j * key_words, page.index, key_words );
+		}
+		for (i = first; i < last; i++)
+			Buffer.BSlot[buffslot]->bp_insert_on_page(
+				data + order_idx[i] * dimensions, keys + order_idx[i] * key_words );
+		dbi_page_mbr( page );
+		Buffer.BSlot[buffslot]->fix = Buffer.BSlot[buffslot]->query; // finished with it
+		lpages[j] = lpage;
+	}
+	LastPage = lpages[pages - 1];
+
+	BT.idx_bulk_load( pkeys, lpages, pages, fill );
+
+	delete [] lpages;
+	delete [] pkeys;
+	delete [] order_idx;
+	delete [] keys;
+
+	return loaded;
 }
 
 /*============================================================================*/
@@ -694,12 +1062,19 @@ int DBASE::db_data_delete( PU_int* data )
 {
 //	int		buffslot;
 	int	lpage;
-	HU_int*	key = new HU_int[dimensions];
+	HU_int*	key = new HU_int[key_words];
 
 	if (NumFreePages == nextPID)
 		errorexit("ERROR 1 in db_data_delete(): database is empty\n");
 
-	key = ENCODE( key, data, dimensions );
+	for (int i = 0; i < dimensions; i++)
+		if (data[i] > max_coord)
+		{
+			delete [] key;
+			return NOT_PRESENT;
+		}
+
+	key = curve->encode( key, data, dimensions, order );
 	lpage = BT.idx_search( key );
 	delete [] key;
 
@@ -728,17 +1103,11 @@ int DBASE::dbi_get_new_page()
 			errorexit("ERROR 1 in dbi_get_new_page(): database full\n");
 		newpage = nextPID;
 		nextPID++;
-		/* write a page-sized block of memory to the end of the file */
-		PAGE	emptypage( dimensions, page_entries );
-		int		page_size = sizeof(pageheader_t) + page_entries * sizeof(U_int) * dimensions;
-
-		fDB.seekp(0, ios::end);
-		if (! fDB)
+		/* write an empty page to the end of the file */
+		if (! Buffer.b_write_empty_page( newpage ))
 			errorexit("ERROR 2 in dbi_get_new_page(): writing to database\n");
-		fDB.write( reinterpret_cast<char*>(emptypage.raw_data), page_size );
-		if (! fDB)
-			errorexit("ERROR 3 in dbi_get_new_page(): writing to database\n");
 	}
+	dbi_mbr_empty( newpage );
 	return newpage;
 }
 
@@ -748,15 +1117,69 @@ int DBASE::dbi_get_new_page()
 /*                            		                          	      */
 /*============================================================================*/
 
+/*============================================================================*/
+/***                   DBASE::db_page_records				    ***/
+/*============================================================================*/
+// (a page of p_entries records holds p_entries - 1 records and its index
+// entry). Returns 0 if not even the smallest page would fit
+int DBASE::db_page_records( int page_bytes, int dims, int ord, bool keys, bool pack )
+{
+	int	n, kwords = keys ? HKEY_WORDS( dims, ord ) : 0;
+
+	for (n = THRESHOLD + EXTRA_RECORDS - 1; ; n++)
+		if ((long)(pack ? PACKED_PAGE_BYTES( dims, ord, keys, n + 1 )
+			: PAGE_BYTES( dims, kwords, n + 1 )) > page_bytes)
+			break;
+	return n < THRESHOLD + EXTRA_RECORDS ? 0 : n;
+}
+
 /*============================================================================*/
 /*                            db_info					      */
 /*============================================================================*/
 void DBASE::db_info()
 {
   cout << "\nnumber of dimensions : " << dimensions << "\n";
+  cout << "curve : " << curve->name << "\n";
+  cout << "order of the curve : " << order << "\n";
+  cout << "hcodes kept on pages : " << (page_keys ? "yes" : "no") << "\n";
+  cout << "pages packed on disk : " << (packed ? "yes" : "no") << "\n";
+  cout << "pages aligned on disk : " << (aligned ? "yes" : "no") << "\n";
+  cout << "bytes per page on disk : " << Buffer.b_page_bytes << "\n";
+  cout << "direct I/O : " << (fdDB >= 0 ? "yes" : "no") << "\n";
   cout << "number of B-Tree node entries : " << bt_node_entries << "\n";
   cout << "number of pages in buffer : " << num_Bslots << "\n";
   cout << "number of records on page : " << page_entries << "\n";
+  cout << "page split policy : " << split_name[split] << "\n";
+
+  if (! fDB.is_open())
+	return;
+
+  // how full the pages are: each is read, so the query statistics are kept
+  int		lpage, buffslot, pages = 0, retrieved = Pages_retrieved, reads = Disk_reads;
+  long		records = 0;
+  vector<bool>	free( nextPID, false );
+  stack<int>	fpl = FreePageList;
+
+  for ( ; !fpl.empty(); fpl.pop())
+	free[fpl.top()] = true;
+  for (lpage = 0; lpage < nextPID; lpage++)
+  {
+	if (free[lpage])
+		continue;
+	buffslot = Buffer.b_page_retrieve( lpage );
+	records += Buffer.BSlot[buffslot]->BPage.page_hdr->size;
+	Buffer.BSlot[buffslot]->fix = Buffer.BSlot[buffslot]->query; // finished with it
+	pages++;
+  }
+  Pages_retrieved = retrieved;
+  Disk_reads = reads;
+
+  cout << "number of pages : " << pages << "\n";
+  cout << "number of records : " << records << "\n";
+  if (pages)
+	cout << "average page fill : " << fixed << setprecision(1)
+		<< 100.0 * records / ((double)pages * (page_entries - 1))
+		<< "%\n" << resetiosflags( ios::fixed ) << setprecision(6);
 }
 
 /*============================================================================*/
@@ -768,7 +1191,7 @@ void DBASE::db_info()
 void DBASE::db_key_dump( string fname )
 {
 	int		i, j, buffslot;
-	BTnode		*p = BT.root;
+	BTnode		*p = BT.idx_root();
 	fstream		f;
 	U_int*		idx;	// no need to allocate storage
 
@@ -793,7 +1216,7 @@ void DBASE::db_key_dump( string fname )
 			f << "PAGE NO.: " << Buffer.BSlot[buffslot]->BPage.page_hdr->lpage << endl;
 			f << "KEY : ";
 			idx =  Buffer.BSlot[buffslot]->BPage.index;
-			for (j = dimensions - 1; j >= 0; j--)
+			for (j = key_words - 1; j >= 0; j--)
 				f << setw(15) << idx[j];
 			f << endl;
 			Buffer.BSlot[buffslot]->fix = 0;
@@ -811,13 +1234,13 @@ void DBASE::db_key_dump( string fname )
 void DBASE::db_data_dump( string fname, char type )
 {
 	int 		i, j, width, buffslot;
-	HU_int		*key = new U_int[dimensions];
+	HU_int		*key = new U_int[key_words];
 	BTnode		*p;
 	fstream		f;
 	U_int		*temp;
 
 	// initialise hcode
-	memset( key, 0, sizeof(U_int) * dimensions );
+	memset( key, 0, sizeof(U_int) * key_words );
 
 	f.open( fname.c_str(), ios::out | ios::binary );
 
@@ -826,7 +1249,7 @@ void DBASE::db_data_dump( string fname, char type )
 	else
 		width = 34;
 
-	p = BT.root->idxi_find_leaf( key );
+	p = BT.idx_root()->idxi_find_leaf( key );
 	while (p)
 	{
 		for (int k = 1; k <= p->lf_HDR->size; k++)
@@ -835,7 +1258,7 @@ void DBASE::db_data_dump( string fname, char type )
 			f << "PAGE NO. : " << setw(5) << Buffer.BSlot[buffslot]->BPage.page_hdr->lpage
 				<< "  INDEX : ";
 			temp = Buffer.BSlot[buffslot]->BPage.index;
-			for (i = dimensions-1; i >= 0; i--)
+			for (i = key_words-1; i >= 0; i--)
 				f << setw(width) << temp[i];
 			f << "  NUM RECORDS : " << Buffer.BSlot[buffslot]->BPage.page_hdr->size;
 			f << endl;
@@ -885,7 +1308,7 @@ void DBASE::db_batch_update( char type, int num )
 		{
 			for (j = 0; j < dimensions; j++)
 			{
-				k[j] = lrand48();
+				k[j] = lrand48() % (max_coord + 1);
 			}
 
 			db_data_insert( k );
@@ -981,7 +1404,7 @@ void DBASE::db_querytest(void)
 	PU_int	*LB = new U_int[dimensions];
 	PU_int	*UB = new U_int[dimensions];
 	PU_int	*result = new U_int[dimensions];
-	HU_int	*hresult = new U_int[dimensions];
+	HU_int	*hresult = new U_int[key_words];
 
 	for (;;)
 	{
@@ -1015,8 +1438,8 @@ void DBASE::db_querytest(void)
 					}
 					cout << "    "; // endl;
 					// output the point's hcode
-					hresult = ENCODE( hresult, result, dimensions );
-					for (j = dimensions - 1; j >= 0; j--)
+					hresult = curve->encode( hresult, result, dimensions, order );
+					for (j = key_words - 1; j >= 0; j--)
 					{
 						cout << setw(12) << hresult[j];
 					}
@@ -1052,8 +1475,8 @@ void DBASE::db_querytest(void)
 					}
 					cout << "    "; // endl;
 					// output the point's hcode
-					hresult = ENCODE( hresult, result, dimensions );
-					for (j = dimensions - 1; j >= 0; j--)
+					hresult = curve->encode( hresult, result, dimensions, order );
+					for (j = key_words - 1; j >= 0; j--)
 					{
 						cout << setw(12) << hresult[j];
 					}
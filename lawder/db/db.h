@@ -9,19 +9,47 @@
 #ifdef __MSDOS__
 	#include "..\gendefs.h"
 	#include "..\btree\btree.h"
+	#include "..\hilbert\curve.h"
 #else
 	#include "../gendefs.h"
 	#include "../btree/btree.h"
+	#include "../hilbert/curve.h"
 #endif
 #else
 	#include "gendefs.h"
 	#include "btree.h"
+	#include "curve.h"
 #endif
 
 #include "buffer.h"
 
-#define 	MEDIAN	   		5
-#define		INF_SIZE		6
+#define		INF_SIZE		13
+
+// the .mbr file starts with MBR_MAGIC, the generation of the pages' MBRs and
+// the no. of pages (see dbi_mbr_setup())
+#define		MBR_MAGIC		0x314d544c	// "LTM1"
+#define		MBR_HDR_SIZE		3
+
+// whether the .db file can be opened for direct I/O (see db_direct_io())
+#if defined(__linux__) && !defined(__MSDOS__)
+	#define		DIRECT_IO
+#endif
+
+// how a full page is split (see BUFFER::b_split_share()): at its median, so
+// that each page is left half full; 90/10 when it's the last page, so that
+// appending in hcode order leaves full pages behind; or at a point that
+// follows the direction in which recent insertions' hcodes have moved
+#define		SPLIT_MEDIAN		0
+#define		SPLIT_APPEND		1
+#define		SPLIT_ADAPTIVE		2
+
+// the percentage of a page's records at or below which a deletion leaves it
+// underflowing, to be merged with a neighbour or topped up from one (see
+// BUFFER::b_min_records()). A skewed split (SPLIT_APPEND or SPLIT_ADAPTIVE)
+// may leave as few as 10% on one page, so under those policies a page may
+// lose half of that before it underflows
+#define		MIN_OCCUPANCY		40
+#define		SKEW_MIN_OCCUPANCY	5
 
 // p_page_entries must be at least EXTRA_RECORDS more than this
 #define		THRESHOLD		30
@@ -48,19 +76,19 @@ class MED {
 	
 public:
 	
-	MED( int dims, int d_entries );	// constructor
+	MED( int kwords, int d_entries );	// constructor
 	~MED();
 
 private:
 
-	int				dimensions;
-	vector<Hcode>	MEDdata;
-	// used for gaining random access to the hcodes of a page of data for the
-	// purpose of finding the approximate median
-	vector<int>		MEDmap;
-
-	int p_median_calc_workspace( int );
-	void p_shuffle_medmap( int );
+	int				key_words;	// no. of U_ints in an hcode
+	// the hilbert codes of the records of a page, or of a pair of pages, being
+	// split or rebalanced, one row of key_words U_ints after another (see
+	// PAGE::p_record_keys())
+	HU_int			*MEDkeys;
+	// the rows of MEDkeys, reordered in finding a median (see
+	// PAGE::p_select_key())
+	int				*MEDidx;
 };
 
 class DBASE;
@@ -73,13 +101,25 @@ class RET_SET {
 	
 private:
 
-	RET_SET( int dims );
+	RET_SET( int dims, BTree *bt );
 	~RET_SET();
 	PU_int	*LB;	// lower bound point
 	PU_int	*UB;	// upper bound point - not used in partial match queries
+	HRQ_STATE	*RQstate;	// range queries' descent of the curve (see hilbert.h)
+	H_BALL	*ball;	// ball queries: LB and UB hold the ball's bounding box
+	H_CLASSIFY	classify;	// region queries: the region is described by
+	const void	*region;	// 'region', which must outlive the set
 	U_int	Qsaf;	// mask used by partial match queries
 	int	numspec;// no. of specified dims (partial matchqueries only)
 	int	pos;	// search position on a page
+	BTreeCursor	cursor;	// on the index entry of the page being searched
+	// range queries filtering by column (see db_range_columns()): the slots of
+	// the current page's matches, from 'mfirst' to 'mlast', as bits
+	vector<U_int>	matches;
+	int	mfirst, mlast;
+	// range queries: the no. of records found not to match since the last
+	// match or skip, and the no. that leads to a skip (see db_range_skip())
+	int	misses, skip_after;
 	int	buffslot;
 	unsigned char	flags;
 };
@@ -93,7 +133,9 @@ class DBASE {
 
 public:
 
-	DBASE( string name, int dims, int bt_n_entries, int b_slots, int p_entries );
+	DBASE( string name, int dims, int bt_n_entries, int b_slots, int p_entries,
+		int order = NUMBITS, int curve = CURVE_HILBERT, bool page_keys = false,
+		bool packed = false, int split = SPLIT_MEDIAN, bool aligned = false );
 
 	string		dbname;
  	BTree		BT;					// database page index
@@ -104,6 +146,7 @@ public:
 	int		NumFreePages;		// size of the FreePageList  - free pages in the db
 	stack<int>	FreePageList;		// free logical page list
 	fstream		fDB;
+	int		fdDB;				// the .db file opened for direct I/O, or -1
 	
 	bool db_create();
 	bool db_open();
@@ -113,15 +156,33 @@ public:
 	// UPDATING .........................
 	// should NOT return bools
 	int db_data_insert( PU_int* );
+	int db_data_insert_batch( PU_int*, int num );
+	int db_data_load( PU_int*, int num, int fill = 100 );
 	int db_data_delete( PU_int* );
 
 	// QUERY PROCESSING ..................
 	bool db_data_present( PU_int* );
  	bool db_open_set( PU_int *point, int *set_id );
 	bool db_range_open_set( PU_int* LB, PU_int *HB, int *set_id );
+	bool db_ball_open_set( PU_int *centre, double radius, int *set_id );
+	bool db_region_open_set( H_CLASSIFY classify, const void *region, int *set_id );
 	bool db_close_set( int set_id );
 	bool db_fetch_another( int set_id, PU_int *retval );
 	bool db_range_fetch_another( int set_id, PU_int *retval );
+	bool db_ball_fetch_another( int set_id, PU_int *retval );
+	bool db_region_fetch_another( int set_id, PU_int *retval );
+	int db_knn( PU_int *point, int k, PU_int *results, double *dists = NULL );
+	// whether range queries test a page's records a column (dimension) at a
+	// time, several records at once: off unless set
+	void db_range_columns( bool on ) { columns = on; }
+	// whether db_open() opens the .db file for direct I/O (O_DIRECT), so that
+	// pages read and written bypass the kernel's page cache, the buffer
+	// being the only cache: off unless set. Pages must be aligned
+	void db_direct_io( bool on ) { direct = on; }
+	// the most records a page can hold (its p_entries) if it's to be no
+	// larger than 'page_bytes' on disk
+	static int db_page_records( int page_bytes, int dims, int order = NUMBITS,
+		bool page_keys = false, bool packed = false );
 	
 	// FOR CHECKING PURPOSES ..............
 	void db_key_dump( string fname );
@@ -134,13 +195,37 @@ public:
 	void db_querytest( void );
 
 	int dbi_get_new_page();
+	void dbi_page_mbr( PAGE& );
+	void dbi_page_mbr_extend( int lpage, const PU_int *data );
 	
 private:	
 	
 	int		dimensions;
+	int		order;				// no. of bits per coordinate (curve order)
+	int		curve_no;			// the curve, eg CURVE_HILBERT (see curve.h)
+	const SF_CURVE	*curve;
+	bool		page_keys;			// whether pages keep their records' hcodes
+	bool		packed;				// whether pages are bit-packed on disk
+	int		split;				// the split policy, eg SPLIT_MEDIAN
+	bool		aligned;			// whether pages are aligned on disk (see PAGE_ALIGN)
+	bool		direct;				// see db_direct_io()
+	int		record_words;		// no. of U_ints in a record on a page
+	bool		columns;			// see db_range_columns()
+	int		key_words;			// no. of U_ints in an hcode
+	PU_int		max_coord;			// largest coordinate: 2^order - 1 (or MAXTOKEN)
 	int		page_entries;		// no. of datum-points on a page + index entry
 	int		bt_node_entries;	// no. of entries in a btree node + header
 	int		num_Bslots;			// no. of buffer slots
+	// each page's minimum bounding rectangle (MBR): the lowest coordinates of
+	// page lpage's records are PageMBR[2 * dimensions * lpage + d], and the
+	// highest follow them. It's kept in the .mbr file
+	vector<PU_int>	PageMBR;
+	// the MBRs' generation: set when the db is created and moved on when it's
+	// closed after any MBR has changed. It's kept in the .inf file and in the
+	// .mbr file's header, so that a .mbr file left by another build of the db
+	// is told apart even when it's the same size
+	int		generation;
+	bool		mbr_changed;		// since the db was opened
 	
 	BUFFER		Buffer;				// the buffer
 	vector<RET_SET*>	Ret_set;	// all members of this vector are 'ACTIVE'
@@ -152,6 +237,19 @@ private:
 
 	bool dbi_create_info();
 	bool dbi_open_info();
+
+	void dbi_mbr_setup();
+	void dbi_mbr_save();
+	void dbi_mbr_empty( int lpage );
+	bool dbi_mbr_meets( int lpage, const PU_int *LB, const PU_int *UB );
+
+	double db_box_dist( const PU_int *point, const PU_int *lo, const PU_int *hi );
+	void dbi_release_page( int set_id );
+	bool db_page_within( int buffslot, const HU_int *first, const HU_int *last );
+	int db_range_find_page( int set_id, HU_int *match );
+	int db_range_skip( int set_id, const PU_int *record, int pos );
+	void db_range_filter_page( int set_id );
+	int db_next_filtered( int set_id, int pos );
 };
 
 #endif	// #ifndef _DB_H
\ No newline at end of file
@@ -1,6 +1,6 @@
 // Copyright (C) Jonathan Lawder 2001-2011
 
-#include <algorithm>	// for sort()
+#include <algorithm>	// for nth_element()
 #include <string>
 	
 #include "page.h"
@@ -31,18 +31,36 @@ extern fstream fjunk3;
 /*                            PAGE::PAGE	                          	      */
 /*============================================================================*/
 // p_page_entries - includes the index entry
-PAGE::PAGE( int dims, int p_entries, MED *m ) {
+// keys - whether each record's hcode is kept after its coordinates
+// frame_bytes - if given, the page is held in a block of memory of this size
+// that starts on a multiple of PAGE_ALIGN, as pages read directly must be
+PAGE::PAGE( int dims, int ord, const SF_CURVE *crv, bool k, int p_entries, MED *m,
+	int frame_bytes ) {
 	dimensions = dims;
+	order = ord;
+	curve = crv;
+	key_words = HKEY_WORDS( dimensions, order );
+	keys = k;
+	p_record_words = dimensions + (keys ? key_words : 0);
 	p_page_entries = p_entries;
-	p_page_entry_size = sizeof(U_int) * dimensions;
-	p_page_bytes = sizeof(pageheader_t) + p_page_entries * p_page_entry_size;
+	p_page_entry_size = sizeof(U_int) * p_record_words;
+	p_page_bytes = PAGE_BYTES( dimensions, keys ? key_words : 0, p_page_entries );
 	M = m;
 
  	// the data block that makes up a page (inc. page header and index entry)
 	// +1 for the index
 /*	raw_data = (unsigned char*)malloc( sizeof(pageheader_t) + p_page_entries * p_page_entry_size );*/
-	raw_data = new unsigned char[p_page_bytes];
-	memset( raw_data, '\0', p_page_bytes );
+	if (frame_bytes > 0)
+	{
+		raw_block = new unsigned char[frame_bytes + PAGE_ALIGN - 1];
+		raw_data = ALIGN_UP( raw_block );
+		memset( raw_data, '\0', frame_bytes );
+	}
+	else
+	{
+		raw_data = raw_block = new unsigned char[p_page_bytes];
+		memset( raw_data, '\0', p_page_bytes );
+	}
 
 	// create the array of pointers to hcodes in a page
 /*	data = (U_int**)malloc( sizeof(U_int*) * p_page_entries );*/
@@ -58,7 +76,7 @@ PAGE::PAGE( int dims, int p_entries, MED *m ) {
 	index = (U_int*)base_ptr;
 	for ( int i = 0; i < p_page_entries; i++ )
 	{
-		data[i] = (U_int*)base_ptr + i * dimensions;
+		data[i] = (U_int*)base_ptr + i * p_record_words;
 	}
 }
 
@@ -67,16 +85,19 @@ PAGE::PAGE( int dims, int p_entries, MED *m ) {
 /*============================================================================*/
 // slightly more efficient than the normal constructor - used in db creation
 // p_page_entries - includes the index entry
-PAGE::PAGE( int dims, int p_entries ) {
+// kwords - the no. of U_ints of hcode kept with each record (0 if none are)
+PAGE::PAGE( int dims, int kwords, int p_entries ) {
 	dimensions = dims;
+	keys = kwords > 0;
+	p_record_words = dimensions + kwords;
 	p_page_entries = p_entries;
-	p_page_entry_size = sizeof(U_int) * dimensions;
-	p_page_bytes = sizeof(pageheader_t) + p_page_entries * p_page_entry_size;
+	p_page_entry_size = sizeof(U_int) * p_record_words;
+	p_page_bytes = PAGE_BYTES( dimensions, kwords, p_page_entries );
 
  	// the data block that makes up a page (inc. page header and index entry)
 	// +1 for the index
 /*	raw_data = (unsigned char*)malloc( sizeof(pageheader_t) + p_page_entries * p_page_entry_size );*/
-	raw_data = new unsigned char[p_page_bytes];
+	raw_data = raw_block = new unsigned char[p_page_bytes];
 	memset( raw_data, '\0', p_page_bytes );
 
 	// create the array of pointers to hcodes in a page
@@ -100,19 +121,20 @@ PAGE::PAGE( int dims, int p_entries ) {
 /*============================================================================*/
 PAGE::~PAGE() {
 	delete [] data;
-	delete raw_data;
+	delete [] raw_block;
 }
 
 /*============================================================================*/
 /***                   PAGE::p_find_pageslot				    ***/
 /*============================================================================*/
-int PAGE::p_find_pageslot( const PU_int * const search_point )
+// searches slots 'low' onwards
+int PAGE::p_find_pageslot( const PU_int * const search_point, int low )
 {
-	int	low = 1, mid, high = page_hdr->size, i, j;
+	int	mid, high = page_hdr->size, i, j;
 	PU_int *page_point;	// no storage required
 
-	if (high == 0) /* page is empty */
-		return -1;
+	if (high < low) /* page is empty, or no slots are to be searched */
+		return -low;
 
 	while (high >= low)
 	{
@@ -147,50 +169,46 @@ int PAGE::p_find_pageslot( const PU_int * const search_point )
 /*============================================================================*/
 // split the page which calls this between left and right pages
 // (left and right are empty pages in the buffer
-void PAGE::p_split_page(PAGE& left, PAGE& right, int newlpage)
+// left_share is the percentage of the records that go on the left page (the
+// rest go on the right, whose key is the lowest hcode among them); 50 splits
+// the page at its median. Each page gets at least one record
+void PAGE::p_split_page(PAGE& left, PAGE& right, int newlpage, int left_share)
 {
-	// allocate storage to median, pass it to median funcs, then delete it
+	int		i, lcount, rcount;
+	int		k = (int)((long)page_hdr->size * left_share / 100);
 
-	int		i, j, k, lcount, rcount;
+	if (k < 1)
+		k = 1;
+	if (k > page_hdr->size - 1)
+		k = page_hdr->size - 1;
 
-	Hcode	median = p_find_median();
+	const HU_int	*median = p_find_split_key( k );	// a row of MEDkeys
 
 	/* re-distribute the data */
 	for (i = lcount = rcount = 0; i < page_hdr->size; i++)
 	{
-		for (j = 0, k = dimensions - 1; k >= 0; k--)
-		/* we're dealing with CODES, not ATTRIBUTES, here:
-			therefore init k to DIM - 1 */
-		{
-			if (M->MEDdata[i].hcode[k] == median.hcode[k])
-				continue;
-			if (M->MEDdata[i].hcode[k] < median.hcode[k])
-			{	j = -1; break;}  /* a < b */
-			else
-			{	j = 1; break;} /* a > b */
-		}
-
-		if (j == -1)
+		/* we're dealing with CODES, not ATTRIBUTES, here */
+		if (keycmp( M->MEDkeys + i * key_words, median, key_words ) < 0)
 		{
 			lcount++;
-			keycopy( left.data[lcount], data[i + 1], dimensions );
+			keycopy( left.data[lcount], data[i + 1], p_record_words );
 		}
 		else
 		{
 			rcount++;
-			keycopy( right.data[rcount], data[i + 1], dimensions );
+			keycopy( right.data[rcount], data[i + 1], p_record_words );
 		}
 	}
 
 	left.page_hdr->lpage = page_hdr->lpage;
 	left.page_hdr->size = lcount;
 
-	keycopy( left.index, index, dimensions );
+	keycopy( left.index, index, key_words );
 
 	right.page_hdr->lpage = newlpage;
 	right.page_hdr->size = rcount;
 
-	keycopy( right.index, median );
+	keycopy( right.index, median, key_words );
 }
 
 /*============================================================================*/
@@ -217,21 +235,21 @@ void PAGE::p_merge_pages(PAGE& left, PAGE& right)
 		}
 		if (j < 0)	/* L < R */
 		{
-			keycopy( data[NL], left.data[L], dimensions );
+			keycopy( data[NL], left.data[L], p_record_words );
 			L++;
 		}
 		else
 		{
-			keycopy( data[NL], right.data[R], dimensions );
+			keycopy( data[NL], right.data[R], p_record_words );
 			R++;
 		}
 	}
 
 	for (; L <= left.page_hdr->size; L++, NL++)
-		keycopy( data[NL], left.data[L], dimensions );
+		keycopy( data[NL], left.data[L], p_record_words );
 
 	for (; R <= right.page_hdr->size; R++, NL++)
-		keycopy( data[NL], right.data[R], dimensions );
+		keycopy( data[NL], right.data[R], p_record_words );
 
 	if (NL - 1 != left.page_hdr->size + right.page_hdr->size)
 		errorexit("ERROR 1 in merge_pages()\n");
@@ -239,7 +257,7 @@ void PAGE::p_merge_pages(PAGE& left, PAGE& right)
 	/* adjust details of new left page */
 	page_hdr->size = left.page_hdr->size + right.page_hdr->size;
 	page_hdr->lpage = left.page_hdr->lpage;
-	keycopy( index, left.index, dimensions );
+	keycopy( index, left.index, key_words );
 }
 
 /*============================================================================*/
@@ -252,15 +270,9 @@ int PAGE::p_shift_from_left(PAGE& right, PAGE& newleft, PAGE& newright )
 	int		L, NL, R, NR, i, j;
 	PU_int	*ldata, *rdata;	// no storage required
 
-	Hcode	median = p_find_median_left( right );	// returns an hcode
+	const HU_int	*median = p_find_median_left( right );	// a row of MEDkeys
 
-	for (i = dimensions - 1; i >= 0; i--)
-	{
-		if (median.hcode[i] == UINT_MAX)
-			continue;
-		break;
-	}
-	if (i == -1)
+	if (median == NULL)
 		return 1; /* median is in the right page - do nothing */
 
 	/* move data from left and right to newleft or newright
@@ -274,17 +286,17 @@ int PAGE::p_shift_from_left(PAGE& right, PAGE& newleft, PAGE& newright )
 	{
 		for (; L <= page_hdr->size; L++, NL++)
 		{
-			for (j = 0, i = dimensions - 1; i >= 0; i--)
+			for (j = 0, i = key_words - 1; i >= 0; i--)
 			/* we're dealing with CODES, not ATTRIBUTES, here:
-				therefore init i to dimensions - 1 */
+				therefore init i to key_words - 1 */
 			{
-				if (M->MEDdata[L-1].hcode[i] < median.hcode[i])
+				if (M->MEDkeys[(L-1) * key_words + i] < median[i])
 				{	j = -1;  break;  }
-				if (M->MEDdata[L-1].hcode[i] > median.hcode[i])
+				if (M->MEDkeys[(L-1) * key_words + i] > median[i])
 				{	j = 1;  break;  }
 			}
 			if (j < 0)	/* L < median */
-				keycopy( newleft.data[NL], data[L], dimensions );
+				keycopy( newleft.data[NL], data[L], p_record_words );
 			else
 				break;
 		}
@@ -306,49 +318,49 @@ int PAGE::p_shift_from_left(PAGE& right, PAGE& newleft, PAGE& newright )
 				{	j = 1;  break;  }
 			}
 			if (j < 0)	/* R < L */
-				keycopy( newright.data[NR], right.data[R], dimensions );
+				keycopy( newright.data[NR], right.data[R], p_record_words );
 			else
 				break;
 		}
-		keycopy( newright.data[NR], data[L], dimensions );
+		keycopy( newright.data[NR], data[L], p_record_words );
 	}
 
 	for (; L <= page_hdr->size; L++)
 	{
-		for (j = 0, i = dimensions - 1; i >= 0; i--)
+		for (j = 0, i = key_words - 1; i >= 0; i--)
 		/* we're dealing with CODES, not ATTRIBUTES, here:
-			therefore init i to dimensions - 1 */
+			therefore init i to key_words - 1 */
 		{
-			if (M->MEDdata[L - 1].hcode[i] < median.hcode[i])
+			if (M->MEDkeys[(L - 1) * key_words + i] < median[i])
 			{	j = -1;  break;  }
-			if (M->MEDdata[L - 1].hcode[i] > median.hcode[i])
+			if (M->MEDkeys[(L - 1) * key_words + i] > median[i])
 			{	j = 1;  break;  }
 		}
 		if (j < 0)
 		{
-			keycopy( newleft.data[NL], data[L], dimensions );
+			keycopy( newleft.data[NL], data[L], p_record_words );
 			NL++;
 		}
 		else
 		{
-			keycopy( newright.data[NR], data[L], dimensions );
+			keycopy( newright.data[NR], data[L], p_record_words );
 			NR++;
 		}
 	}
 
 	for (; R <= right.page_hdr->size; R++, NR++)
-		keycopy( newright.data[NR], right.data[R], dimensions );
+		keycopy( newright.data[NR], right.data[R], p_record_words );
 
 	if (NL + NR - 2 != page_hdr->size + right.page_hdr->size)
 		errorexit("ERROR 1 in p_shift_from_left()\n");
 
 	newleft.page_hdr->lpage = page_hdr->lpage;
 	newleft.page_hdr->size = NL - 1;
-	keycopy( newleft.index, index, dimensions );
+	keycopy( newleft.index, index, key_words );
 
 	newright.page_hdr->lpage = right.page_hdr->lpage;
 	newright.page_hdr->size = NR - 1;
-	keycopy( newright.index, median );
+	keycopy( newright.index, median, key_words );
 
 	return 0;
 }
@@ -363,32 +375,26 @@ int PAGE::p_shift_from_right(PAGE& right, PAGE& newleft, PAGE& newright )
 	int		L, NL, R, NR, i, j;
 	PU_int	*ldata, *rdata;	// no storage required
 
-	Hcode	median = p_find_median_right( right );	// returns an hcode
+	const HU_int	*median = p_find_median_right( right );	// a row of MEDkeys
 
-	for (i = dimensions - 1; i >= 0; i--)
-	{
-		if (median.hcode[i] == 0)
-			continue;
-		break;
-	}
-	if (i == -1)
+	if (median == NULL)
 		return 1; /* median is in the left page - do nothing */
 
 	for (L = NL = R = NR = 1; L <= page_hdr->size && R <= right.page_hdr->size; R++, NL++)
 	{
 		for (; R <= right.page_hdr->size; R++, NR++)
 		{
-			for (j = 0, i = dimensions - 1; i >= 0; i--)
+			for (j = 0, i = key_words - 1; i >= 0; i--)
 			/* we're dealing with CODES, not ATTRIBUTES, here:
-				therefore init i to dimensions - 1 */
+				therefore init i to key_words - 1 */
 			{
-				if (M->MEDdata[page_hdr->size + R - 1].hcode[i] < median.hcode[i])
+				if (M->MEDkeys[(page_hdr->size + R - 1) * key_words + i] < median[i])
 				{	j = -1;  break;  }
-				if (M->MEDdata[page_hdr->size + R - 1].hcode[i] > median.hcode[i])
+				if (M->MEDkeys[(page_hdr->size + R - 1) * key_words + i] > median[i])
 				{	j = 1;  break;  }
 			}
 			if (j >= 0)	/* R >= median */
-				keycopy( newright.data[NR], right.data[R], dimensions );
+				keycopy( newright.data[NR], right.data[R], p_record_words );
 			else
 				break;
 		}
@@ -410,808 +416,246 @@ int PAGE::p_shift_from_right(PAGE& right, PAGE& newleft, PAGE& newright )
 				{	j = 1;  break;  }
 			}
 			if (j < 0)	/* L < R */
-				keycopy( newleft.data[NL], data[L], dimensions );
+				keycopy( newleft.data[NL], data[L], p_record_words );
 			else
 				break;
 		}
-		keycopy( newleft.data[NL], right.data[R], dimensions );
+		keycopy( newleft.data[NL], right.data[R], p_record_words );
 	}
 
 	for (; R <= right.page_hdr->size; R++)
 	{
-		for (j = 0, i = dimensions - 1; i >= 0; i--)
+		for (j = 0, i = key_words - 1; i >= 0; i--)
 		/* we're dealing with CODES, not ATTRIBUTES, here:
-			therefore init i to dimensions - 1 */
+			therefore init i to key_words - 1 */
 		{
-			if (M->MEDdata[page_hdr->size + R - 1].hcode[i] < median.hcode[i])
+			if (M->MEDkeys[(page_hdr->size + R - 1) * key_words + i] < median[i])
 			{	j = -1;  break;  }
-			if (M->MEDdata[page_hdr->size + R - 1].hcode[i] > median.hcode[i])
+			if (M->MEDkeys[(page_hdr->size + R - 1) * key_words + i] > median[i])
 			{	j = 1;  break;  }
 		}
 		if (j < 0)
 		{
-			keycopy( newleft.data[NL], data[R], dimensions );
+			keycopy( newleft.data[NL], right.data[R], p_record_words );
 			NL++;
 		}
 		else
 		{
-			keycopy( newright.data[NR], data[R], dimensions );
+			keycopy( newright.data[NR], right.data[R], p_record_words );
 			NR++;
 		}
 	}
 
 	for (; L <= page_hdr->size; L++, NL++)
-		keycopy( newleft.data[NL], data[L], dimensions );
+		keycopy( newleft.data[NL], data[L], p_record_words );
 
 	if (NL + NR - 2 != page_hdr->size + right.page_hdr->size)
 		errorexit("ERROR 1 in shift_from_right()\n");
 
 	newleft.page_hdr->lpage = page_hdr->lpage;
 	newleft.page_hdr->size = NL - 1;
-	keycopy( newleft.index, index, dimensions );
+	keycopy( newleft.index, index, key_words );
 
 	newright.page_hdr->lpage = right.page_hdr->lpage;
 	newright.page_hdr->size = NR - 1;
-	keycopy( newright.index, median );
+	keycopy( newright.index, median, key_words );
 
 	return 0;
 }
 
 /*============================================================================*/
-/***                   median_of_3	  				      */
+/***                   PAGE::p_record_keys	  			    ***/
 /*============================================================================*/
-/* two or more parameters may point to addresses containing the same values */
-static Hcode median_of_3( Hcode& first, Hcode& second, Hcode& third,
-							int dimensions )
+// places the hcodes of the records of 'page' in MEDkeys, from row 'first'
+// on: they are copied from the page if it keeps them and encoded otherwise
+void PAGE::p_record_keys( PAGE& page, int first )
 {
-	int		j, k;
-	Hcode	min = second, max = first, median(dimensions);
+	int i, size = page.page_hdr->size;
 
-	/* find max and min of first 2 */
-	for (k = dimensions - 1; k >= 0; k--)
+	if (keys)
 	{
-		if (first.hcode[k] > second.hcode[k])
-			break;
-		if (first.hcode[k] < second.hcode[k])
-		{
-			min = first;
-			max = second;
-			break;
-		}
+		for (i = 1; i <= size; i++)
+			keycopy( M->MEDkeys + (first + i - 1) * key_words, page.p_key( i ),
+				key_words );
+		return;
 	}
 
-	/* find the median of the first 3 */
-	for (j = 0, k = dimensions - 1; k >= 0; k--)
-	{
-		if (third.hcode[k] > max.hcode[k])
-		{
-			median = max;
-			max = third;
-			j = 1;
-			break;
-		}
-		if (third.hcode[k] < max.hcode[k])
-			break;
-	}
-
-
-	if (j == 0)	/* third < max */
-	{
-		median = third;
-		for (k = dimensions - 1; k >= 0; k--)
-		{
-			if (third.hcode[k] > min.hcode[k])
-				break;
-			if (third.hcode[k] < min.hcode[k])
-			{
-				median = min;
-				min = third;
-				break;
-			}
-		}
-	}
-	return median;
+	// the records are contiguous from data[1] so are all encoded together
+	curve->encode_batch( page.data[1], size, M->MEDkeys + first * key_words,
+		dimensions, order );
 }
 
 /*============================================================================*/
-/***                   median_of_5	  				      */
+/***                   PAGE::p_select_key	  			    ***/
 /*============================================================================*/
-/* two or more parameters may point to addresses containing the same values */
-Hcode median_of_5( Hcode& first, Hcode& second, Hcode& third,
-							Hcode& fourth, Hcode& fifth, int dimensions)
+// returns the hcode of rank 'k' (from 0) among the 'n' hcodes in MEDkeys from
+// row 'first' on. Only MEDidx is reordered, so the rows stay where they are
+const HU_int* PAGE::p_select_key( int first, int n, int k )
 {
-	int		j, k, mincount = 0, maxcount = 0;
-	Hcode	min = second, max = first, median(dimensions);
-
-	/* find max and min of first 2 */
-	for (k = dimensions - 1; k >= 0; k--)
-	{
-		if (first.hcode[k] > second.hcode[k])
-			break;
-		if (first.hcode[k] < second.hcode[k])
-		{
-			min = first;
-			max = second;
-			break;
-		}
-	}
-
-	/* find the median of the first 3 */
-	for (j = 0, k = dimensions - 1; k >= 0; k--)
-	{
-		if (third.hcode[k] > max.hcode[k])
-		{
-			median = max;
-			max = third;
-			j = 1;
-			break;
-		}
-		if (third.hcode[k] < max.hcode[k])
-			break;
-	}
-
-
-	if (j == 0)	/* third < max */
-	{
-		median = third;
-		for (k = dimensions - 1; k >= 0; k--)
-		{
-			if (third.hcode[k] > min.hcode[k])
-				break;
-			if (third.hcode[k] < min.hcode[k])
-			{
-				median = min;
-				min = third;
-				break;
-			}
-		}
-	}
+	int	i, *idx = M->MEDidx;
 
-	/* see if fourth < or > median */
-	for (k = dimensions - 1; k >= 0; k--)
-	{
-		if (fourth.hcode[k] > median.hcode[k])
-		{
-			maxcount++;
-			break;
-		}
-		if (fourth.hcode[k] < median.hcode[k])
-		{
-			mincount++;
-			break;
-		}
-	}
+	for (i = 0; i < n; i++)
+		idx[i] = first + i;
+	nth_element( idx, idx + k, idx + n, KEY_LESS( M->MEDkeys, key_words ) );
 
-	/* see if fifth < or > median */
-	for (k = dimensions - 1; k >= 0; k--)
-	{
-		if (fifth.hcode[k] > median.hcode[k])
-		{
-			maxcount++;
-			break;
-		}
-		if (fifth.hcode[k] < median.hcode[k])
-		{
-			mincount++;
-			break;
-		}
-	}
-
-	/* both fourth & fifth are < median */
-	if (mincount > maxcount)
-	{
-		median = min;
-		for (k = dimensions - 1; k >= 0; k--)
-		{
-			if (min.hcode[k] > fourth.hcode[k])
-				break;
-			if (min.hcode[k] < fourth.hcode[k])
-			{
-				median = fourth;
-				break;
-			}
-		}
-
-		for (k = dimensions - 1; k >= 0; k--)
-		{
-			if (median.hcode[k] > fifth.hcode[k])
-				break;
-			if (median.hcode[k] < fifth.hcode[k])
-			{
-				median = fifth;
-				break;
-			}
-		}
-	}
-
-	/* both fourth & fifth are > median */
-	if (mincount < maxcount)
-	{
-		median = fourth;
-		for (k = dimensions - 1; k >= 0; k--)
-		{
-			if (max.hcode[k] > fourth.hcode[k])
-				break;
-			if (max.hcode[k] < fourth.hcode[k])
-			{
-				median = max;
-				break;
-			}
-		}
-
-		for (k = dimensions - 1; k >= 0; k--)
-		{
-			if (median.hcode[k] > fifth.hcode[k])
-			{
-				median = fifth;
-				break;
-			}
-			if (median.hcode[k] < fifth.hcode[k])
-				break;
-		}
-	}
-	return median;
+	return M->MEDkeys + idx[k] * key_words;
 }
 
 /*============================================================================*/
-/***                   median_sortfun	  			      */
+/***                   PAGE::p_find_split_key	  			    ***/
 /*============================================================================*/
-bool median_sortfun( Hcode a, Hcode b )
+// the page's hcode of rank k (from 0), eg its median: the k records below it
+// are to go on one page and the others on another; their hcodes are in MEDkeys
+const HU_int* PAGE::p_find_split_key( int k )
 {
-	for ( int i = a.hcode.size() - 1; i >= 0; i-- )
-		if ( a.hcode[i] < b.hcode[i] )
-			return true;
-		else
-			if ( a.hcode[i] > b.hcode[i] )
-				return false;
-	// should never get here - a and b should always be different
-	errorexit("ERROR 1 in median_sortfn()\n");
-	return false;
-}
+	if (page_hdr->size <= THRESHOLD)
+		errorexit("ERROR in p_find_split_key(): data pages are too small!\n");
 
-
-#ifdef xJKLDEBUGxxxx
-void print_hcode(string str, Hcode * hval, int dims)
-{
-	fjunk3 << "\t\t" << str << "\t";
-//	for (int z = dims - 1; z >= 0; z--)
-	for (int z = 0; z < dims; z++)
-	{
-		fjunk3 << setw(15) << hval->hcode[z];
-	}
-	fjunk3 << "\n";
+	p_record_keys( *this, 0 );
+	return p_select_key( 0, page_hdr->size, k );
 }
-#endif
-
 
 /*============================================================================*/
-/***                   PAGE::p_find_median  (of 5)			    ***/
+/***                   PAGE::p_find_median_left	  		    ***/
 /*============================================================================*/
-// the result is placed in 'median'
-Hcode PAGE::p_find_median()
+// called by the left-hand page: the median of the hcodes of the records of
+// both pages, or NULL if it is on the right page. Since every hcode on the
+// left page is below those on the right, only the left page's are needed;
+// they are in MEDkeys
+const HU_int* PAGE::p_find_median_left( PAGE& right )
 {
-	int		start = 0, end = page_hdr->size - 1, i, j, k, n, m, nobj, count;
-	HU_int	*key = new HU_int[dimensions];
- 	Hcode	*first, *second, *third, *fourth, *fifth, *min, *min2, *min3,
-			*max, *max2, *max3, *median;
-#ifdef xJKLDEBUGxxxx
-	fjunk3 << "Outputting page no. "<< page_hdr->lpage <<"'s record's hcodes followed by data values\n";
-#endif
-	/* place page in oflowslot's data's hilbert codes in MEDdata array */
-	for (i = 1; i <= page_hdr->size; i++)
-	{
-		// copy to an Hcode, an encoding of a PU_int*
-		// ENCODE returns 'key' (a HU_int*)
-		keycopy( M->MEDdata[i - 1],  ENCODE( key, data[i], dimensions ) );
-#ifdef xJKLDEBUGxxxx
-		for (int j = 0; j < dimensions; j++)
-			fjunk3 << setw(15) << key[j];
-		fjunk3 << " " << i << " ";
-		PU_int *D = data[i];
-		for (int j = 0; j < dimensions; j++)
-			fjunk3 << setw(15) << D[j];
-		fjunk3 << endl;
+	int	size = page_hdr->size, k = (size + right.page_hdr->size) / 2;
 
-#endif
-	}
-	delete [] key;
+	if (size + right.page_hdr->size <= THRESHOLD)
+		errorexit("ERROR in p_find_median_left(): data pages are too small!\n");
+	if (k >= size)
+		return NULL;
 
-#ifdef xJKLDEBUGxxxx
-	fjunk3 << "\nOutputting MEDdata's hcodes\n";
-	for ( int j = 0; j < page_hdr->size; j++ )
-	{
-		for (int z = 0; z < dimensions; z++)
-			fjunk3 << setw(15) << M->MEDdata[j].hcode[z];
-		fjunk3 << " " << j << endl;
-	}
-#endif
+	p_record_keys( *this, 0 );
+	return p_select_key( 0, size, k );
+}
 
-	/* the first iteration of the outer for loop should NOT ALTER THE POSITIONS
-	of the hcodes in MEDdata (ie sort them) because the positions of the
-	hcodes originally placed in MEDdata correspond to positions of records
-	(stored as attribute values) on the origial data page and, later on, we want
-	to compare the 1st (etc) MEDdata hcode with the median and do something
-	with the 1st (etc) data page's record according to the results of the
-	comparison (eg move the record to the left or right page of a pair of pages):
-	that is why we check the value of end-start before entering the loop in the
-	first place */
-
-	if (end - start <= THRESHOLD)
-	{
-		cout << "start = " << start << " end = " << end << " THRESHOLD = " << THRESHOLD << endl;
-		errorexit("ERROR in p_find_median(): data pages are too small!\n");
-	}
+/*============================================================================*/
+/***                   PAGE::p_find_median_right	  		    ***/
+/*============================================================================*/
+// called by the left-hand page: the median of the hcodes of the records of
+// both pages, or NULL if it is on the left page (or is the right page's
+// lowest, when nothing would move). Only the right page's hcodes are needed;
+// they are in MEDkeys after as many rows as the left page has records
+const HU_int* PAGE::p_find_median_right( PAGE& right )
+{
+	int	size = page_hdr->size, k = (size + right.page_hdr->size) / 2;
 
-	for (n = 0; end != start; n++)
-	{
-		// I found the sort function couldn't cope with values of about 30 for THRESHOLD
-		if (end - start <= 10)//THRESHOLD)
-		{
-			nobj = end - start + 1;
+	if (size + right.page_hdr->size <= THRESHOLD)
+		errorexit("ERROR in p_find_median_right(): data pages are too small!\n");
+	if (k <= size)
+		return NULL;
 
-			sort( &(M->MEDdata[start]), &(M->MEDdata[start + nobj]), median_sortfun );
-//			sort( (M->MEDdata[start]), (M->MEDdata[start + nobj]), median_sortfun );
+	p_record_keys( right, size );
+	return p_select_key( size, right.page_hdr->size, k - size );
+}
 
-			return M->MEDdata[start + nobj / 2];
-		}
+/*============================================================================*/
+/*                            		                          	      */
+/*                            PACKED PAGES			      	      */
+/*                            		                          	      */
+/*============================================================================*/
+/* On disk a page may be packed: after the header, the index entry and then
+   each record's coordinates (and hcode, if kept) follow one another in a
+   stream of bits, each coordinate taking 'order' bits rather than a U_int.
+   Pages are unpacked as they are read into the buffer and packed as they are
+   written out, so nothing else sees the packed form. */
 
-		for (i = start, count = 0; i <= end; i += 5)
-		// find median of 3, 4 or 5 - otherwise ignore the values
-		{
-			if ((m = end + 1 - i) > 2)
-			{
-				// first, find the median of the first three
-				// first = &MEDdata[i]; second = first + 1; third = first + 2;
-				if (n == 0)
-				{
-//  NEVER EXECUTED? - yes! first time (only) the outer for loop iterates - hcodes are
-// taken 'randomly' from MEDdata according to sequnce of numbers held in MEDmap
-
- 					first = &(M->MEDdata[M->MEDmap[i]]);
-					second = &(M->MEDdata[M->MEDmap[i + 1]]);
-					third = &(M->MEDdata[M->MEDmap[i + 2]]);
-				}
-				else
-				{
-// CHECK VALUES OF SECOND, THIRD
-					first = &(M->MEDdata[i]);
-					second = first + 1;
-					third = first + 2;
-				}
-#ifdef xJKLDEBUGxxxx
-fjunk3 << "step 1 - " << n <<endl;
-#endif
+typedef unsigned long long	U_int64;
 
-				for (k = dimensions - 1; k >= 0; k--)
-				{
-					if (first->hcode[k] > second->hcode[k])
-					{
-						max = first;
-						min = second;
-						break;
-					}
-					if (first->hcode[k] < second->hcode[k])
-					{
-						min = first;
-						max = second;
-						break;
-					}
-				}
-#ifdef xJKLDEBUGxxxx
-fjunk3 << "step 2" <<endl;
-print_hcode( "max   ",max  , dimensions );
-print_hcode(  "min   ",min , dimensions );
-#endif
+/*============================================================================*/
+/***                   put_bits / get_bits				    ***/
+/*============================================================================*/
+// the low 'nbits' (1 - WORDBITS) of 'value' are placed at bit 'pos' of 'out',
+// which must have been zeroed
+static inline void put_bits( U_int *out, long pos, U_int value, int nbits )
+{
+	U_int64	v = (U_int64)(nbits == WORDBITS ? value : value & (((U_int)1 << nbits) - 1))
+				<< (pos % WORDBITS);
 
-				
-				for (j = 0, k = dimensions - 1; k >= 0; k--)
-				{
-					if (third->hcode[k] > max->hcode[k])
-					{
-						median = max;
-						max = third;
-						j = 1;
-						break;
-					}
-					if (third->hcode[k] < max->hcode[k])
-						break;
-				}
-#ifdef xJKLDEBUGxxxx
-fjunk3 << "step 3" <<endl;
-if ( j==1)
-{	
-	print_hcode( "median",median  , dimensions );
-	print_hcode(  "max   ",max , dimensions );
+	out[pos / WORDBITS] |= (U_int)v;
+	if ((pos % WORDBITS) + nbits > WORDBITS)
+		out[pos / WORDBITS + 1] |= (U_int)(v >> WORDBITS);
 }
-#endif
 
-				if (j == 0)
-				{
-					for (k = dimensions - 1; k >= 0; k--)
-					{
-						if (third->hcode[k] > min->hcode[k])
-						{
-							median = third;
-							break;
-						}
-						if (third->hcode[k] < min->hcode[k])
-						{
-							median = min;
-							min = third;
-							break;
-						}
-					}
-#ifdef xJKLDEBUGxxxx
-fjunk3 << "step 4" <<endl;
-print_hcode( "median",median  , dimensions );
-print_hcode(  "min   ",min , dimensions );
-#endif
-				}
-
-				if (m > 4) /* we are finding the median of 5 */
-				{
-/*					Hcode *fourth = first + 3, *fifth = first + 4,*/
-					int mincount = 0, maxcount = 0;
-
-					if (n == 0)
-					{
-						fourth = &(M->MEDdata[M->MEDmap[i + 3]]);
-						fifth = &(M->MEDdata[M->MEDmap[i + 4]]);
-					}
-					else
-					{
-						fourth = first + 3;
-						fifth = first + 4;
-					}
-#ifdef xJKLDEBUGxxxx
-fjunk3 << "step 5 - " << n <<endl;
-#endif
-					for (k = dimensions - 1; k >= 0; k--)
-					{
-						if (fourth->hcode[k] > median->hcode[k])
-						{
-							max2 = fourth;
-							maxcount++;
-#ifdef xJKLDEBUGxxxx
-fjunk3 << "step 6a" <<endl;
-print_hcode( "max2  ",max2  , dimensions );
-#endif
-							break;
-						}
-						if (fourth->hcode[k] < median->hcode[k])
-						{
-							min2 = fourth;
-							mincount++;
-#ifdef xJKLDEBUGxxxx
-fjunk3 << "step 6b" <<endl;
-print_hcode(  "min2  ",min2 , dimensions );
-#endif
-							break;
-						}
-					}
-
-					for (k = dimensions - 1; k >= 0; k--)
-					{
-						if (fifth->hcode[k] > median->hcode[k])
-						{
-							max3 = fifth;
-							maxcount++;
-#ifdef xJKLDEBUGxxxx
-fjunk3 << "step 7a" <<endl;
-print_hcode(  "max3  ",max3 , dimensions );
-#endif
-							break;
-						}
-						if (fifth->hcode[k] < median->hcode[k])
-						{
-							min3 = fifth;
-							mincount++;
-#ifdef xJKLDEBUGxxxx
-fjunk3 << "step 7b" <<endl;
-print_hcode( "min3  ",min3  , dimensions );
-#endif
-							break;
-						}
-					}
-
-					if (mincount > maxcount)
-					{
-						for (k = dimensions - 1; k >= 0; k--)
-						{
-							if (min->hcode[k] > min2->hcode[k])
-							{
-								median = min;
-								break;
-							}
-							if (min->hcode[k] < min2->hcode[k])
-							{
-								median = min2;
-								break;
-							}
-						}
-
-						for (k = dimensions - 1; k >= 0; k--)
-						{
-							if (median->hcode[k] > min3->hcode[k])
-								break;
-							if (median->hcode[k] < min3->hcode[k])
-							{
-								median = min3;
-								break;
-							}
-						}
-#ifdef xJKLDEBUGxxxx
-fjunk3 << "step 8" <<endl;
-print_hcode( "median",median  , dimensions );
-#endif
-					}
-
-					if (mincount < maxcount)
-					{
-						for (k = dimensions - 1; k >= 0; k--)
-						{
-							if (max->hcode[k] > max2->hcode[k])
-							{
-								median = max2;
-								break;
-							}
-							if (max->hcode[k] < max2->hcode[k])
-							{
-								median = max;
-								break;
-							}
-						}
-
-						for (k = dimensions - 1; k >= 0; k--)
-						{
-							if (median->hcode[k] > max3->hcode[k])
-							{
-								median = max3;
-								break;
-							}
-							if (median->hcode[k] < max3->hcode[k])
-								break;
-						}
-#ifdef xJKLDEBUGxxxx
-fjunk3 << "step 9" <<endl;
-print_hcode( "median",median  , dimensions );
-#endif
-					}
-				}	/* end if (m > 4) */
-				count++;
-				M->MEDdata[end + count] = *median;
-
-				#ifdef xJKLDEBUGxxxx
-					fjunk3 << "\n....\n";
- 					for (int z = 0; z < dimensions; z++)
-//					for (int z = dimensions - 1; z >= 0; z--)
-						fjunk3 << setw(15) << M->MEDdata[end + count].hcode[z];
-					fjunk3 << " " << end + count << endl;
-
-				#endif
-
-			}	/* end if ((m = end + 1 - i) > 2) */
-		}	/* end inner for */
-		start = end + 1;
-		end += count;
-	}	/* end outer for */
+// the 'nbits' bits at bit 'pos' of 'in'
+static inline U_int get_bits( const U_int *in, long pos, int nbits )
+{
+	const U_int	*w = in + pos / WORDBITS;
+	U_int64	v = (U_int64)w[0];
+
+	if ((pos % WORDBITS) + nbits > WORDBITS)
+		v |= (U_int64)w[1] << WORDBITS;
+	v >>= pos % WORDBITS;
+	return nbits == WORDBITS ? (U_int)v : (U_int)v & (((U_int)1 << nbits) - 1);
 }
 
 /*============================================================================*/
-/***                   PAGE::p_find_median_left	  		    ***/
+/***                   PAGE::p_pack					    ***/
 /*============================================================================*/
-// called by the left-hand page
-Hcode PAGE::p_find_median_left( PAGE& right )
+// places the packed page in 'out', which must hold
+// PACKED_PAGE_BYTES( dimensions, order, keys, p_page_entries ) bytes
+void PAGE::p_pack( U_int *out ) const
 {
-	int i, n, m, temp, start, end, count, rstart, nobj, modifytemp, size = page_hdr->size;
-	HU_int	*key = new HU_int[dimensions];
-	Hcode dummy( dimensions );
-
-	for (i = 0; i < dimensions; i++)
-		dummy.hcode[i] = UINT_MAX;
-
-	/* place left page's data's hilbert codes in MEDdata array */
-	for (i = 1; i <= size; i++)
-		// copy to an Hcode, an encoding of a PU_int*
-		// ENCODE returns 'key' (a HU_int*)
-		keycopy( M->MEDdata[i - 1],  ENCODE( key, data[i], dimensions ) );
-	delete [] key;
-
-	/* fill the rest of left page with dummy data (max hcode) */
-	for (; i <= MAX_DATA; i++)    // CHECK ????
-		M->MEDdata[i - 1] = dummy;
+	int		i, j, n, key_bits = dimensions * order;
+	long	pos = 0;
+	U_int	*bits = out + sizeof(pageheader_t) / sizeof(U_int);
 
-	/* add extra dummy values to make a multiple of MEDIAN values */
-	temp = MAX_DATA % MEDIAN;    // CHECK ????
-	for (; temp != 0 && temp < MEDIAN; temp++, i++)
-		M->MEDdata[i - 1] = dummy;
+	memset( out, 0, PACKED_PAGE_BYTES( dimensions, order, keys, p_page_entries ) );
+	memcpy( out, page_hdr, sizeof(pageheader_t) );
 
-	rstart = i - 1;
-	start  = 0;
-	end    = size + right.page_hdr->size - 1;
-
-/* see lengthy comment at beginning of the MEDIAN of 5 version of
-	p_find_median ()*/
-
-	if (end - start <= THRESHOLD)
-		errorexit("ERROR in p_find_median_left(): data pages are too small!\n");
-
-	for (n = 0; end != start; n++)
+	for (j = 0; j < key_words; j++, pos += n)
 	{
-		if (end - start <= THRESHOLD)
-		{
-			nobj = end - start + 1;
-
-			sort( &(M->MEDdata[start]), &(M->MEDdata[start + nobj]), median_sortfun );
-
-			return M->MEDdata[start + nobj / 2];
-		}
-
-		for (i = start, count = 0, modifytemp = true; i <= end; i += MEDIAN)
-		/* find median of 3, 4 or 5 - otherwise ignore the values */
-		{
-			if ((m = end + 1 - i) > 2) /* at least 3 hcodes left */
+		n = key_bits - j * WORDBITS < WORDBITS ? key_bits - j * WORDBITS : WORDBITS;
+		put_bits( bits, pos, index[j], n );
+	}
+	for (i = 1; i <= page_hdr->size; i++)
+	{
+		for (j = 0; j < dimensions; j++, pos += order)
+			put_bits( bits, pos, data[i][j], order );
+		if (keys)
+			for (j = 0; j < key_words; j++, pos += n)
 			{
-				count++;
-				if (i >= rstart)
-				{
-					if (modifytemp)
-					{
-						temp = end + count;
-						modifytemp = false;
-					}
-					M->MEDdata[end + count] = dummy;
-				}
-				else
-				{
-					if (n == 0)
-						if (m > 4)
-							M->MEDdata[end + count] = median_of_5(
-									M->MEDdata[M->MEDmap[i]],
-									M->MEDdata[M->MEDmap[i + 1]],
-									M->MEDdata[M->MEDmap[i + 2]],
-									M->MEDdata[M->MEDmap[i + 3]],
-									M->MEDdata[M->MEDmap[i + 4]],
-									dimensions);
-						else
-							M->MEDdata[end + count] = median_of_3(
-									M->MEDdata[M->MEDmap[i]],
-									M->MEDdata[M->MEDmap[i + 1]],
-									M->MEDdata[M->MEDmap[i + 2]],
-									dimensions);
-					else
-						if (m > 4)
-							M->MEDdata[end + count] = median_of_5(
-									M->MEDdata[i],
-									M->MEDdata[i + 1],
-									M->MEDdata[i + 2],
-									M->MEDdata[i + 3],
-									M->MEDdata[i + 4],
-									dimensions);
-						else
-							M->MEDdata[end + count] = median_of_3(
-									M->MEDdata[i],
-									M->MEDdata[i + 1],
-									M->MEDdata[i + 2],
-									dimensions);
-				}
+				n = key_bits - j * WORDBITS < WORDBITS ? key_bits - j * WORDBITS : WORDBITS;
+				put_bits( bits, pos, data[i][dimensions + j], n );
 			}
-		}
-		start = end + 1;
-		end += count;
-		rstart = temp;
 	}
 }
 
 /*============================================================================*/
-/***                   PAGE::p_find_median_right	  		    ***/
+/***                   PAGE::p_unpack					    ***/
 /*============================================================================*/
-// called by the left-hand page
-Hcode PAGE::p_find_median_right( PAGE& right )
+// fills the page from the packed page in 'in'; one U_int beyond the packed
+// page is read from (but ignored)
+void PAGE::p_unpack( const U_int *in )
 {
-	int i, n, m, temp, start, end, count, rstart, nobj, size = page_hdr->size;
-	HU_int	*key = new HU_int[dimensions];
-	Hcode dummy( dimensions );
-
-	for (i = 0; i < dimensions; i++)
-		dummy.hcode[i] = 0;
-
-	/* place right page's data's hilbert codes in MEDdata array */
-	for (i = 1; i <= right.page_hdr->size; i++)
-		keycopy( M->MEDdata[size + i - 1],  ENCODE( key, data[i], dimensions ) );
-	delete [] key;
-
-	temp = size % MEDIAN;
-	rstart = size - temp;
-	/* place left page's key in MEDdata beyond the last multiple of MEDIAN
-	   entries in left page */
-	for (; temp > 0 ; temp--)
-		M->MEDdata[size - temp] = dummy;
-
-	/* the first MEDdata element which notionally holds the right page's
-	   hilbert codes, excluding those used to pad out the end of left page */
-	start = 0;
-	end = size + right.page_hdr->size - 1;
-
-/* see lengthy comment at beginning of the MEDIAN of 5 version of
-	p_find_median ()*/
-
-	if (end - start <= THRESHOLD)
-		errorexit("ERROR in p_find_median_right(): data pages are too small!\n");
-
-	/* find the median of the two pages */
-	for (n = 0; start != end; n++)
-	{
-		if (end - start <= THRESHOLD)
-		{
-			nobj = end - start + 1;
-
-			sort( &(M->MEDdata[start]), &(M->MEDdata[start + nobj]), median_sortfun );
-
-			return M->MEDdata[start + nobj / 2];
-		}
+	int		i, j, n, key_bits = dimensions * order;
+	long	pos = 0;
+	const U_int	*bits = in + sizeof(pageheader_t) / sizeof(U_int);
+	PU_int	*record;
 
-		for (i = start, count = 0, temp = 0; i <= end; i += MEDIAN)
-		{
-			count++;
-			if (i < rstart)
-			{
-				temp = end + count;
-				M->MEDdata[end + count] = dummy;
-				continue;
-			}
-
-			if (n == 0 && i == rstart)
-			{
-				M->MEDdata[end + count] = median_of_5(
-					M->MEDdata[i     < size ? i    : M->MEDmap[i - size]],
-					M->MEDdata[i + 1 < size ? i + 1: M->MEDmap[i - size +1]],
-					M->MEDdata[i + 2 < size ? i + 2: M->MEDmap[i - size +2]],
-					M->MEDdata[i + 3 < size ? i + 3: M->MEDmap[i - size +3]],
-					M->MEDdata[i + 4 < size ? i + 4: M->MEDmap[i - size +4]],
-					dimensions);
-				continue;
-			}
+	memcpy( page_hdr, in, sizeof(pageheader_t) );
 
-			if ((m = end + 1 - i) > 2)
+	for (j = 0; j < key_words; j++, pos += n)
+	{
+		n = key_bits - j * WORDBITS < WORDBITS ? key_bits - j * WORDBITS : WORDBITS;
+		index[j] = get_bits( bits, pos, n );
+	}
+	for (i = 1; i <= page_hdr->size; i++)
+	{
+		record = data[i];
+		for (j = 0; j < dimensions; j++, pos += order)
+			record[j] = get_bits( bits, pos, order );
+		if (keys)
+			for (j = 0; j < key_words; j++, pos += n)
 			{
-				if (n == 0)
-					if (m > 4)
-						M->MEDdata[end + count] = median_of_5(
-								M->MEDdata[M->MEDmap[i - size]],
-								M->MEDdata[M->MEDmap[i - size + 1]],
-								M->MEDdata[M->MEDmap[i - size + 2]],
-								M->MEDdata[M->MEDmap[i - size + 3]],
-								M->MEDdata[M->MEDmap[i - size + 4]],
-								dimensions);
-					else
-						M->MEDdata[end + count] = median_of_3(
-								M->MEDdata[M->MEDmap[i - size]],
-								M->MEDdata[M->MEDmap[i - size + 1]],
-								M->MEDdata[M->MEDmap[i - size + 2]],
-								dimensions);
-				else
-					if (m > 4)
-						M->MEDdata[end + count] = median_of_5(
-								M->MEDdata[i],
-								M->MEDdata[i + 1],
-								M->MEDdata[i + 2],
-								M->MEDdata[i + 3],
-								M->MEDdata[i + 4],
-								dimensions);
-					else
-						M->MEDdata[end + count] = median_of_3(
-								M->MEDdata[i],
-								M->MEDdata[i + 1],
-								M->MEDdata[i + 2],
-								dimensions);
+				n = key_bits - j * WORDBITS < WORDBITS ? key_bits - j * WORDBITS : WORDBITS;
+				record[dimensions + j] = get_bits( bits, pos, n );
 			}
-
-		}
-		start = end + 1;
-		end += count;
-		rstart = temp;
-		if (rstart - start < MEDIAN)
-			rstart = 0;
 	}
 }
@@ -14,6 +14,7 @@
 #endif
 
 class MED;
+struct SF_CURVE;
 
 /*============================================================================*/
 /*                            HEADER	                          	      */
@@ -26,6 +27,49 @@ typedef struct {
 	int size;	/* the number of Hcodes on a page: doesn't include INFO */
 } pageheader_t;
 
+// the no. of bytes in a page of 'p_entries' records, each of 'dims' coordinates
+// followed, if the page format keeps them (see PAGE), by 'kwords' U_ints of
+// the record's hcode
+#define		PAGE_BYTES( dims, kwords, p_entries )	\
+	(sizeof(pageheader_t) + (p_entries) * sizeof(U_int) * ((dims) + (kwords)))
+
+// the no. of bytes in such a page on disk when it is packed (see p_pack()):
+// each coordinate takes 'order' bits, as do the index entry and any record's
+// hcode 'dims' times over
+#define		PACKED_PAGE_BYTES( dims, order, keys, p_entries )	\
+	(sizeof(pageheader_t) + sizeof(U_int) * (((long)(dims) * (order) *	\
+	(1 + ((p_entries) - 1) * ((keys) ? 2 : 1)) + WORDBITS - 1) / WORDBITS))
+
+// pages on disk of a database whose pages are aligned (see DBASE) take a power
+// of two multiple of PAGE_ALIGN bytes, the size of a block of the file system
+// and of the kernel's page cache, and start on a multiple of it, as do their
+// frames in the buffer; so they can be read and written directly (O_DIRECT)
+#define		PAGE_ALIGN		4096
+
+// the first address at or after 'p' that is a multiple of PAGE_ALIGN
+#define		ALIGN_UP( p )	\
+	((unsigned char*)(p) + (-(unsigned long)(p) & (PAGE_ALIGN - 1)))
+
+/*============================================================================*/
+/***                   KEY_LESS	  				      ***/
+/*============================================================================*/
+// orders rows of 'key_words' U_ints by the hcodes they hold, eg the rows of
+// MEDkeys for nth_element()
+struct KEY_LESS {
+	KEY_LESS( const HU_int *k, int kwords ) : keys( k ), key_words( kwords ) {}
+	bool operator()( int a, int b ) const
+	{
+		const HU_int	*ka = keys + a * key_words, *kb = keys + b * key_words;
+
+		for (int i = key_words - 1; i >= 0; i--)
+			if (ka[i] != kb[i])
+				return ka[i] < kb[i];
+		return false;
+	}
+	const HU_int	*keys;
+	int		key_words;
+};
+
 /*============================================================================*/
 /*                            PAGE	                          	      */
 /*============================================================================*/
@@ -37,8 +81,9 @@ class PAGE {
 
 private:
 
-	PAGE( int dims, int p_entries, MED* );	// constructor (GIVE SECOND PARAM A DEFAULT VALUE ????)
-	PAGE( int dims, int p_entries );	// constuctor creates an empty page
+	PAGE( int dims, int order, const SF_CURVE *crv, bool keys, int p_entries, MED*,
+		int frame_bytes = 0 );	// constructor (GIVE SECOND PARAM A DEFAULT VALUE ????)
+	PAGE( int dims, int kwords, int p_entries );	// constuctor creates an empty page
 	~PAGE();
 
 	pageheader_t	*page_hdr;		// points at start of raw_data
@@ -46,23 +91,38 @@ private:
 	HU_int		**data;			// array of pointers into 'raw_data'
 	int		p_page_entries;		// no. of hcodes in a page (INCLUDING. index entry - first entry)
 	
-	int p_find_pageslot( const PU_int* const );	
+	int p_find_pageslot( const PU_int* const, int low = 1 );
 	void p_merge_pages( PAGE&, PAGE&);
- 	void p_split_page( PAGE&, PAGE&, int );
+ 	void p_split_page( PAGE&, PAGE&, int, int left_share = 50 );
  	int p_shift_from_left( PAGE&, PAGE&, PAGE& );
 	int p_shift_from_right( PAGE&, PAGE&, PAGE& );
 
 // private:
 	unsigned char 	*raw_data;
+	unsigned char	*raw_block;		// what raw_data was allocated from
 
 	int		dimensions;
-	int		p_page_entry_size;	// no. of bytes in an hcode
+	int		order;			// no. of bits per coordinate mapped to hcodes
+	const SF_CURVE	*curve;			// the curve that maps points to hcodes
+	int		key_words;		// no. of U_ints in an hcode (the index entry)
+	// whether each record's hcode is kept after its coordinates, so that
+	// splits and shifts need not encode the records
+	bool	keys;
+	int		p_record_words;		// no. of U_ints in a record
+	int		p_page_entry_size;	// no. of bytes in a record
 	int		p_page_bytes;		// no. of bytes on a page
 	MED		*M;
+
+	// the hcode of the record in 'slot' (pages that keep hcodes only)
+	HU_int* p_key( int slot ) { return data[slot] + dimensions; }
+	void p_record_keys( PAGE&, int );
+	void p_pack( U_int* ) const;
+	void p_unpack( const U_int* );
 	
- 	Hcode p_find_median();
-	Hcode p_find_median_left( PAGE& );
-	Hcode p_find_median_right( PAGE& );
+	const HU_int* p_select_key( int first, int n, int k );
+	const HU_int* p_find_split_key( int );
+	const HU_int* p_find_median_left( PAGE& );
+	const HU_int* p_find_median_right( PAGE& );
 };
 
 
@@ -9,21 +9,44 @@
 	#include "../hilbert/hilbert.h"
 	#include "../utils/utils.h"
 #endif
+#include "columns.h"
+
+#include <queue>
+#include <functional>	// greater
+#include <math.h>		// sqrt
 
 #define		ACTIVE			1
 #define		PARTIAL_MATCH		2
 #define		RANGE_QUERY		4
+#define		BALL_QUERY		8
+#define		REGION_QUERY		16
+// the page being searched lies wholly within a region query's region
+#define		PAGE_INSIDE		32
+// a range query's matches on the page being searched are in RET_SET::matches
+#define		PAGE_FILTERED		64
+
+// the bounds on RET_SET::skip_after
+#define		SKIP_MIN		4
+#define		SKIP_MAX		256
 
 using namespace std;
 
 /*============================================================================*/
 /*                            RET_SET::RET_SET                                */
 /*============================================================================*/
-RET_SET::RET_SET( int dims )
+RET_SET::RET_SET( int dims, BTree *bt ) :
+	cursor( bt )
 {
 	flags = 0;
 	Qsaf = 0;
 	buffslot = numspec = pos = 0;
+	mfirst = mlast = 0;
+	misses = 0;
+	skip_after = SKIP_MIN;
+	RQstate = NULL;		// allocated by the first range query to use the set
+	ball = NULL;		// and by the first ball query
+	classify = NULL;
+	region = NULL;
 
 	LB = new PU_int[dims];
 	UB = new PU_int[dims];
@@ -38,6 +61,8 @@ RET_SET::~RET_SET()
 {
 	delete [] LB;
 	delete [] UB;
+	delete RQstate;
+	delete ball;
 }
 
 /*============================================================================*/
@@ -48,8 +73,16 @@ bool DBASE::db_open_set( PU_int *point, int *set_id )
 {
 	int	i;
 	int	lpage;
-	HU_int	*minmatch = new U_int[dimensions];
-	HU_int	*key = new U_int[dimensions];
+	HU_int	*minmatch;
+	HU_int	*key;
+
+	// a coordinate beyond the curve can't be matched
+	for (i = 0; i < dimensions; i++)
+		if (point[i] != _UNSPECIFIED_ && point[i] > max_coord)
+			return false;
+
+	minmatch = new U_int[key_words];
+	key = new U_int[key_words];
 
 	// find an inactive set...
 	if (FreeRet_setList.size() > 0)
@@ -61,7 +94,7 @@ bool DBASE::db_open_set( PU_int *point, int *set_id )
 	// ...or create a new one
 	{
 		*set_id = Ret_set.size();
-		RET_SET *r = new RET_SET( dimensions );
+		RET_SET *r = new RET_SET( dimensions, &BT );
 		Ret_set.push_back( r );
 	}
 	
@@ -91,17 +124,17 @@ bool DBASE::db_open_set( PU_int *point, int *set_id )
 	}
 
        	// find the minimum match to the query
-	memset( minmatch, 0, sizeof(PU_int) * dimensions );
-	memset( key, 0, sizeof(PU_int) * dimensions );
+	memset( minmatch, 0, sizeof(HU_int) * key_words );
+	memset( key, 0, sizeof(HU_int) * key_words );
 
-       	if (false == H_nextmatch_PM( Ret_set[*set_id]->LB, minmatch, key,
-       			Ret_set[*set_id]->Qsaf, dimensions ))
+       	if (false == curve->nextmatch_PM( Ret_set[*set_id]->LB, minmatch, key,
+       			Ret_set[*set_id]->Qsaf, dimensions, order ))
        	{
        		errorexit("ERROR 2 in db_open_set(): lowest match not found\n");
        	}
 	
 	// find the page that may contain the minimum match       		
-	lpage = BT.idx_search( minmatch );
+	lpage = Ret_set[*set_id]->cursor.cur_seek( minmatch );
 	
 	Ret_set[*set_id]->flags = ACTIVE | PARTIAL_MATCH;
 	// bring in the first page to search
@@ -131,12 +164,17 @@ bool DBASE::db_open_set( PU_int *point, int *set_id )
 /***                   DBASE::db_range_open_set				    ***/
 /*============================================================================*/
 //	FOR RANGE QUERIES
+// returns false if no page can hold a match, eg if no page's MBR meets the range
 bool DBASE::db_range_open_set( PU_int* LB, PU_int *UB, int *set_id )
 {
 	int	i;
 	int	lpage;
-	HU_int	*minmatch = new U_int[dimensions];
-	HU_int	*key = new U_int[dimensions];
+	HU_int	minmatch[HKEY_MAX_WORDS], key[HKEY_MAX_WORDS];
+
+	// a range wholly beyond the curve can't be matched
+	for (i = 0; i < dimensions; i++)
+		if (LB[i] != _UNSPECIFIED_ && LB[i] > max_coord)
+			return false;
 
 	// find an inactive set...
 	if (FreeRet_setList.size() > 0)
@@ -148,7 +186,7 @@ bool DBASE::db_range_open_set( PU_int* LB, PU_int *UB, int *set_id )
 	// ...or create a new one
 	{
 		*set_id = Ret_set.size();
-		RET_SET *r = new RET_SET( dimensions );
+		RET_SET *r = new RET_SET( dimensions, &BT );
 		Ret_set.push_back( r );
 	}
 	
@@ -160,39 +198,52 @@ bool DBASE::db_range_open_set( PU_int* LB, PU_int *UB, int *set_id )
 		else
 			Ret_set[*set_id]->LB[i] = MINTOKEN;
 
-		if (UB[i] != _UNSPECIFIED_)
+		// only the low 'order' bits are seen by nextmatch_RQ so the upper
+		// bound is limited to the largest coordinate
+		if (UB[i] != _UNSPECIFIED_ && UB[i] < max_coord)
 			Ret_set[*set_id]->UB[i] = UB[i];
 		else
-			Ret_set[*set_id]->UB[i] = MAXTOKEN;
+			Ret_set[*set_id]->UB[i] = max_coord;
 
 		if (Ret_set[*set_id]->LB[i] == MINTOKEN &&
-			Ret_set[*set_id]->UB[i] == MAXTOKEN)
+			Ret_set[*set_id]->UB[i] == max_coord)
 			Ret_set[*set_id]->numspec--;
 	}
 	if (Ret_set[*set_id]->numspec == 0)
 	{
 		cout << "ERROR 1 in dbi_range_open_set(): not programmed to answer "
 		     << "unspecified queries\n";
-		delete [] minmatch;
-		delete [] key;
 		return false;
 	}
 
-	// find lowest match to query
-	memset( minmatch, 0, sizeof(PU_int) * dimensions );
-	memset( key, 0, sizeof(PU_int) * dimensions );
+	// find lowest match to query; the descent of the curve is kept in
+	// RQstate for db_range_fetch_another() to resume
+	memset( minmatch, 0, sizeof(HU_int) * key_words );
+	memset( key, 0, sizeof(HU_int) * key_words );
+
+	if (Ret_set[*set_id]->RQstate == NULL)
+		Ret_set[*set_id]->RQstate = new HRQ_STATE;
+	curve->nextmatch_RQ_start( *Ret_set[*set_id]->RQstate,
+			Ret_set[*set_id]->LB, Ret_set[*set_id]->UB, dimensions, order );
 
-     	if (false == H_nextmatch_RQ( Ret_set[*set_id]->LB,
-       			Ret_set[*set_id]->UB,
-       			minmatch, key, dimensions ))
+     	if (false == curve->nextmatch_RQ( *Ret_set[*set_id]->RQstate, minmatch, key ))
         {
 		errorexit("ERROR 2 in dbi_range_open_set(): lowest match not found\n");
 	}
 	
-	// find the page that may contain the minimum match       		
-	lpage = BT.idx_search( minmatch );
+	// find the first page, from the one that may contain the minimum match,
+	// whose MBR meets the range
+	lpage = db_range_find_page( *set_id, minmatch );
+	if (lpage < 0)
+	{
+		// no page can hold a match
+		FreeRet_setList.push( *set_id );
+		return false;
+	}
 
 	Ret_set[*set_id]->flags = ACTIVE | RANGE_QUERY;
+	Ret_set[*set_id]->misses = 0;
+	Ret_set[*set_id]->skip_after = SKIP_MIN;
 	// bring in the first page to search
 	Ret_set[*set_id]->buffslot = Buffer.b_page_retrieve( lpage );
 
@@ -203,8 +254,140 @@ bool DBASE::db_range_open_set( PU_int* LB, PU_int *UB, int *set_id )
 
 	Buffer.BSlot[Ret_set[*set_id]->buffslot]->query = true; // QUERY;
 
-	delete [] minmatch;
-	delete [] key;
+	return true;
+}
+
+/*============================================================================*/
+/***                   DBASE::db_ball_open_set				    ***/
+/*============================================================================*/
+//	FOR BALL (HYPERSPHERE) QUERIES
+// matches are the points no further than 'radius' from 'centre'. The pages
+// that may hold them are found by the curve's nextmatch_region(), with
+// H_classify_ball(), and are searched once each, in key order
+bool DBASE::db_ball_open_set( PU_int *centre, double radius, int *set_id )
+{
+	int	i;
+	int	lpage;
+	HU_int	minmatch[HKEY_MAX_WORDS], key[HKEY_MAX_WORDS];
+	H_BALL	ball;
+
+	if (radius < 0.0)
+		return false;
+
+	for (i = 0; i < dimensions; i++)
+		ball.centre[i] = centre[i];
+	ball.radius2 = radius * radius;
+
+	// find lowest match to query: there is none if the ball holds no point
+	// of the space
+	memset( key, 0, sizeof(HU_int) * key_words );
+	if (false == curve->nextmatch_region( H_classify_ball, &ball, minmatch, key,
+		dimensions, order, NULL ))
+		return false;
+
+	// find an inactive set...
+	if (FreeRet_setList.size() > 0)
+	{
+		*set_id = FreeRet_setList.top();
+		FreeRet_setList.pop();
+	}
+	else
+	// ...or create a new one
+	{
+		*set_id = Ret_set.size();
+		RET_SET *r = new RET_SET( dimensions, &BT );
+		Ret_set.push_back( r );
+	}
+
+	if (Ret_set[*set_id]->ball == NULL)
+		Ret_set[*set_id]->ball = new H_BALL;
+	*Ret_set[*set_id]->ball = ball;
+
+	// the bounding box of the ball, within the space
+	for (i = 0; i < dimensions; i++)
+	{
+		if ((double)centre[i] <= radius)
+			Ret_set[*set_id]->LB[i] = MINTOKEN;
+		else
+			Ret_set[*set_id]->LB[i] = centre[i] - (PU_int)radius;
+
+		if ((double)centre[i] + radius >= (double)max_coord)
+			Ret_set[*set_id]->UB[i] = max_coord;
+		else
+			Ret_set[*set_id]->UB[i] = centre[i] + (PU_int)radius;
+	}
+	Ret_set[*set_id]->numspec = dimensions;
+
+	// find the page that may contain the minimum match
+	lpage = Ret_set[*set_id]->cursor.cur_seek( minmatch );
+
+	Ret_set[*set_id]->flags = ACTIVE | BALL_QUERY;
+	// bring in the first page to search
+	Ret_set[*set_id]->buffslot = Buffer.b_page_retrieve( lpage );
+
+	i = Buffer.BSlot[Ret_set[*set_id]->buffslot]->BPage.p_find_pageslot( Ret_set[*set_id]->LB );
+	if (i < 0)
+		i = -i;
+	Ret_set[*set_id]->pos = i;
+
+	Buffer.BSlot[Ret_set[*set_id]->buffslot]->query = true; // QUERY;
+
+	return true;
+}
+
+/*============================================================================*/
+/***                   DBASE::db_region_open_set			    ***/
+/*============================================================================*/
+//	FOR QUERIES ON REGIONS OF ANY SHAPE
+// matches are the points within the region that 'classify' and 'region'
+// describe (see H_nextmatch_region()), eg an H_POLYTOPE classified by
+// H_classify_polytope(). The pages that may hold matches are searched once
+// each, in key order; the points of a page that lies wholly within a
+// sub-quadrant classified as H_INSIDE are returned without being tested
+bool DBASE::db_region_open_set( H_CLASSIFY classify, const void *region,
+	int *set_id )
+{
+	int	lpage;
+	HU_int	minmatch[HKEY_MAX_WORDS], key[HKEY_MAX_WORDS],
+		inside[2 * HKEY_MAX_WORDS];
+
+	// find lowest match to query
+	memset( key, 0, sizeof(HU_int) * key_words );
+	if (false == curve->nextmatch_region( classify, region, minmatch, key,
+		dimensions, order, inside ))
+		return false;
+
+	// find an inactive set...
+	if (FreeRet_setList.size() > 0)
+	{
+		*set_id = FreeRet_setList.top();
+		FreeRet_setList.pop();
+	}
+	else
+	// ...or create a new one
+	{
+		*set_id = Ret_set.size();
+		RET_SET *r = new RET_SET( dimensions, &BT );
+		Ret_set.push_back( r );
+	}
+
+	Ret_set[*set_id]->classify = classify;
+	Ret_set[*set_id]->region = region;
+	Ret_set[*set_id]->numspec = dimensions;
+
+	// find the page that may contain the minimum match
+	lpage = Ret_set[*set_id]->cursor.cur_seek( minmatch );
+
+	Ret_set[*set_id]->flags = ACTIVE | REGION_QUERY;
+	// bring in the first page to search
+	Ret_set[*set_id]->buffslot = Buffer.b_page_retrieve( lpage );
+	if (db_page_within( Ret_set[*set_id]->buffslot, inside, inside + key_words ))
+		Ret_set[*set_id]->flags |= PAGE_INSIDE;
+	// records are not in key order on a page, so all are searched
+	Ret_set[*set_id]->pos = 1;
+
+	Buffer.BSlot[Ret_set[*set_id]->buffslot]->query = true; // QUERY;
+
 	return true;
 }
 
@@ -216,8 +399,6 @@ bool DBASE::db_range_open_set( PU_int* LB, PU_int *UB, int *set_id )
 // of a RET_SET remaining constant while it is in use
 bool DBASE::db_close_set( int set_id )
 {
-	int i;
-
 	if (! (Ret_set[set_id]->flags & ACTIVE))
 	{
 		cerr << "ERROR - Ret_set " << set_id << " is inactive - unexpected\n";
@@ -226,33 +407,8 @@ bool DBASE::db_close_set( int set_id )
 
 	if (Ret_set.size() == FreeRet_setList.size())
 		errorexit( "ERROR in db_close_set - no active RET_SETs\n" );
-		
-	if (Ret_set.size() - FreeRet_setList.size() == 1)
-	{
-		// this is the only ACTIVE Ret_set
-		i = -1;
-	}
-	else
-	{
-	       	// check all of the Ret_sets to see if any is accessing the same
-       		// page that Ret_set[set_id] last accessed
-	       	// (could use an iterator here but this is simple)
-       		for (i = Ret_set.size() - 1; i >= 0; i--)
-		{
-			if (i == set_id || !(Ret_set[i]->flags & ACTIVE))
-				continue;
-			if (Ret_set[i]->buffslot == Ret_set[set_id]->buffslot)
-			// another RET_SET is accessing the same page as Ret_set[set_id]
-				break;
-		}
-	}
-	
-       	if (i < 0)
-       	{
-       		// no other Ret_set is using the page
-       		Buffer.BSlot[Ret_set[set_id]->buffslot]->fix =
-       		Buffer.BSlot[Ret_set[set_id]->buffslot]->query = false;
-       	}
+
+	dbi_release_page( set_id );
 
 	// free-up the RET_SET
 	Ret_set[set_id]->flags = 0;
@@ -265,6 +421,31 @@ bool DBASE::db_close_set( int set_id )
 	return true;
 }
 
+/*============================================================================*/
+/***                   DBASE::dbi_release_page				    ***/
+/*============================================================================*/
+// Ret_set[set_id] is done with the page it last accessed: the page's buffer
+// slot is no longer fixed or marked as being queried, unless another ACTIVE
+// Ret_set is accessing the same page
+void DBASE::dbi_release_page( int set_id )
+{
+	int	i;
+
+	// check all of the other Ret_sets, if there are any
+	// (could use an iterator here but this is simple)
+	if (Ret_set.size() - FreeRet_setList.size() > 1)
+		for (i = Ret_set.size() - 1; i >= 0; i--)
+		{
+			if (i == set_id || !(Ret_set[i]->flags & ACTIVE))
+				continue;
+			if (Ret_set[i]->buffslot == Ret_set[set_id]->buffslot)
+				return;	// another RET_SET is accessing the same page
+		}
+
+	Buffer.BSlot[Ret_set[set_id]->buffslot]->fix =
+	Buffer.BSlot[Ret_set[set_id]->buffslot]->query = false;
+}
+
 /*============================================================================*/
 /***                   DBASE::db_fetch_another				    ***/
 /*============================================================================*/
@@ -274,8 +455,8 @@ bool DBASE::db_close_set( int set_id )
 bool DBASE::db_fetch_another( int set_id, PU_int *retval )
 {
 	int	i, buffslot;
-	HU_int	*next_pagekey = new U_int[dimensions], // the key of the next page after the current one
-		*next_match = new U_int[dimensions];
+	HU_int	next_pagekey[HKEY_MAX_WORDS], // the key of the next page after the current one
+		next_match[HKEY_MAX_WORDS];
 	PU_int	*query = Ret_set[set_id]->LB,
 		*data;
 	int	lpage, pos, end;
@@ -291,7 +472,7 @@ bool DBASE::db_fetch_another( int set_id, PU_int *retval )
 
 		// while not at end of page (currently being searched)
 		// NB incrementing data moves it along one PU_int, not one record
-		for ( ;pos <= end; pos++, data+= (dimensions + NO_EXTRA_TOKENS) )
+		for ( ;pos <= end; pos++, data+= (record_words + NO_EXTRA_TOKENS) )
 		{
 			i = 0;
 
@@ -319,8 +500,6 @@ bool DBASE::db_fetch_another( int set_id, PU_int *retval )
 			{
 				keycopy( retval, data, dimensions );
 				Ret_set[set_id]->pos = pos + 1;
-				delete [] next_pagekey;
-				delete [] next_match;
 				return true;
 			}
 		}
@@ -329,8 +508,6 @@ bool DBASE::db_fetch_another( int set_id, PU_int *retval )
 		{
 			// query is fully specified - to get this far, either we've already
 			// found the (single) next_match or searched the page that might contain it
-			delete [] next_pagekey;
-			delete [] next_match;
 			return false;
 		}
 
@@ -338,58 +515,27 @@ bool DBASE::db_fetch_another( int set_id, PU_int *retval )
 		if (Buffer.BSlot[buffslot]->BPage.page_hdr->lpage == LastPage)
 		{
 			// there can be no higher match
-			delete [] next_pagekey;
-			delete [] next_match;
 			return false;
 		}
 
 		// find key of next page - there will be one
-		keycopy( next_pagekey,
-			 BT.idx_get_next_key(
-				Buffer.BSlot[buffslot]->BPage.index,
-				Buffer.BSlot[buffslot]->BPage.page_hdr->lpage ),
-			 dimensions );
+		keycopy( next_pagekey, Ret_set[set_id]->cursor.cur_next_key(),
+			 key_words );
 
 		// find next match above this key
-	 	memset( next_match, 0, sizeof(HU_int) * dimensions );
+	 	memset( next_match, 0, sizeof(HU_int) * key_words );
 		
-		if (false == H_nextmatch_PM( query, next_match, next_pagekey,
-					Qsaf, dimensions ))
+		if (false == curve->nextmatch_PM( query, next_match, next_pagekey,
+					Qsaf, dimensions, order ))
 		{
-			delete [] next_pagekey;
-			delete [] next_match;
 			return false; // no higher matching hilbert codes
 		}
 
-		// clear the current page's flags if not in use by another Ret_set
-        	if (Ret_set.size() - FreeRet_setList.size() == 1)
-        	{
-        		// this is the only ACTIVE Ret_set
-        		i = -1;
-        	}
-        	else
-        	{
-        	       	// check all of the Ret_sets to see if any is accessing the same
-               		// page that Ret_set[set_id] last accessed
-        	       	// (could use an iterator here but this is simple)
-               		for (i = Ret_set.size() - 1; i >= 0; i--)
-        		{
-        			if (i == set_id || !(Ret_set[i]->flags & ACTIVE))
-        				continue;
-        			if (Ret_set[i]->buffslot == Ret_set[set_id]->buffslot)
-        			// another RET_SET is accessing the same page as Ret_set[set_id]
-        				break;
-        		}
-        	}
-            	if (i < 0)
-          	{
-          		// no other Ret_set is using the page
-          		Buffer.BSlot[buffslot]->fix =
-          		Buffer.BSlot[buffslot]->query = false;
-          	}
+		// done with the current page, unless another Ret_set is using it
+		dbi_release_page( set_id );
 					
-		// find the page that may contain the match
-		lpage = BT.idx_search( next_match );
+		// find the page that may contain the match, from the current one
+		lpage = Ret_set[set_id]->cursor.cur_seek( next_match );
 		
 		Ret_set[set_id]->buffslot = Buffer.b_page_retrieve( lpage );
 		Buffer.BSlot[Ret_set[set_id]->buffslot]->query = true; // QUERY;
@@ -415,8 +561,8 @@ bool DBASE::db_range_fetch_another( int set_id, PU_int *retval )
 {
 	int	i, buffslot;
 	bool	maybe, no_more;
-	HU_int	*next_pagekey = new U_int[dimensions], // the key of the next page after the current one
-		*next_match = new U_int[dimensions];
+	HU_int	next_pagekey[HKEY_MAX_WORDS], // the key of the next page after the current one
+		next_match[HKEY_MAX_WORDS];
 	PU_int	*Lobound = Ret_set[set_id]->LB,
 		*Upbound = Ret_set[set_id]->UB,
 		*data;
@@ -429,8 +575,22 @@ bool DBASE::db_range_fetch_another( int set_id, PU_int *retval )
 		end = Buffer.BSlot[buffslot]->BPage.page_hdr->size;
 		data = Buffer.BSlot[buffslot]->BPage.data[pos];
 
+		if (columns)
+		{
+			if (!(Ret_set[set_id]->flags & PAGE_FILTERED))
+				db_range_filter_page( set_id );
+			pos = db_next_filtered( set_id, pos );
+			if (pos > 0) // next_match found
+			{
+				keycopy( retval, Buffer.BSlot[buffslot]->BPage.data[pos], dimensions);
+				Ret_set[set_id]->pos = pos + 1;
+
+				return true;
+			}
+		}
+		else
 		// (see note in db_fetch_another())
-		for ( ;pos <= end; pos++, data+= (dimensions + NO_EXTRA_TOKENS) )
+		for ( ;pos <= end; pos++, data+= (record_words + NO_EXTRA_TOKENS) )
 		{
 			for (maybe = no_more = false, i = 0; i < dimensions; i++)
 			{
@@ -449,73 +609,274 @@ bool DBASE::db_range_fetch_another( int set_id, PU_int *retval )
 			{
 				keycopy( retval, data, dimensions);
 				Ret_set[set_id]->pos = pos + 1;
+				Ret_set[set_id]->misses = 0;
 				
-				delete [] next_pagekey;
-				delete [] next_match;
 				return true;
 			}
 			if (no_more)
 				break;
+
+			// after a run of records that don't match, skip those that can't
+			if (++Ret_set[set_id]->misses >= Ret_set[set_id]->skip_after)
+			{
+				i = db_range_skip( set_id, data, pos );
+				if (i > end)
+					break;
+				pos = i - 1;
+				data = Buffer.BSlot[buffslot]->BPage.data[pos];
+			}
 		}
+		Ret_set[set_id]->misses = 0;
 		
 		// have we just searched the last page?		
 		if (Buffer.BSlot[buffslot]->BPage.page_hdr->lpage == LastPage)
 		{
 			// there can be no higher match
-			delete [] next_pagekey;
-			delete [] next_match;
 			return false;
 		}
 
 		// find key of next page - there will be one
-		keycopy( next_pagekey,
-			 BT.idx_get_next_key(
-				Buffer.BSlot[buffslot]->BPage.index,
-				Buffer.BSlot[buffslot]->BPage.page_hdr->lpage ),
-			 dimensions );
+		keycopy( next_pagekey, Ret_set[set_id]->cursor.cur_next_key(),
+			 key_words );
 			
 		// find next match above this next_pagekey, place result in next_match
-	 	memset( next_match, 0, sizeof(PU_int) * dimensions );
+	 	memset( next_match, 0, sizeof(HU_int) * key_words );
+
+		// (resuming the descent made for the previous page key)
+		if (false == curve->nextmatch_RQ( *Ret_set[set_id]->RQstate,
+			next_match, next_pagekey ))
+		{
+			return false; // no higher matching hilbert codes
+		}
+
+		// find the page that may contain the match, passing over those
+		// whose MBRs don't meet the range
+		lpage = db_range_find_page( set_id, next_match );
+		if (lpage < 0)
+			return false;
+		
+		// done with the current page, unless another Ret_set is using it
+		dbi_release_page( set_id );
+
+		Ret_set[set_id]->buffslot = Buffer.b_page_retrieve( lpage );
+		Buffer.BSlot[Ret_set[set_id]->buffslot]->query = true; // QUERY;
+
+		i = Buffer.BSlot[Ret_set[set_id]->buffslot]->BPage.p_find_pageslot( Ret_set[set_id]->LB );
+		if (i < 0)
+			i = -i;
+		Ret_set[set_id]->pos = i;
+		Ret_set[set_id]->flags &= ~PAGE_FILTERED;
+	}
+}
+
+/*============================================================================*/
+/***                   DBASE::db_range_find_page			    ***/
+/*============================================================================*/
+// finds the page that may contain 'match', a match to a range query; if the
+// page's MBR doesn't meet the range then the next match is found, from the
+// following page's key on, and so on. Returns the page's lpage, and 'match'
+// the match it may contain, or -1 if no page can hold a match
+int DBASE::db_range_find_page( int set_id, HU_int *match )
+{
+	int	lpage;
+	HU_int	*nextkey, pagekey[HKEY_MAX_WORDS];
+
+	for (;;)
+	{
+		lpage = Ret_set[set_id]->cursor.cur_seek( match );
+		if (dbi_mbr_meets( lpage, Ret_set[set_id]->LB, Ret_set[set_id]->UB ))
+			return lpage;
+
+		// the last page can't be followed by another
+		nextkey = Ret_set[set_id]->cursor.cur_next_key();
+		if (nextkey == NULL)
+			return -1;
+		keycopy( pagekey, nextkey, key_words );
+
+		memset( match, 0, sizeof(HU_int) * key_words );
+		if (false == curve->nextmatch_RQ( *Ret_set[set_id]->RQstate,
+			match, pagekey ))
+			return -1;
+	}
+}
+
+/*============================================================================*/
+/***                   DBASE::db_range_skip				    ***/
+/*============================================================================*/
+// a page's records are in order of their coordinates, the first the most
+// significant. Finds the lowest point within a range query's range that
+// follows 'record', in slot 'pos', which doesn't match, and returns the slot
+// of the first record from it on - or the slot after the last record.
+// If few records were skipped skips are made less often, and vice versa
+int DBASE::db_range_skip( int set_id, const PU_int *record, int pos )
+{
+	RET_SET	*R = Ret_set[set_id];
+	PAGE	&P = Buffer.BSlot[R->buffslot]->BPage;
+	PU_int	next[MAXDIMS];
+	int	i, j;
 
-		if (false == H_nextmatch_RQ( Ret_set[set_id]->LB,
-			Ret_set[set_id]->UB,
-			next_match, next_pagekey,
-			dimensions ))
+	// the first coordinate outside the range
+	for (j = 0; record[j] >= R->LB[j] && record[j] <= R->UB[j]; j++)
+		;
+	keycopy( next, record, dimensions );
+	if (record[j] > R->UB[j])
+	{
+		// increase the last coordinate before it that can be
+		for (i = j - 1; i >= 0 && record[i] == R->UB[i]; i--)
+			;
+		if (i < 0)
+			return P.page_hdr->size + 1;
+		next[i] = record[i] + 1;
+		j = i;
+	}
+	else
+		next[j] = R->LB[j];
+	for (i = j + 1; i < dimensions; i++)
+		next[i] = R->LB[i];
+
+	i = P.p_find_pageslot( next, pos + 1 );
+	if (i < 0)
+		i = -i;
+
+	if (i - pos - 1 < R->skip_after)
+		R->skip_after = R->skip_after * 2 < SKIP_MAX ? R->skip_after * 2 : SKIP_MAX;
+	else
+		R->skip_after = R->skip_after / 2 > SKIP_MIN ? R->skip_after / 2 : SKIP_MIN;
+	R->misses = 0;
+
+	return i;
+}
+
+/*============================================================================*/
+/***                   DBASE::db_range_filter_page			    ***/
+/*============================================================================*/
+// finds all of a range query's matches on the page being searched, from the
+// search position on, testing the page's records a column at a time
+void DBASE::db_range_filter_page( int set_id )
+{
+	RET_SET	*R = Ret_set[set_id];
+	BUFF_PAGE	*B = Buffer.BSlot[R->buffslot];
+	int	low = R->pos, high = B->BPage.page_hdr->size, mid;
+
+	// records are in order of their coordinates, so none beyond the last
+	// whose first coordinate is within the range can match
+	while (high >= low)
+	{
+		mid = (high + low) / 2;
+		if (B->BPage.data[mid][0] <= R->UB[0])
+			low = mid + 1;
+		else
+			high = mid - 1;
+	}
+	R->mfirst = R->pos;
+	R->mlast = high;
+	R->matches.resize( B->BPage.p_page_entries / WORDBITS + 1 );
+	COL_range_filter( B->bp_columns(), B->BPage.p_page_entries, dimensions,
+		R->mfirst, R->mlast, R->LB, R->UB, &R->matches[0] );
+	R->flags |= PAGE_FILTERED;
+}
+
+/*============================================================================*/
+/***                   DBASE::db_next_filtered				    ***/
+/*============================================================================*/
+// the slot of the first match found by db_range_filter_page() at or after
+// 'pos', or 0 if there is none
+int DBASE::db_next_filtered( int set_id, int pos )
+{
+	RET_SET	*R = Ret_set[set_id];
+	U_int	w;
+	int	k = pos - R->mfirst;
+
+	if (k < 0)
+		k = 0;
+	while (k <= R->mlast - R->mfirst)
+	{
+		w = R->matches[k / WORDBITS] >> (k % WORDBITS);
+		if (w != 0)
+		{
+#ifdef __GNUC__
+			k += __builtin_ctz( w );
+#else
+			for (; !(w & 1); w >>= 1)
+				k++;
+#endif
+			return R->mfirst + k;
+		}
+		k = (k / WORDBITS + 1) * WORDBITS;
+	}
+	return 0;
+}
+
+/*============================================================================*/
+/***                   DBASE::db_ball_fetch_another			    ***/
+/*============================================================================*/
+// memory must already have been allocated to retval
+bool DBASE::db_ball_fetch_another( int set_id, PU_int *retval )
+{
+	int	i, buffslot;
+	double	dist, x;
+	HU_int	next_pagekey[HKEY_MAX_WORDS], // the key of the next page after the current one
+		next_match[HKEY_MAX_WORDS];
+	PU_int	*centre = Ret_set[set_id]->ball->centre,
+		*Upbound = Ret_set[set_id]->UB,
+		*data;
+	double	radius2 = Ret_set[set_id]->ball->radius2;
+	int	lpage, pos, end;
+
+	for (;;)
+	{
+		buffslot = Ret_set[set_id]->buffslot;
+		pos = Ret_set[set_id]->pos;
+		end = Buffer.BSlot[buffslot]->BPage.page_hdr->size;
+		data = Buffer.BSlot[buffslot]->BPage.data[pos];
+
+		// (see note in db_fetch_another())
+		for ( ;pos <= end; pos++, data+= (record_words + NO_EXTRA_TOKENS) )
+		{
+			// records are in attribute order on a page: none beyond the
+			// ball's bounding box in the first dimension can match
+			if (data[0] > Upbound[0])
+				break;
+
+			for (dist = 0.0, i = 0; i < dimensions && dist <= radius2; i++)
+			{
+				x = (double)data[i] - centre[i];
+				dist += x * x;
+			}
+
+			if (dist <= radius2) // next_match found
+			{
+				keycopy( retval, data, dimensions);
+				Ret_set[set_id]->pos = pos + 1;
+				
+				return true;
+			}
+		}
+		
+		// have we just searched the last page?		
+		if (Buffer.BSlot[buffslot]->BPage.page_hdr->lpage == LastPage)
+		{
+			// there can be no higher match
+			return false;
+		}
+
+		// find key of next page - there will be one
+		keycopy( next_pagekey, Ret_set[set_id]->cursor.cur_next_key(),
+			 key_words );
+			
+		// find next match above this next_pagekey, place result in next_match
+		if (false == curve->nextmatch_region( H_classify_ball,
+			Ret_set[set_id]->ball, next_match, next_pagekey, dimensions, order,
+			NULL ))
 		{
-			delete [] next_pagekey;
-			delete [] next_match;
 			return false; // no higher matching hilbert codes
 		}
 		
-		// clear the current page's flags if not in use by another Ret_set
-        	if (Ret_set.size() - FreeRet_setList.size() == 1)
-        	{
-        		// this is the only ACTIVE Ret_set
-        		i = -1;
-        	}
-        	else
-        	{
-        	       	// check all of the Ret_sets to see if any is accessing the same
-               		// page that Ret_set[set_id] last accessed
-        	       	// (could use an iterator here but this is simple)
-               		for (i = Ret_set.size() - 1; i >= 0; i--)
-        		{
-        			if (i == set_id || !(Ret_set[i]->flags & ACTIVE))
-        				continue;
-        			if (Ret_set[i]->buffslot == Ret_set[set_id]->buffslot)
-        			// another RET_SET is accessing the same page as Ret_set[set_id]
-        				break;
-        		}
-        	}
-            	if (i < 0)
-          	{
-          		// no other Ret_set is using the page
-          		Buffer.BSlot[buffslot]->fix =
-          		Buffer.BSlot[buffslot]->query = false;
-          	}
+		// done with the current page, unless another Ret_set is using it
+		dbi_release_page( set_id );
 			
-		// find the page that may contain the match
-		lpage = BT.idx_search( next_match );
+		// find the page that may contain the match, from the current one
+		lpage = Ret_set[set_id]->cursor.cur_seek( next_match );
 
 		Ret_set[set_id]->buffslot = Buffer.b_page_retrieve( lpage );
 		Buffer.BSlot[Ret_set[set_id]->buffslot]->query = true; // QUERY;
@@ -527,3 +888,247 @@ bool DBASE::db_range_fetch_another( int set_id, PU_int *retval )
 	}
 }
 
+/*============================================================================*/
+/***                   DBASE::db_region_fetch_another			    ***/
+/*============================================================================*/
+// memory must already have been allocated to retval
+bool DBASE::db_region_fetch_another( int set_id, PU_int *retval )
+{
+	int	i, buffslot;
+	HU_int	next_pagekey[HKEY_MAX_WORDS], // the key of the next page after the current one
+		next_match[HKEY_MAX_WORDS],
+		inside[2 * HKEY_MAX_WORDS];
+	H_CLASSIFY	classify = Ret_set[set_id]->classify;
+	const void	*region = Ret_set[set_id]->region;
+	PU_int	*data;
+	int	lpage, pos, end;
+
+	for (;;)
+	{
+		buffslot = Ret_set[set_id]->buffslot;
+		pos = Ret_set[set_id]->pos;
+		end = Buffer.BSlot[buffslot]->BPage.page_hdr->size;
+		data = Buffer.BSlot[buffslot]->BPage.data[pos];
+
+		// (see note in db_fetch_another())
+		for ( ;pos <= end; pos++, data+= (record_words + NO_EXTRA_TOKENS) )
+		{
+			// a point is a box with no extent
+			if (Ret_set[set_id]->flags & PAGE_INSIDE
+				|| classify( data, data, dimensions, region ) != H_OUTSIDE)
+			{
+				keycopy( retval, data, dimensions);
+				Ret_set[set_id]->pos = pos + 1;
+				
+				return true;
+			}
+		}
+		
+		// have we just searched the last page?		
+		if (Buffer.BSlot[buffslot]->BPage.page_hdr->lpage == LastPage)
+		{
+			// there can be no higher match
+			return false;
+		}
+
+		// find key of next page - there will be one
+		keycopy( next_pagekey, Ret_set[set_id]->cursor.cur_next_key(),
+			 key_words );
+			
+		// find next match above this next_pagekey, place result in next_match
+		if (false == curve->nextmatch_region( classify, region, next_match,
+			next_pagekey, dimensions, order, inside ))
+		{
+			return false; // no higher matching hilbert codes
+		}
+		
+		// done with the current page, unless another Ret_set is using it
+		dbi_release_page( set_id );
+			
+		// find the page that may contain the match, from the current one
+		lpage = Ret_set[set_id]->cursor.cur_seek( next_match );
+
+		Ret_set[set_id]->buffslot = Buffer.b_page_retrieve( lpage );
+		Buffer.BSlot[Ret_set[set_id]->buffslot]->query = true; // QUERY;
+
+		Ret_set[set_id]->flags &= ~PAGE_INSIDE;
+		if (db_page_within( Ret_set[set_id]->buffslot, inside, inside + key_words ))
+			Ret_set[set_id]->flags |= PAGE_INSIDE;
+		Ret_set[set_id]->pos = 1;
+	}
+}
+
+/*============================================================================*/
+/***                   DBASE::db_knn					    ***/
+/*============================================================================*/
+//	FOR K-NEAREST-NEIGHBOUR QUERIES
+// Places the (up to) k stored points nearest to 'point' in 'results' (which
+// must have room for k * dimensions PU_ints), nearest first, and their
+// distances in 'dists' if it isn't NULL; returns the no. of points found.
+// Sub-quadrants of the curve and pages are visited nearest first, from a queue
+// ordered by the least distance of any of their points. A sub-quadrant whose
+// codes all map to the same page is replaced in the queue by that page, if it
+// hasn't already been searched; otherwise it is split. The search stops when
+// k points have been found that are no further than the nearest thing left
+// in the queue.
+int DBASE::db_knn( PU_int *point, int k, PU_int *results, double *dists )
+{
+	// queue entries: >= 0 is an index into 'quads', < 0 is -(lpage + 1)
+	typedef pair<double, int>	KNN_ENTRY;
+
+	priority_queue<KNN_ENTRY, vector<KNN_ENTRY>, greater<KNN_ENTRY> >	queue;
+	priority_queue<KNN_ENTRY>	best;	// found so far, furthest at the top
+	vector<H_QUADRANT>	quads;
+	vector<PU_int>		found;			// points of 'best', by index
+	vector<bool>		searched( nextPID, false );	// by logical page no.
+	HU_int		first[HKEY_MAX_WORDS], last[HKEY_MAX_WORDS];
+	H_QUADRANT	Q, lower, upper;
+	PU_int		*data;
+	double		dist, d;
+	int		i, j, n, buffslot, lpage, end;
+
+	if (k <= 0)
+		return 0;
+
+	H_quadrant_root( Q, dimensions, order );
+	quads.push_back( Q );
+	queue.push( KNN_ENTRY( 0.0, 0 ) );
+
+	while (! queue.empty())
+	{
+		KNN_ENTRY	top = queue.top();
+
+		if ((int)best.size() == k && top.first >= best.top().first)
+			break;
+		queue.pop();
+
+		if (top.second < 0)
+		{
+			// search a page
+			lpage = -(top.second + 1);
+			if (searched[lpage])
+				continue;
+			searched[lpage] = true;
+
+			buffslot = Buffer.b_page_retrieve( lpage );
+			if (lpage != Buffer.BSlot[buffslot]->BPage.page_hdr->lpage)
+				errorexit("ERROR 1 in db_knn(): index inconsistent\n");
+			end = Buffer.BSlot[buffslot]->BPage.page_hdr->size;
+			// records occupy slots 1 to 'end'
+			for (i = 1; i <= end; i++)
+			{
+				data = Buffer.BSlot[buffslot]->BPage.data[i];
+				for (dist = 0.0, j = 0; j < dimensions; j++)
+				{
+					d = (double)data[j] - point[j];
+					dist += d * d;
+				}
+				if ((int)best.size() < k)
+				{
+					n = best.size();
+					found.insert( found.end(), data, data + dimensions );
+				}
+				else if (dist < best.top().first)
+				{
+					// re-use the slot of the furthest
+					n = best.top().second;
+					best.pop();
+					memcpy( &found[n * dimensions], data,
+						sizeof(PU_int) * dimensions );
+				}
+				else
+					continue;
+				best.push( KNN_ENTRY( dist, n ) );
+			}
+			Buffer.BSlot[buffslot]->fix = Buffer.BSlot[buffslot]->query; // finished with it
+			continue;
+		}
+
+		// a sub-quadrant: the pages that its lowest and highest codes map to
+		Q = quads[top.second];
+		H_quadrant_codes( Q, first, last, dimensions, order );
+		lpage = BT.idx_search( first );
+		if (lpage == BT.idx_search( last ))
+		{
+			if (! searched[lpage])
+				queue.push( KNN_ENTRY( top.first, -(lpage + 1) ) );
+			continue;
+		}
+
+		// split it, re-using its entry in 'quads' for its lower half
+		curve->quadrant_split( Q, &lower, &upper, dimensions, order );
+		quads[top.second] = lower;
+		queue.push( KNN_ENTRY( db_box_dist( point, lower.lo, lower.hi ),
+			top.second ) );
+		quads.push_back( upper );
+		queue.push( KNN_ENTRY( db_box_dist( point, upper.lo, upper.hi ),
+			quads.size() - 1 ) );
+	}
+
+	// empty 'best', furthest first
+	n = best.size();
+	for (i = n - 1; i >= 0; i--)
+	{
+		memcpy( &results[i * dimensions], &found[best.top().second * dimensions],
+			sizeof(PU_int) * dimensions );
+		if (dists != NULL)
+			dists[i] = sqrt( best.top().first );
+		best.pop();
+	}
+	return n;
+}
+
+/*============================================================================*/
+/***                   DBASE::db_box_dist				    ***/
+/*============================================================================*/
+// the square of the least distance from 'point' to any point of the box
+// (lo, hi)
+double DBASE::db_box_dist( const PU_int *point, const PU_int *lo,
+	const PU_int *hi )
+{
+	double	dist = 0.0, d;
+
+	for (int i = 0; i < dimensions; i++)
+	{
+		if (point[i] < lo[i])
+			d = (double)lo[i] - point[i];
+		else if (point[i] > hi[i])
+			d = (double)point[i] - hi[i];
+		else
+			continue;
+		dist += d * d;
+	}
+	return dist;
+}
+
+/*============================================================================*/
+/***                   DBASE::db_page_within				    ***/
+/*============================================================================*/
+// whether all of the codes that map to the page in 'buffslot' lie in the
+// interval [first, last]
+bool DBASE::db_page_within( int buffslot, const HU_int *first,
+	const HU_int *last )
+{
+	HU_int	top[HKEY_MAX_WORDS];	// the page's highest code
+	int	i, lpage = Buffer.BSlot[buffslot]->BPage.page_hdr->lpage;
+
+	if (keycmp( first, Buffer.BSlot[buffslot]->BPage.index, key_words ) > 0)
+		return false;
+
+	if (lpage == LastPage)
+	{
+		// the highest code of all
+		memset( top, 0xff, sizeof(HU_int) * key_words );
+		if ((i = dimensions * order % WORDBITS) != 0)
+			top[key_words - 1] = ((U_int)1 << i) - 1;
+	}
+	else
+	{
+		// one less than the next page's key
+		keycopy( top, BT.idx_get_next_key( Buffer.BSlot[buffslot]->BPage.index,
+			lpage ), key_words );
+		for (i = 0; i < key_words && top[i]-- == 0; i++)
+			;
+	}
+	return keycmp( top, last, key_words ) <= 0;
+}
@@ -21,27 +21,56 @@ typedef unsigned int	U_int;
 #define HU_int			U_int	// a HU_int* is a hilbert code
 #define PU_int			U_int	// a PU_int* is a 'point' (array of coordinates)
 
-/*============================================================================*/
-/*                            Hcode	                          	      */
-/*============================================================================*/
-class Hcode{
-public:
-	Hcode( int dims );
-	~Hcode() { hcode.erase( hcode.begin(), hcode.end() ); }; // not needed?
-
-	vector<U_int> hcode;
-};
-
 /*============================================================================*/
 /*                            #defines	                          	      */
 /*============================================================================*/
 
 #define		WORDBITS		32
-#define		NUMBITS			32
+#define		NUMBITS			32	// the maximum (and default) order of the curve
+
+// the no. of U_ints in the hilbert code of a point in 'dims' dimensions on a
+// curve of order 'order', ie with 'order' bits per coordinate
+#define		HKEY_WORDS( dims, order )	(((dims) * (order) + WORDBITS - 1) / WORDBITS)
+
+// dimensions are represented by the bits of a U_int in partial match queries
+// (Qsaf), so no more than WORDBITS of them are supported
+#define		MAXDIMS			WORDBITS
+#define		HKEY_MAX_WORDS		HKEY_WORDS( MAXDIMS, NUMBITS )
+
 #ifndef NO_EXTRA_TOKENS
 	#define NO_EXTRA_TOKENS		0
 #endif
 	
+/*============================================================================*/
+/*                            Hcode	                          	      */
+/*============================================================================*/
+// a hilbert code held in place, least significant U_int first; only the first
+// 'words' of hcode are used. Holding the U_ints inline rather than on the heap
+// means that Hcodes may be created, copied and returned (eg when finding the
+// median of a page) without any memory allocation
+class Hcode{
+public:
+	Hcode( int kwords );
+	Hcode( const Hcode& h ) : words( h.words )
+		{ memcpy( hcode, h.hcode, words * sizeof(U_int) ); }
+	Hcode& operator=( const Hcode& h )
+		{ words = h.words; memcpy( hcode, h.hcode, words * sizeof(U_int) );
+		  return *this; }
+
+	// returns -1, 0 or 1 as this hcode is <, == or > h
+	int compare( const Hcode& h ) const
+	{
+		for ( int i = words - 1; i >= 0; i-- )
+			if ( hcode[i] != h.hcode[i] )
+				return hcode[i] < h.hcode[i] ? -1 : 1;
+		return 0;
+	}
+	bool operator<( const Hcode& h ) const { return compare( h ) < 0; }
+
+	int		words;	// no. of U_ints in use
+	U_int	hcode[HKEY_MAX_WORDS];
+};
+
 // #define JKLDEBUG
 
 #endif // _GENDEFS_H
@@ -0,0 +1,52 @@
+// hilbert/curve.cc
+
+/*----------------------------------------------------------------------------*/
+/*	THIS FILE SELECTS THE SPACE-FILLING CURVE THAT A DATABASE USES	      */
+/*----------------------------------------------------------------------------*/
+
+#ifdef __MSDOS__
+	#include "..\gendefs.h"
+#else
+	#include "../gendefs.h"
+#endif
+#include "curve.h"
+#include "morton.h"
+
+using namespace std;
+
+// indexed by curve number
+static const SF_CURVE	SF_curves[NUM_CURVES] = {
+	{
+		"hilbert",
+		ENCODE, DECODE, ENCODE_batch,
+		H_nextmatch_PM, H_nextmatch_RQ_start, H_nextmatch_RQ,
+		H_nextmatch_region, H_quadrant_split
+	},
+	{
+		"morton",
+		M_ENCODE, M_DECODE, M_ENCODE_batch,
+		M_nextmatch_PM, M_nextmatch_RQ_start, M_nextmatch_RQ,
+		M_nextmatch_region, M_quadrant_split
+	}
+};
+
+/*============================================================================*/
+/*                            SF_curve					      */
+/*============================================================================*/
+const SF_CURVE* SF_curve( int curve )
+{
+	if (curve < 0 || curve >= NUM_CURVES)
+		return NULL;
+	return &SF_curves[curve];
+}
+
+/*============================================================================*/
+/*                            SF_curve_number				      */
+/*============================================================================*/
+int SF_curve_number( string name )
+{
+	for (int i = 0; i < NUM_CURVES; i++)
+		if (name == SF_curves[i].name)
+			return i;
+	return -1;
+}
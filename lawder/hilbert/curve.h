@@ -0,0 +1,33 @@
+// hilbert/curve.h
+
+#ifndef _CURVE_H
+#define _CURVE_H
+
+#include "hilbert.h"
+
+// the space-filling curves that a database may be built on: the value is
+// recorded in the .inf file
+#define		CURVE_HILBERT		0
+#define		CURVE_MORTON		1
+#define		NUM_CURVES		2
+
+// the functions of a curve; those of the hilbert curve are in hilbert.h, and
+// the others match them
+typedef struct SF_CURVE {
+	const char	*name;
+	HU_int*	(*encode)( HU_int*, const PU_int* const, int, int );
+	PU_int*	(*decode)( PU_int*, HU_int*, int, int );
+	void	(*encode_batch)( const PU_int*, size_t, HU_int*, int, int );
+	bool	(*nextmatch_PM)( PU_int*, HU_int*, HU_int*, U_int, int, int );
+	void	(*nextmatch_RQ_start)( HRQ_STATE&, const PU_int*, const PU_int*, int, int );
+	bool	(*nextmatch_RQ)( HRQ_STATE&, HU_int*, HU_int* );
+	bool	(*nextmatch_region)( H_CLASSIFY, const void*, HU_int*, const HU_int*, int, int, HU_int* );
+	bool	(*quadrant_split)( const H_QUADRANT&, H_QUADRANT*, H_QUADRANT*, int, int );
+} SF_CURVE;
+
+// the curve of the given number (eg CURVE_HILBERT), or NULL if there is none
+const SF_CURVE* SF_curve( int curve );
+// the number of the curve of the given name, or -1 if there is none
+int SF_curve_number( string name );
+
+#endif
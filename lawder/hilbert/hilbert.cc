@@ -4,6 +4,7 @@
 /*	THIS FILE CONTAINS CODE FOR THE HILBERT CURVE WHICH		      */
 /*                            						      */
 /*	USES BUTZ' CALCULATED MAPPING METHOD				      */
+/*	(TABLE DRIVEN FOR 2 - 8 DIMENSIONS)				      */
 /*                            						      */
 /*	ie MAPPING == BUTZ		 				      */
 /*----------------------------------------------------------------------------*/
@@ -11,6 +12,7 @@
 //#include <stdio.h>
 //#include <stdlib.h>
 //#include <math.h>
+#include <type_traits>	// conditional
 
 #ifdef __MSDOS__
 	#include "..\gendefs.h"
@@ -19,6 +21,7 @@
 	#include "../gendefs.h"
 	#include "../utils/utils.h"
 #endif
+#include "hilbert.h"
 
 using namespace std;
 
@@ -38,20 +41,23 @@ using namespace std;
 /*============================================================================*/
 
 /*============================================================================*/
-/*                            ENCODE					      */
+/*                            ENCODE_BUTZ				      */
 /*============================================================================*/
 // point is the point to be encoded, hcode receives the hilbert code of point.
 // hcode is returned.
 // point and hcode must have storage allocated to them before this function
 // is called.
-HU_int* ENCODE( HU_int* hcode, const PU_int* const point, int DIMS )
+// This is the calculated mapping; ENCODE uses it directly for numbers of
+// dimensions that have no state table (see below).
+// Only the low 'order' bits of each coordinate are mapped.
+HU_int* ENCODE_BUTZ( HU_int* hcode, const PU_int* const point, int DIMS, int order )
 {
-	U_int	mask = (U_int)1 << WORDBITS - 1, element, temp1, temp2,
+	U_int	mask = (U_int)1 << (order - 1), element, temp1, temp2,
 		A, W = 0, S, tS, T, tT, J, P = 0, xJ;
-	int	i = NUMBITS * DIMS - DIMS, j;
+	int	i = order * DIMS - DIMS, j;
 	
 	// initialise hcode
-	memset( hcode, 0, sizeof(U_int) * DIMS );
+	memset( hcode, 0, sizeof(U_int) * HKEY_WORDS( DIMS, order ) );
 
 	for (j = A = 0; j < DIMS; j++)
 		if (point[j] & mask)
@@ -178,13 +184,14 @@ for (i=0; i < DIMS; i++)
 }
 
 /*============================================================================*/
-/*                            DECODE					      */
+/*                            DECODE_BUTZ				      */
 /*============================================================================*/
-PU_int* DECODE ( PU_int* point, HU_int* hcode, int DIMS )
+// NB the bits of the point are OR-ed into 'point' which must be zeroed first
+PU_int* DECODE_BUTZ ( PU_int* point, HU_int* hcode, int DIMS, int order )
 {
-	U_int	mask = (U_int)1 << WORDBITS - 1, element, temp1, temp2,
+	U_int	mask = (U_int)1 << (order - 1), element, temp1, temp2,
 		A, W = 0, S, tS, T, tT, J, P = 0, xJ;
-	int	i = NUMBITS * DIMS - DIMS, j;
+	int	i = order * DIMS - DIMS, j;
 
 
 	/*--- P ---*/
@@ -233,8 +240,8 @@ PU_int* DECODE ( PU_int* point, HU_int* hcode, int DIMS )
 	tT = T;
 
 	/*--- distrib bits to coords ---*/
-	for (j = DIMS - 1; P > 0; P >>=1, j--)
-		if (P & 1)
+	for (j = DIMS - 1; A > 0; A >>=1, j--)
+		if (A & 1)
 			point[j] |= mask;
 
 
@@ -320,6 +327,332 @@ PU_int* DECODE ( PU_int* point, HU_int* hcode, int DIMS )
 	return point;
 }
 
+/*============================================================================*/
+/*                            						      */
+/*                            STATE TABLE MAPPING			      */
+/*                            						      */
+/*============================================================================*/
+/* From one level of the curve to the next, Butz' algorithm only carries
+   forward the mask that is xor-ed with the next n-point (W ^ tT) and the
+   amount of rotation (xJ % DIMS). Together these make up a 'state' of which
+   there are DIMS * 2^DIMS. For small numbers of dimensions the transition
+   from every state for every n-point is calculated once, on first use, and
+   held in a table so that mapping one level costs one lookup. The codes
+   produced are exactly those of ENCODE_BUTZ/DECODE_BUTZ.
+
+   A state is numbered (rotation << DIMS) | mask. Each table entry holds
+   (next state << DIMS) | n-point, where the n-point is the derived key P
+   for the encode table and the coordinate bits A for the decode table. */
+
+/*============================================================================*/
+/*                            HB_transition				      */
+/*============================================================================*/
+// given the derived key P of a level entered in state (rotation, mask),
+// returns the state for the next level. Same arithmetic as ENCODE_BUTZ.
+static U_int HB_transition( U_int P, U_int rotation, U_int mask, int DIMS )
+{
+	U_int	T, tT, J;
+	int	j;
+
+	if (P < 3)
+		T = 0;
+	else
+		if (P % 2)
+			T = (P - 1) ^ (P - 1) / 2;
+		else
+			T = (P - 2) ^ (P - 2) / 2;
+
+	if (rotation != 0)
+	{
+		tT = (T >> rotation) | (T << (DIMS - rotation));
+		tT &= ((U_int)1 << DIMS) - 1;
+	}
+	else
+		tT = T;
+
+	J = DIMS;
+	for (j = 1; j < DIMS; j++)
+		if ((P >> j & 1) != (P & 1))
+			break;
+	if (j != DIMS)
+		J -= j;
+
+	rotation = (rotation + J - 1) % DIMS;
+	return rotation << DIMS | (mask ^ tT);
+}
+
+/*============================================================================*/
+/*                            HB_TABLE					      */
+/*============================================================================*/
+template <int DIMS> class HB_TABLE{
+public:
+	// 16 bit entries are enough up to 6 dimensions (9 bits of state)
+	typedef typename conditional<(DIMS <= 6), u2BYTES, U_int>::type entry_t;
+	enum { POINTS = 1 << DIMS, STATES = POINTS * DIMS };
+
+	static const HB_TABLE& get()
+	{
+		static HB_TABLE *table = new HB_TABLE;
+		return *table;
+	}
+
+	entry_t	encode[STATES * POINTS];	// indexed by (state << DIMS) | A
+	entry_t	decode[STATES * POINTS];	// indexed by (state << DIMS) | P
+
+private:
+	HB_TABLE();
+};
+
+template <int DIMS> HB_TABLE<DIMS>::HB_TABLE()
+{
+	U_int	state, rotation, mask, A, S, tS, P;
+	int	j;
+
+	for (state = 0; state < STATES; state++)
+	{
+		rotation = state >> DIMS;
+		mask = state & (POINTS - 1);
+
+		for (A = 0; A < POINTS; A++)
+		{
+			tS = A ^ mask;
+			if (rotation != 0)
+			{
+				S = (tS << rotation) | (tS >> (DIMS - rotation));
+				S &= POINTS - 1;
+			}
+			else
+				S = tS;
+
+			P = S & (1 << (DIMS-1));
+			for (j = 1; j < DIMS; j++)
+				if( (S & (1 << (DIMS-1-j))) ^ ((P >> 1) & (1 << (DIMS-1-j))))
+					P |= (1 << (DIMS-1-j));
+
+			encode[state << DIMS | A] =
+			    HB_transition( P, rotation, mask, DIMS ) << DIMS | P;
+			decode[state << DIMS | P] =
+			    HB_transition( P, rotation, mask, DIMS ) << DIMS | A;
+		}
+	}
+}
+
+/*============================================================================*/
+/*                            HB_encode_table				      */
+/*============================================================================*/
+template <int DIMS>
+static HU_int* HB_encode_table( HU_int* hcode, const PU_int* const point, int order )
+{
+	const typename HB_TABLE<DIMS>::entry_t	*table = HB_TABLE<DIMS>::get().encode;
+	U_int	state = 0, A, P, element;
+	int	i, j, k;
+
+	// initialise hcode
+	memset( hcode, 0, sizeof(U_int) * HKEY_WORDS( DIMS, order ) );
+
+	for (k = order - 1, i = k * DIMS; k >= 0; k--, i -= DIMS)
+	{
+		for (j = A = 0; j < DIMS; j++)
+			A |= (point[j] >> k & 1) << (DIMS-1-j);
+
+		P = table[state << DIMS | A];
+		state = P >> DIMS;
+		P &= (1 << DIMS) - 1;
+
+		/* add in DIMS bits to hcode */
+		element = i / WORDBITS;
+		hcode[element] |= P << i % WORDBITS;
+		if (i % WORDBITS > WORDBITS - DIMS)
+			hcode[element + 1] |= P >> (WORDBITS - i % WORDBITS);
+	}
+	return hcode;
+}
+
+/*============================================================================*/
+/*                            HB_decode_table				      */
+/*============================================================================*/
+template <int DIMS>
+static PU_int* HB_decode_table( PU_int* point, HU_int* hcode, int order )
+{
+	const typename HB_TABLE<DIMS>::entry_t	*table = HB_TABLE<DIMS>::get().decode;
+	U_int	state = 0, A, P, element;
+	int	i, j, k;
+
+	for (k = order - 1, i = k * DIMS; k >= 0; k--, i -= DIMS)
+	{
+		element = i / WORDBITS;
+		P = hcode[element] >> i % WORDBITS;
+		if (i % WORDBITS > WORDBITS - DIMS)
+			P |= hcode[element + 1] << (WORDBITS - i % WORDBITS);
+		P &= (1 << DIMS) - 1;
+
+		A = table[state << DIMS | P];
+		state = A >> DIMS;
+
+		/*--- distrib bits to coords ---*/
+		for (j = 0; j < DIMS; j++)
+			point[j] |= (A >> (DIMS-1-j) & 1) << k;
+	}
+	return point;
+}
+
+/*============================================================================*/
+/*                            ENCODE					      */
+/*============================================================================*/
+// point is the point to be encoded, hcode receives the hilbert code of point.
+// hcode is returned.
+// point and hcode must have storage allocated to them before this function
+// is called. Only the low 'order' bits of each coordinate are mapped.
+HU_int* ENCODE( HU_int* hcode, const PU_int* const point, int DIMS, int order )
+{
+	switch (DIMS)
+	{
+		case 2:	return HB_encode_table<2>( hcode, point, order );
+		case 3:	return HB_encode_table<3>( hcode, point, order );
+		case 4:	return HB_encode_table<4>( hcode, point, order );
+		case 5:	return HB_encode_table<5>( hcode, point, order );
+		case 6:	return HB_encode_table<6>( hcode, point, order );
+		case 7:	return HB_encode_table<7>( hcode, point, order );
+		case 8:	return HB_encode_table<8>( hcode, point, order );
+		default:return ENCODE_BUTZ( hcode, point, DIMS, order );
+	}
+}
+
+/*============================================================================*/
+/*                            DECODE					      */
+/*============================================================================*/
+// NB the bits of the point are OR-ed into 'point' which must be zeroed first
+PU_int* DECODE ( PU_int* point, HU_int* hcode, int DIMS, int order )
+{
+	switch (DIMS)
+	{
+		case 2:	return HB_decode_table<2>( point, hcode, order );
+		case 3:	return HB_decode_table<3>( point, hcode, order );
+		case 4:	return HB_decode_table<4>( point, hcode, order );
+		case 5:	return HB_decode_table<5>( point, hcode, order );
+		case 6:	return HB_decode_table<6>( point, hcode, order );
+		case 7:	return HB_decode_table<7>( point, hcode, order );
+		case 8:	return HB_decode_table<8>( point, hcode, order );
+		default:return DECODE_BUTZ( point, hcode, DIMS, order );
+	}
+}
+
+/*============================================================================*/
+/*                            						      */
+/*                            BATCH ENCODING				      */
+/*                            						      */
+/*============================================================================*/
+/* Where the processor supports AVX2, 8 points are encoded together, one per
+   32 bit lane: the state table is consulted with a gather instruction and
+   each word of the 8 hilbert codes is accumulated in a vector register. The
+   AVX2 code is compiled for that instruction set regardless of the compiler
+   flags and only called when the CPU is found to support it at run time. */
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+	#define HB_AVX2
+	#include <immintrin.h>
+#endif
+
+#ifdef HB_AVX2
+/*============================================================================*/
+/*                            HB_encode_batch_avx2			      */
+/*============================================================================*/
+template <int DIMS> __attribute__((target("avx2")))
+static void HB_encode_batch_avx2( const PU_int* points, size_t n, HU_int* out,
+				int order )
+{
+	typedef typename HB_TABLE<DIMS>::entry_t	entry_t;
+	const entry_t	*table = HB_TABLE<DIMS>::get().encode;
+	const __m256i	lanes = _mm256_setr_epi32( 0, DIMS, 2 * DIMS, 3 * DIMS,
+				4 * DIMS, 5 * DIMS, 6 * DIMS, 7 * DIMS ),
+			Pmask = _mm256_set1_epi32( (1 << DIMS) - 1 ),
+			entry_mask = _mm256_set1_epi32( sizeof(entry_t) == 2 ? 0xffff : ~0 );
+	const __m128i	unmapped = _mm_cvtsi32_si128( WORDBITS - order );
+	const int	words = HKEY_WORDS( DIMS, order );
+	__m256i		coord[DIMS], hcode[DIMS], state, A, P;
+	U_int		lane_out[DIMS][8];
+	size_t		p;
+	int		i, j, k, l, element;
+
+	for (p = 0; p + 8 <= n; p += 8, points += 8 * DIMS, out += 8 * words)
+	{
+		for (j = 0; j < DIMS; j++)
+		{
+			// bit order - 1 is moved to the top of each lane
+			coord[j] = _mm256_sll_epi32( _mm256_i32gather_epi32(
+				(const int*)points + j, lanes, 4 ), unmapped );
+			hcode[j] = _mm256_setzero_si256();
+		}
+		state = _mm256_setzero_si256();
+
+		for (k = order - 1, i = k * DIMS; k >= 0; k--, i -= DIMS)
+		{
+			// bit k of each coordinate, first coordinate most significant
+			for (j = 0, A = _mm256_setzero_si256(); j < DIMS; j++)
+			{
+				A = _mm256_or_si256( _mm256_slli_epi32( A, 1 ),
+					_mm256_srli_epi32( coord[j], WORDBITS - 1 ) );
+				coord[j] = _mm256_slli_epi32( coord[j], 1 );
+			}
+
+			// 16 bit entries are gathered as 32 bits and masked; the table
+			// is followed by the decode table so this stays in bounds
+			P = _mm256_i32gather_epi32( (const int*)table,
+				_mm256_or_si256( _mm256_slli_epi32( state, DIMS ), A ),
+				sizeof(entry_t) );
+			P = _mm256_and_si256( P, entry_mask );
+			state = _mm256_srli_epi32( P, DIMS );
+			P = _mm256_and_si256( P, Pmask );
+
+			/* add in DIMS bits to hcode */
+			element = i / WORDBITS;
+			hcode[element] = _mm256_or_si256( hcode[element],
+				_mm256_sll_epi32( P, _mm_cvtsi32_si128( i % WORDBITS ) ) );
+			if (i % WORDBITS > WORDBITS - DIMS)
+				hcode[element + 1] = _mm256_or_si256( hcode[element + 1],
+					_mm256_srl_epi32( P, _mm_cvtsi32_si128( WORDBITS - i % WORDBITS ) ) );
+		}
+
+		for (j = 0; j < words; j++)
+			_mm256_storeu_si256( (__m256i*)lane_out[j], hcode[j] );
+		for (l = 0; l < 8; l++)
+			for (j = 0; j < words; j++)
+				out[l * words + j] = lane_out[j][l];
+	}
+
+	// the remaining (fewer than 8) points
+	for (; p < n; p++, points += DIMS, out += words)
+		HB_encode_table<DIMS>( out, points, order );
+}
+#endif
+
+/*============================================================================*/
+/*                            ENCODE_batch				      */
+/*============================================================================*/
+// encodes n points held contiguously in 'points' (DIMS coordinates each),
+// placing their hilbert codes contiguously in 'out'
+// (HKEY_WORDS( DIMS, order ) words each)
+void ENCODE_batch( const PU_int* points, size_t n, HU_int* out, int DIMS, int order )
+{
+#ifdef HB_AVX2
+	static const bool avx2 = __builtin_cpu_supports( "avx2" );
+
+	if (avx2)
+		switch (DIMS)
+		{
+			case 2:	HB_encode_batch_avx2<2>( points, n, out, order ); return;
+			case 3:	HB_encode_batch_avx2<3>( points, n, out, order ); return;
+			case 4:	HB_encode_batch_avx2<4>( points, n, out, order ); return;
+			case 5:	HB_encode_batch_avx2<5>( points, n, out, order ); return;
+			case 6:	HB_encode_batch_avx2<6>( points, n, out, order ); return;
+			case 7:	HB_encode_batch_avx2<7>( points, n, out, order ); return;
+			case 8:	HB_encode_batch_avx2<8>( points, n, out, order ); return;
+		}
+#endif
+	for (size_t p = 0; p < n; p++, points += DIMS, out += HKEY_WORDS( DIMS, order ))
+		ENCODE( out, points, DIMS, order );
+}
+
 /*============================================================================*/
 /*                            						      */
 /*                            PARTIAL MATCH QUERY FUNCTIONS		      */
@@ -414,7 +747,7 @@ static bool HB_matches_PMQ( U_int P, U_int Qsaf, U_int Qp,
 static bool HB_nextmatch_PM ( PU_int *query, HU_int *match, HU_int *key,
 			U_int Qsaf, int counter, U_int xJ, U_int tT, U_int W, int DIMS )
 {
-	U_int	mask = 1 << counter / DIMS, Qp, H, element, temp,
+	U_int	mask, Qp, H, element, temp,
 			local_xJ, local_tT, local_W;
 	U_int	Lo, Hi, LoHi_H, HiLo_H, tSL, tSH, LoHi_C, temp1, temp2, diffbit,
 			LoBAK, HiBAK, NUMPOINTS = (U_int)1 << DIMS;
@@ -425,6 +758,7 @@ static bool HB_nextmatch_PM ( PU_int *query, HU_int *match, HU_int *key,
 
 	if (counter >= 0)
 	{
+		mask = 1 << counter / DIMS;
 		for (i = 0, Qp = 0; i < DIMS; i++)
 			if (query[i] & mask)
 				Qp |= (1 << (DIMS-1-i));
@@ -606,9 +940,10 @@ static bool HB_nextmatch_PM ( PU_int *query, HU_int *match, HU_int *key,
 /*============================================================================*/
 /* in call to HB_nextmatch_PM(); the last 3 parameters
    are xJ, tT and W */
-bool H_nextmatch_PM( PU_int *query, HU_int *match, HU_int *key, U_int Qsaf, int dimensions )
+bool H_nextmatch_PM( PU_int *query, HU_int *match, HU_int *key, U_int Qsaf,
+			int dimensions, int order )
 {
-    return HB_nextmatch_PM( query, match, key, Qsaf, dimensions * (NUMBITS-1), 0, 0, 0, dimensions );
+    return HB_nextmatch_PM( query, match, key, Qsaf, dimensions * (order-1), 0, 0, 0, dimensions );
 }
 
 
@@ -1100,11 +1435,50 @@ static U_int HB_nextmatch_RQ (Point LoBound, Point HiBound,
 
 #define jORDER WORDBITS
 
-static bool HB_nextmatch_RQ( PU_int *LoBound, PU_int *HiBound,
-            HU_int *next_match, HU_int *page_key, int K,
-            U_int xJ, U_int tT, U_int W,
-            U_int LoMask, U_int HiMask, int DIMS )
+/*=============================================================*/
+/*                    HB_rq_enter_level                        */
+/*=============================================================*/
+/* set the state of the search to that on entry to level K of
+   the descent along the path of page_key; next_match receives
+   the bits of page_key above level K */
+
+static void HB_rq_enter_level( HRQ_STATE& RQ, int K,
+            HU_int *next_match, HU_int *page_key,
+            PU_int *LoBound, PU_int *HiBound,
+            U_int *xJ, U_int *tT, U_int *W,
+            U_int *LoMask, U_int *HiMask )
 {
+    HRQ_LEVEL   *L = &RQ.level[K];
+    int         bits = RQ.DIMS * (K + 1), i;
+
+    *xJ = L->xJ; *tT = L->tT; *W = L->W;
+    *LoMask = L->LoMask; *HiMask = L->HiMask;
+    keycopy( LoBound, L->LoBound, RQ.DIMS );
+    keycopy( HiBound, L->HiBound, RQ.DIMS );
+
+    for (i = 0; i < RQ.KEYWORDS; i++, bits -= jORDER)
+    {
+        if (bits <= 0)
+            next_match[i] = page_key[i];
+        else if (bits < jORDER)
+            next_match[i] = page_key[i] & ~(((U_int)1 << bits) - 1);
+        else
+            next_match[i] = 0;
+    }
+}
+
+/*=============================================================*/
+/*                    HB_nextmatch_RQ                          */
+/*=============================================================*/
+/* the descent is resumed at the highest level at which page_key
+   differs from the key of the previous call: the state on entry
+   to each level along the path of a key depends only on the
+   bits of the key above it */
+
+static bool HB_nextmatch_RQ( HRQ_STATE& RQ,
+            HU_int *next_match, HU_int *page_key )
+{
+    int     DIMS = RQ.DIMS, KEYWORDS = RQ.KEYWORDS;
     U_int   mask, qLo, qHi,
             L_xor_H, R_xor_L, R_xor_H, region,
             H, element, temp,
@@ -1112,26 +1486,70 @@ static bool HB_nextmatch_RQ( PU_int *LoBound, PU_int *HiBound,
             Lo, Hi, LoHi_H, HiLo_H, LoHi_C, tSL, tSH,
             temp1, temp2,
             NUMPOINTS = (U_int)1 << DIMS,
-            g_all_ones = ( (U_int)1 << DIMS ) -1;
-    int     i, j, N;
-
-/* variables used for back-tracking */
+            g_all_ones = ( (U_int)1 << DIMS ) -1,
+            xJ, tT, W, LoMask, HiMask;
+    int     i, j, N, K;
+    PU_int  LoBound[MAXDIMS], HiBound[MAXDIMS];
+    HRQ_LEVEL   *L;
+
+/* variables used for back-tracking; the rest of the state to
+   back-track to is that on entry to level KBAK, in RQ.level */
 	U_int	qLoBAK, qHiBAK,
 			L_xor_HBAK,
 			HBAK,
-			xJBAK, tTBAK, WBAK,
-			LoMaskBAK, HiMaskBAK,
 			LoBAK, HiBAK;
-	bool	Backup = false;
-	// allocate storage to these and delete them when finished
-	HU_int	*next_matchBAK = new HU_int[DIMS];
-	PU_int	*LoBoundBAK = new PU_int[DIMS];
-	PU_int	*HiBoundBAK = new PU_int[DIMS];
+	bool	Backup;
 	int 	KBAK;
 
+/* find the level to resume from */
+    for (K = -1, i = KEYWORDS - 1; i >= 0; i--)
+    {
+        if ((temp = page_key[i] ^ RQ.key[i]) != 0)
+        {
+            for (j = jORDER - 1; !(temp >> j & 1); j--)
+                ;
+            K = (i * jORDER + j) / DIMS;
+            break;
+        }
+    }
+    if (K >= RQ.order)
+        K = RQ.order - 1;	/* bits above the code: start afresh */
+    if (K < RQ.valid)
+        K = RQ.valid;
+    RQ.valid = K;
+    keycopy( RQ.key, page_key, KEYWORDS );
+
+    HB_rq_enter_level( RQ, K, next_match, page_key, LoBound, HiBound,
+            &xJ, &tT, &W, &LoMask, &HiMask );
+    L = &RQ.level[K];
+    if ((Backup = L->KBAK >= 0))
+    {
+        KBAK = L->KBAK;
+        qLoBAK = L->qLoBAK; qHiBAK = L->qHiBAK;
+        L_xor_HBAK = L->L_xor_HBAK;
+        HBAK = L->HBAK;
+        LoBAK = L->LoBAK; HiBAK = L->HiBAK;
+    }
+
     while (K >= 0)
     {
 	mask = 1 << K;
+
+	if (K < RQ.valid)
+	{
+/* a new level on the path of page_key: note its entry state */
+		L = &RQ.level[K];
+		L->xJ = xJ; L->tT = tT; L->W = W;
+		L->LoMask = LoMask; L->HiMask = HiMask;
+		keycopy( L->LoBound, LoBound, DIMS );
+		keycopy( L->HiBound, HiBound, DIMS );
+		L->KBAK = Backup ? KBAK : -1;
+		L->qLoBAK = qLoBAK; L->qHiBAK = qHiBAK;
+		L->L_xor_HBAK = L_xor_HBAK;
+		L->HBAK = HBAK;
+		L->LoBAK = LoBAK; L->HiBAK = HiBAK;
+		RQ.valid = K;
+	}
 /* step 1: find the n-points of the quadrants in which the
    query lower and upper bound points lie */
 
@@ -1253,12 +1671,7 @@ static bool HB_nextmatch_RQ( PU_int *LoBound, PU_int *HiBound,
 						qLoBAK = qLo; qHiBAK = qHi;
 						L_xor_HBAK = L_xor_H;
 						HBAK = H;
-						xJBAK = xJ; tTBAK = tT; WBAK = W;
 						KBAK = K;
-						keycopy( next_matchBAK, next_match, DIMS );
-						keycopy( LoBoundBAK, LoBound, DIMS );
-						keycopy( HiBoundBAK, HiBound, DIMS );
-						LoMaskBAK = LoMask; HiMaskBAK = HiMask;
 						LoBAK = HiLo_H; HiBAK = Hi;
 						Backup = true;
                     }
@@ -1294,20 +1707,15 @@ static bool HB_nextmatch_RQ( PU_int *LoBound, PU_int *HiBound,
 							qLo = qLoBAK; qHi = qHiBAK;
 							L_xor_H = L_xor_HBAK;
 							H = HBAK;
-							xJ = xJBAK; tT = tTBAK; W = WBAK;
 							K = KBAK;
-							keycopy( next_match, next_matchBAK, DIMS );
-							keycopy( LoBound, LoBoundBAK, DIMS );
-							keycopy( HiBound, HiBoundBAK, DIMS );
-							LoMask = LoMaskBAK; HiMask = HiMaskBAK;
+							HB_rq_enter_level( RQ, K, next_match,
+								page_key, LoBound, HiBound,
+								&xJ, &tT, &W, &LoMask, &HiMask );
 							Lo = LoBAK; Hi = HiBAK;
 							Backup = false;
                         }
                         else
                         {
-                        	delete [] next_matchBAK;
-                        	delete [] LoBoundBAK;
-                        	delete [] HiBoundBAK;
                          	return false;
                         }
        		    }
@@ -1340,21 +1748,15 @@ static bool HB_nextmatch_RQ( PU_int *LoBound, PU_int *HiBound,
             if (Backup == false)
             {
             	cerr << "ERROR in ......\n";
-             	delete [] next_matchBAK;
-             	delete [] LoBoundBAK;
-             	delete [] HiBoundBAK;
                 return false;
             }
 
 			qLo = qLoBAK; qHi = qHiBAK;
 			L_xor_H = L_xor_HBAK;
 			H = HBAK;
-			xJ = xJBAK; tT = tTBAK; W = WBAK;
 			K = KBAK;
-			keycopy( next_match, next_matchBAK, DIMS );
-			keycopy( LoBound, LoBoundBAK, DIMS );
-			keycopy( HiBound, HiBoundBAK, DIMS );
-			LoMask = LoMaskBAK; HiMask = HiMaskBAK;
+			HB_rq_enter_level( RQ, K, next_match, page_key,
+				LoBound, HiBound, &xJ, &tT, &W, &LoMask, &HiMask );
 			Lo = LoBAK; Hi = HiBAK;
 			Backup = false;
             continue;
@@ -1405,10 +1807,7 @@ static bool HB_nextmatch_RQ( PU_int *LoBound, PU_int *HiBound,
             if (LoMask == g_all_ones && HiMask == g_all_ones)
             {
                     /* the page_key is a match to the query */
-                keycopy( next_match, page_key, DIMS );
-               	delete [] next_matchBAK;
-               	delete [] LoBoundBAK;
-               	delete [] HiBoundBAK;
+                keycopy( next_match, page_key, KEYWORDS );
                 return true; // 2;  a next-match has been found
             }
         }
@@ -1440,9 +1839,6 @@ static bool HB_nextmatch_RQ( PU_int *LoBound, PU_int *HiBound,
 
 	if ( K < 0 )
 	{
-               	delete [] next_matchBAK;
-               	delete [] LoBoundBAK;
-               	delete [] HiBoundBAK;
 		return true;
 	}
 
@@ -1457,9 +1853,6 @@ static bool HB_nextmatch_RQ( PU_int *LoBound, PU_int *HiBound,
 
         if (LoMask == g_all_ones && HiMask == g_all_ones)
         {
-		delete [] next_matchBAK;
-		delete [] LoBoundBAK;
-		delete [] HiBoundBAK;
 		return true; /* next_match found */
         }
 
@@ -1556,36 +1949,58 @@ static bool HB_nextmatch_RQ( PU_int *LoBound, PU_int *HiBound,
                                 Lo << (DIMS * j) - element * jORDER;
         }
     }
-	delete [] next_matchBAK;
-	delete [] LoBoundBAK;
-	delete [] HiBoundBAK;
 
 	return true; /* next-match found */
 
 }
 
+/*============================================================================*/
+/*                            H_nextmatch_RQ_start			      */
+/*============================================================================*/
+// prepares 'state' for a range query (LB, UB); the descent of the curve starts
+// at the top level, with the whole of the query
+void H_nextmatch_RQ_start( HRQ_STATE& state, const PU_int *LB, const PU_int *UB,
+		int dimensions, int order )
+{
+	HRQ_LEVEL	*L = &state.level[order - 1];
+
+	state.DIMS = dimensions;
+	state.order = order;
+	state.KEYWORDS = HKEY_WORDS( dimensions, order );
+	state.valid = order - 1;
+	memset( state.key, 0, sizeof(state.key) );
+
+	L->xJ = L->tT = L->W = 0;
+	L->LoMask = L->HiMask = 0;
+	keycopy( L->LoBound, LB, dimensions );
+	keycopy( L->HiBound, UB, dimensions );
+	L->KBAK = -1;
+}
+
+/*============================================================================*/
+/*                            H_nextmatch_RQ				      */
+/*============================================================================*/
+// the next match at or above key to the query that 'state' was started with;
+// successive calls re-use as much of the previous descent as they can
+bool H_nextmatch_RQ( HRQ_STATE& state, HU_int *match, HU_int *key )
+{
+	return HB_nextmatch_RQ( state, match, key );
+}
+
 /*============================================================================*/
 /*                            H_nextmatch_RQ				      */
 /*============================================================================*/
-/* in call to HB_nextmatch_RQ_v5d(), state is not used; the last 3 parameters
-   are xJ, tT and W */
+// a single next match to a query (LB, UB)
 
 bool H_nextmatch_RQ( PU_int *LB, PU_int *UB,
-		HU_int *match, HU_int *key, int dimensions )
+		HU_int *match, HU_int *key, int dimensions, int order )
 {
     bool retval;
 //    int i;
-    // these get changed by HB_nextmatch_RQ, therefore use copies
-    PU_int *LoBound = new PU_int[dimensions];
-    PU_int *HiBound = new PU_int[dimensions];
-
-    keycopy( LoBound, LB, dimensions );
-    keycopy( HiBound, UB, dimensions );
-
-    retval = HB_nextmatch_RQ( LoBound, HiBound, match, key, NUMBITS-1, 0, 0, 0, 0, 0, dimensions );
+    HRQ_STATE   state;
 
-    delete [] LoBound;
-    delete [] HiBound;
+    H_nextmatch_RQ_start( state, LB, UB, dimensions, order );
+    retval = HB_nextmatch_RQ( state, match, key );
 
 	/*
 	printf("key: ");
@@ -1611,3 +2026,570 @@ bool H_nextmatch_RQ( PU_int *LB, PU_int *UB,
 }
 
 
+/*============================================================================*/
+/*                                                                            */
+/*                    DECOMPOSITION OF A QUERY BOX INTO KEY INTERVALS         */
+/*                                                                            */
+/*============================================================================*/
+/* The curve is descended one bit of the hilbert code at a time. Each bit of
+   the code halves the region of space reached so far in one dimension, so the
+   region is always a box; it is discarded if it doesn't intersect the query
+   box and output as a single interval of hilbert codes if it lies within it
+   (or if the depth limit is reached). Otherwise both halves are descended, the
+   lower half first, so that intervals are output in ascending order. The
+   state carried from one level of the curve to the next (W and xJ) is that of
+   ENCODE_BUTZ. */
+
+struct HB_BOX {
+	const PU_int	*LB, *UB;	// the query box
+	int				DIMS, order, KEYWORDS, KEYBITS;
+	int				maxdepth;	// no. of bits of a code to descend to
+	int				cap;		// max. no. of intervals or 0 for no limit
+	PU_int			lo[MAXDIMS], hi[MAXDIMS];	// the region reached
+	HU_int			key[HKEY_MAX_WORDS];	// the code bits fixed so far
+	vector<HU_int>	*out;
+	int				count;		// no. of intervals output
+	long			nodes, budget;	// regions examined, and the limit if cap > 0
+	bool			overflow;	// the cap or the budget was exceeded
+};
+
+/*============================================================================*/
+/*                            HB_next_level				      */
+/*============================================================================*/
+// the state (W and xJ) on moving down to the next level of the curve from the
+// quadrant whose derived-key is P, as in ENCODE_BUTZ
+static void HB_next_level( U_int P, U_int *W, U_int *xJ, int DIMS )
+{
+	U_int	T, tT, J;
+	int		j;
+
+	if (P < 3)
+		T = 0;
+	else
+		if (P % 2)
+			T = (P - 1) ^ (P - 1) / 2;
+		else
+			T = (P - 2) ^ (P - 2) / 2;
+	if (*xJ % DIMS != 0)
+		tT = ((T >> (*xJ % DIMS)) | (T << (DIMS - *xJ % DIMS)))
+				& (((U_int)1 << (DIMS - 1)) * 2 - 1);
+	else
+		tT = T;
+	J = DIMS;
+	for (j = 1; j < DIMS; j++)
+		if ((P >> j & 1) != (P & 1))
+			break;
+	if (j != DIMS)
+		J -= j;
+
+	*W ^= tT;
+	*xJ += J - 1;
+}
+
+/*============================================================================*/
+/*                            HB_split_dim				      */
+/*============================================================================*/
+// Bit 't' (from the top) of P fixes a bit of S (the gray code of P), and so a
+// bit of the rotated S, tS, and of A = tS ^ W: ie it halves the current
+// quadrant in one dimension, which is placed in 'dim'. P's higher bits must
+// be set. A value of 1 for the bit selects the upper half of the dimension
+// if the value returned is 0, the lower half if it is 1
+static U_int HB_split_dim( int t, U_int P, U_int W, U_int xJ, int DIMS,
+							int *dim )
+{
+	int		pbit = DIMS - 1 - t,
+			abit = (pbit - (int)(xJ % DIMS) + DIMS) % DIMS;
+	U_int	above = t == 0 ? 0 : (P >> (pbit + 1)) & 1;
+
+	*dim = DIMS - 1 - abit;
+	return above ^ (W >> abit & 1);
+}
+
+/*============================================================================*/
+/*                            HB_box_emit				      */
+/*============================================================================*/
+// output the interval of codes whose first 'depth' bits are those of B.key,
+// merging it with the previous interval if the two are contiguous
+static void HB_box_emit( HB_BOX& B, int depth )
+{
+	HU_int	hi[HKEY_MAX_WORDS];
+	int		i;
+
+	keysetlow( hi, B.key, B.KEYBITS - depth, B.KEYWORDS );
+
+	if (B.count > 0)
+	{
+		// the previous interval's upper code + 1 == this lower code?
+		HU_int	*prev = &(*B.out)[B.out->size() - B.KEYWORDS];
+		U_int	carry = 1;
+
+		for (i = 0; i < B.KEYWORDS; i++)
+		{
+			U_int sum = prev[i] + carry;
+			carry = carry && sum == 0;
+			if (sum != B.key[i])
+				break;
+		}
+		if (i == B.KEYWORDS)
+		{
+			keycopy( prev, hi, B.KEYWORDS );
+			return;
+		}
+	}
+
+	if (B.cap > 0 && B.count == B.cap)
+	{
+		B.overflow = true;
+		return;
+	}
+	B.out->insert( B.out->end(), B.key, B.key + B.KEYWORDS );
+	B.out->insert( B.out->end(), hi, hi + B.KEYWORDS );
+	B.count++;
+}
+
+/*============================================================================*/
+/*                            HB_box_descend				      */
+/*============================================================================*/
+// 'depth' bits of the code have been fixed, 't' of them at the current level
+// of the curve, where they form the high bits of P. The region reached
+// intersects the query box and extends beyond it in 'partial' dimensions
+static void HB_box_descend( HB_BOX& B, int depth, int t, U_int P,
+							U_int W, U_int xJ, int partial )
+{
+	int		DIMS = B.DIMS;
+
+	if (B.cap > 0 && ++B.nodes > B.budget)
+	{
+		B.overflow = true;
+		return;
+	}
+	if (partial == 0 || depth == B.maxdepth)
+	{
+		HB_box_emit( B, depth );
+		return;
+	}
+
+	if (t == DIMS)
+	{
+		HB_next_level( P, &W, &xJ, DIMS );
+		t = 0;
+		P = 0;
+	}
+
+	int		dim, pbit = DIMS - 1 - t, kbit = B.KEYBITS - 1 - depth;
+	U_int	flip = HB_split_dim( t, P, W, xJ, DIMS, &dim ),
+			cmask = (U_int)1 << (B.order - 1 - depth / DIMS),
+			lo = B.lo[dim], hi = B.hi[dim];
+
+	// only 'dim' changes, so only it needs comparing with the query box
+	partial -= lo < B.LB[dim] || hi > B.UB[dim];
+	for (U_int bit = 0; bit <= 1 && !B.overflow; bit++)
+	{
+		if ((bit ^ flip) == 0)
+			B.hi[dim] = hi & ~cmask;	// lower half of the dimension
+		else
+			B.lo[dim] = lo | cmask;		// upper half of the dimension
+		if (bit)
+			B.key[kbit / WORDBITS] |= (U_int)1 << kbit % WORDBITS;
+
+		if (B.hi[dim] >= B.LB[dim] && B.lo[dim] <= B.UB[dim])
+			HB_box_descend( B, depth + 1, t + 1, P | bit << pbit, W, xJ,
+				partial + (B.lo[dim] < B.LB[dim] || B.hi[dim] > B.UB[dim]) );
+
+		B.lo[dim] = lo;
+		B.hi[dim] = hi;
+	}
+	B.key[kbit / WORDBITS] &= ~((U_int)1 << kbit % WORDBITS);
+}
+
+/*============================================================================*/
+/*                            H_box_intervals				      */
+/*============================================================================*/
+// Finds the intervals of hilbert codes that together cover the query box
+// (LB, UB). 'intervals' receives the lower and then the upper code of each
+// interval, in ascending order, each code occupying HKEY_WORDS( dimensions,
+// order ) U_ints; the no. of intervals is returned.
+// If max_intervals is > 0, no more than that no. of intervals is returned:
+// the curve is then descended only as far as allows this (and a proportionate
+// amount of work) and the intervals may cover codes of points outside of the
+// box. Without a limit the intervals are exact, but their no. (and the time
+// taken) can be very large for boxes with long faces in many dimensions.
+// The no. of intervals (ie of separate searches of the index) and the codes
+// they span give an estimate of the cost of a range query before it is run.
+int H_box_intervals( const PU_int *LB, const PU_int *UB,
+		vector<HU_int>& intervals, int dimensions, int order, int max_intervals )
+{
+	HB_BOX	B;
+	PU_int	Lo[MAXDIMS], Hi[MAXDIMS],
+			max_coord = order == WORDBITS ? UINT_MAX : ((U_int)1 << order) - 1;
+	int		i, partial, shallow, deep;
+
+	intervals.clear();
+	for (i = partial = 0; i < dimensions; i++)
+	{
+		Lo[i] = LB[i];
+		Hi[i] = UB[i] > max_coord ? max_coord : UB[i];
+		if (Lo[i] > Hi[i])
+			return 0;
+		partial += Lo[i] > 0 || Hi[i] < max_coord;
+	}
+
+	B.LB = Lo;
+	B.UB = Hi;
+	B.DIMS = dimensions;
+	B.order = order;
+	B.KEYWORDS = HKEY_WORDS( dimensions, order );
+	B.KEYBITS = dimensions * order;
+	B.cap = max_intervals;
+	// a region on the boundary of the box may need descending a long way
+	// before it yields an interval that doesn't merge with its neighbour, so
+	// the work done is limited too
+	B.budget = 4L * max_intervals * B.KEYBITS;
+	B.out = &intervals;
+	memset( B.key, 0, sizeof(B.key) );
+
+	// find the deepest descent that doesn't need more than max_intervals
+	// (or the budget): neither falls as the depth increases
+	shallow = 0;
+	deep = B.KEYBITS;
+	for (B.maxdepth = deep;; B.maxdepth = (shallow + deep + 1) / 2)
+	{
+		for (i = 0; i < dimensions; i++)
+		{
+			B.lo[i] = 0;
+			B.hi[i] = max_coord;
+		}
+		intervals.clear();
+		B.count = 0;
+		B.nodes = 0;
+		B.overflow = false;
+		HB_box_descend( B, 0, 0, 0, 0, 0, partial );
+
+		if (!B.overflow)
+		{
+			if (B.maxdepth == deep)
+				break;
+			shallow = B.maxdepth;
+		}
+		else
+			deep = B.maxdepth - 1;
+	}
+	return B.count;
+}
+
+/*============================================================================*/
+/*                                                                            */
+/*                    NEXT-MATCHES TO QUERY REGIONS OF ANY SHAPE              */
+/*                                                                            */
+/*============================================================================*/
+/* As when decomposing a query box into intervals, the curve is descended one
+   bit of the hilbert code at a time, each bit halving the region of space (a
+   box) reached so far in one dimension. A function classifying boxes against
+   the query region prunes the regions that lie outside of it. While the bits
+   fixed so far are those of the key, the descent follows the key and then
+   any higher half region; the first region found to lie inside the query
+   region gives the next-match: the key itself if it is still being followed,
+   otherwise the lowest code in the region. The codes of the whole of that
+   region are of points inside the query region, so they need no testing.
+   A region may be classified as H_PARTIAL without holding any point inside
+   the query region (eg a slab thinner than the spacing of the points), and
+   descending every such region on its boundary can take time exponential in
+   the no. of dimensions, so the no. of regions examined is limited. Once the
+   limit is reached the first code of the region being examined is returned:
+   no match lies below it, but there may be none in it either, so the points
+   of the pages found from it must all be tested. */
+
+struct HB_REGION {
+	H_CLASSIFY		classify;
+	const void		*arg;
+	int				DIMS, order, KEYWORDS, KEYBITS;
+	PU_int			lo[MAXDIMS], hi[MAXDIMS];	// the region reached
+	HU_int			*match;
+	const HU_int	*key;
+	HU_int			*inside;	// the codes of the region found, or NULL
+	long			nodes, budget;	// regions examined, and the limit
+};
+
+/*============================================================================*/
+/*                            HB_region_descend				      */
+/*============================================================================*/
+// 'depth' bits of the code have been fixed (and set in R.match), 't' of them
+// at the current level of the curve, where they form the high bits of P; they
+// are those of R.key if 'follow' is true
+static bool HB_region_descend( HB_REGION& R, int depth, int t, U_int P,
+							U_int W, U_int xJ, bool follow )
+{
+	int		DIMS = R.DIMS, c;
+
+	if ((c = R.classify( R.lo, R.hi, DIMS, R.arg )) == H_OUTSIDE)
+		return false;
+	// a region of a single point is either inside or outside
+	if (c == H_INSIDE || depth == R.KEYBITS)
+	{
+		// R.match holds the region's first 'depth' bits, the rest are 0
+		if (R.inside != NULL)
+		{
+			keycopy( R.inside, R.match, R.KEYWORDS );
+			keysetlow( R.inside + R.KEYWORDS, R.match, R.KEYBITS - depth,
+				R.KEYWORDS );
+		}
+		if (follow)
+			keycopy( R.match, R.key, R.KEYWORDS );
+		return true;
+	}
+	if (++R.nodes > R.budget)
+	{
+		// give up: no code of the region is known to be a match, so
+		// 'inside' is left empty (its first code above its last)
+		if (R.inside != NULL)
+		{
+			memset( R.inside, 0xff, sizeof(HU_int) * R.KEYWORDS );
+			memset( R.inside + R.KEYWORDS, 0, sizeof(HU_int) * R.KEYWORDS );
+		}
+		if (follow)
+			keycopy( R.match, R.key, R.KEYWORDS );
+		return true;
+	}
+
+	if (t == DIMS)
+	{
+		HB_next_level( P, &W, &xJ, DIMS );
+		t = 0;
+		P = 0;
+	}
+
+	int		dim, pbit = DIMS - 1 - t, kbit = R.KEYBITS - 1 - depth;
+	U_int	flip = HB_split_dim( t, P, W, xJ, DIMS, &dim ),
+			cmask = (U_int)1 << (R.order - 1 - depth / DIMS),
+			lo = R.lo[dim], hi = R.hi[dim],
+			keybit = follow ? R.key[kbit / WORDBITS] >> kbit % WORDBITS & 1 : 0;
+
+	for (U_int bit = keybit; bit <= 1; bit++)
+	{
+		if ((bit ^ flip) == 0)
+			R.hi[dim] = hi & ~cmask;	// lower half of the dimension
+		else
+			R.lo[dim] = lo | cmask;		// upper half of the dimension
+		if (bit)
+			R.match[kbit / WORDBITS] |= (U_int)1 << kbit % WORDBITS;
+
+		if (HB_region_descend( R, depth + 1, t + 1, P | bit << pbit, W, xJ,
+				follow && bit == keybit ))
+			return true;
+
+		R.lo[dim] = lo;
+		R.hi[dim] = hi;
+	}
+	R.match[kbit / WORDBITS] &= ~((U_int)1 << kbit % WORDBITS);
+	return false;
+}
+
+/*============================================================================*/
+/*                            H_nextmatch_region			      */
+/*============================================================================*/
+// The lowest code >= key of a point within the query region that 'classify'
+// and 'arg' describe is placed in match. If 'inside' isn't NULL, it receives
+// the lowest and then the highest code of the sub-quadrant the match was found
+// in, all of whose points are within the query region: the match is the first
+// of them to follow key.
+// 'classify' must classify a box of a single point as H_OUTSIDE or H_INSIDE;
+// H_PARTIAL is taken to mean H_INSIDE.
+// If more than H_REGION_BUDGET regions per bit of a code are examined, the
+// code returned may be lower than the next match (and be returned even if
+// there is none) and 'inside' is left empty
+bool H_nextmatch_region( H_CLASSIFY classify, const void *arg,
+		HU_int *match, const HU_int *key, int dimensions, int order,
+		HU_int *inside )
+{
+	HB_REGION	R;
+	PU_int		max_coord = order == WORDBITS ? UINT_MAX : ((U_int)1 << order) - 1;
+
+	R.classify = classify;
+	R.arg = arg;
+	R.DIMS = dimensions;
+	R.order = order;
+	R.KEYWORDS = HKEY_WORDS( dimensions, order );
+	R.KEYBITS = dimensions * order;
+	R.match = match;
+	R.key = key;
+	R.inside = inside;
+	R.nodes = 0;
+	R.budget = (long)H_REGION_BUDGET * R.KEYBITS;
+	for (int i = 0; i < dimensions; i++)
+	{
+		R.lo[i] = 0;
+		R.hi[i] = max_coord;
+	}
+	memset( match, 0, sizeof(HU_int) * R.KEYWORDS );
+
+	return HB_region_descend( R, 0, 0, 0, 0, 0, true );
+}
+
+/*============================================================================*/
+/*                            H_classify_ball				      */
+/*============================================================================*/
+// 'arg' is an H_BALL; distances are squared and calculated in doubles
+int H_classify_ball( const PU_int *lo, const PU_int *hi, int dims,
+							const void *arg )
+{
+	const H_BALL	*B = (const H_BALL*)arg;
+	double			near = 0.0, far = 0.0, a, b;
+
+	for (int i = 0; i < dims; i++)
+	{
+		a = (double)B->centre[i] - lo[i];
+		b = (double)hi[i] - B->centre[i];
+		if (a < 0.0)
+			near += a * a;
+		else if (b < 0.0)
+			near += b * b;
+		a = a > b ? a : b;
+		far += a * a;
+	}
+	if (near > B->radius2)
+		return H_OUTSIDE;
+	return far <= B->radius2 ? H_INSIDE : H_PARTIAL;
+}
+
+/*============================================================================*/
+/*                            H_nextmatch_ball				      */
+/*============================================================================*/
+// the next match at or above key to a ball query (ie of points whose distance
+// from the centre is no more than the radius)
+bool H_nextmatch_ball( const H_BALL& ball, HU_int *match, const HU_int *key,
+		int dimensions, int order )
+{
+	return H_nextmatch_region( H_classify_ball, &ball, match, key,
+			dimensions, order );
+}
+
+/*============================================================================*/
+/*                            H_classify_polytope			      */
+/*============================================================================*/
+// 'arg' is an H_POLYTOPE. Over a box, the least and greatest values of a.x are
+// found by taking, in each dimension, the end of the box that a's sign favours.
+// A box that straddles more than one face may lie outside of the polytope and
+// still be classified as H_PARTIAL, as may one holding no point of a polytope
+// thinner than the spacing of the points: the descent of such boxes is
+// limited (see H_nextmatch_region()), and a page found from one that holds
+// no match is searched for nothing
+int H_classify_polytope( const PU_int *lo, const PU_int *hi, int dims,
+						const void *arg )
+{
+	const H_POLYTOPE	*T = (const H_POLYTOPE*)arg;
+	const double		*a;
+	double				least, most;
+	int					i, f, c = H_INSIDE;
+
+	for (f = 0; f < T->faces; f++)
+	{
+		a = T->a + f * dims;
+		least = most = 0.0;
+		for (i = 0; i < dims; i++)
+			if (a[i] >= 0.0)
+			{
+				least += a[i] * lo[i];
+				most += a[i] * hi[i];
+			}
+			else
+			{
+				least += a[i] * hi[i];
+				most += a[i] * lo[i];
+			}
+		if (least > T->b[f])
+			return H_OUTSIDE;
+		if (most > T->b[f])
+			c = H_PARTIAL;
+	}
+	return c;
+}
+
+/*============================================================================*/
+/*                                                                            */
+/*                    SUB-QUADRANTS FOR BEST-FIRST SEARCHES                   */
+/*                                                                            */
+/*============================================================================*/
+/* A sub-quadrant is the box of points whose codes share their first 'depth'
+   bits; it is split into two halves, in curve order, by fixing the next bit,
+   exactly as in the descents above. Searches that visit regions of space in
+   an order of their own choosing (eg nearest first) keep the sub-quadrants
+   yet to be visited and split them as they need to. */
+
+/*============================================================================*/
+/*                            H_quadrant_root				      */
+/*============================================================================*/
+// the whole space: no bits of the code are fixed
+void H_quadrant_root( H_QUADRANT& Q, int dimensions, int order )
+{
+	PU_int	max_coord = order == WORDBITS ? UINT_MAX : ((U_int)1 << order) - 1;
+
+	Q.depth = Q.t = 0;
+	Q.P = Q.W = Q.xJ = 0;
+	for (int i = 0; i < dimensions; i++)
+	{
+		Q.lo[i] = 0;
+		Q.hi[i] = max_coord;
+	}
+	memset( Q.key, 0, sizeof(Q.key) );
+}
+
+/*============================================================================*/
+/*                            H_quadrant_split				      */
+/*============================================================================*/
+// places the lower and upper halves (in curve order) of Q in 'lower' and
+// 'upper'; returns false, and does nothing, if Q is a single point
+bool H_quadrant_split( const H_QUADRANT& Q, H_QUADRANT *lower,
+		H_QUADRANT *upper, int dimensions, int order )
+{
+	int		DIMS = dimensions, KEYBITS = dimensions * order,
+			t = Q.t, dim, pbit, kbit = KEYBITS - 1 - Q.depth;
+	U_int	P = Q.P, W = Q.W, xJ = Q.xJ, flip, cmask;
+
+	if (Q.depth == KEYBITS)
+		return false;
+
+	if (t == DIMS)
+	{
+		HB_next_level( P, &W, &xJ, DIMS );
+		t = 0;
+		P = 0;
+	}
+	pbit = DIMS - 1 - t;
+	flip = HB_split_dim( t, P, W, xJ, DIMS, &dim );
+	cmask = (U_int)1 << (order - 1 - Q.depth / DIMS);
+
+	*lower = *upper = Q;
+	lower->depth = upper->depth = Q.depth + 1;
+	lower->t = upper->t = t + 1;
+	lower->W = upper->W = W;
+	lower->xJ = upper->xJ = xJ;
+	lower->P = P;
+	upper->P = P | (U_int)1 << pbit;
+	upper->key[kbit / WORDBITS] |= (U_int)1 << kbit % WORDBITS;
+
+	// a bit of 1 selects the upper half of the dimension unless 'flip' is set
+	if (flip == 0)
+	{
+		lower->hi[dim] = Q.hi[dim] & ~cmask;
+		upper->lo[dim] = Q.lo[dim] | cmask;
+	}
+	else
+	{
+		lower->lo[dim] = Q.lo[dim] | cmask;
+		upper->hi[dim] = Q.hi[dim] & ~cmask;
+	}
+	return true;
+}
+
+/*============================================================================*/
+/*                            H_quadrant_codes				      */
+/*============================================================================*/
+// the lowest and highest codes of points in Q
+void H_quadrant_codes( const H_QUADRANT& Q, HU_int *first, HU_int *last,
+		int dimensions, int order )
+{
+	int		KEYWORDS = HKEY_WORDS( dimensions, order );
+
+	keycopy( first, Q.key, KEYWORDS );
+	keysetlow( last, Q.key, dimensions * order - Q.depth, KEYWORDS );
+}
@@ -3,9 +3,92 @@
 #ifndef _HILBERT_H
 #define _HILBERT_H
 
-HU_int* ENCODE( HU_int*, const PU_int* const, int );
-PU_int* DECODE( PU_int*, HU_int*, int );
-bool H_nextmatch_PM( PU_int *query, HU_int *match, HU_int *key, U_int Qsaf, int dimensions );
-bool H_nextmatch_RQ( PU_int *LB, PU_int *UB, HU_int *match, HU_int *key, int dimensions );
+// 'order' is the no. of bits per coordinate that are mapped; hilbert codes
+// occupy HKEY_WORDS( dims, order ) U_ints
+HU_int* ENCODE( HU_int*, const PU_int* const, int, int order = NUMBITS );
+PU_int* DECODE( PU_int*, HU_int*, int, int order = NUMBITS );
+HU_int* ENCODE_BUTZ( HU_int*, const PU_int* const, int, int order = NUMBITS );
+PU_int* DECODE_BUTZ( PU_int*, HU_int*, int, int order = NUMBITS );
+void ENCODE_batch( const PU_int* points, size_t n, HU_int* out, int dims, int order = NUMBITS );
+bool H_nextmatch_PM( PU_int *query, HU_int *match, HU_int *key, U_int Qsaf, int dimensions, int order = NUMBITS );
+bool H_nextmatch_RQ( PU_int *LB, PU_int *UB, HU_int *match, HU_int *key, int dimensions, int order = NUMBITS );
+
+// the state of the curve, and the narrowed query, on entry to a level of the
+// descent made by H_nextmatch_RQ
+typedef struct {
+	U_int	xJ, tT, W;
+	U_int	LoMask, HiMask;
+	PU_int	LoBound[MAXDIMS], HiBound[MAXDIMS];
+	// the point to back-track to if the search of this level fails:
+	// KBAK < 0 if there is none
+	int		KBAK;
+	U_int	qLoBAK, qHiBAK, L_xor_HBAK, HBAK, LoBAK, HiBAK;
+} HRQ_LEVEL;
+
+// a range query's descent of the curve, kept from one call of H_nextmatch_RQ
+// to the next so that each call only re-descends from the highest level at
+// which its page key differs from the previous one
+typedef struct HRQ_STATE {
+	int			DIMS, order, KEYWORDS;
+	int			valid;		// the lowest level whose entry in 'level' is known
+	HU_int		key[HKEY_MAX_WORDS];	// the key whose path 'level' follows
+	HRQ_LEVEL	level[NUMBITS];
+} HRQ_STATE;
+
+void H_nextmatch_RQ_start( HRQ_STATE& state, const PU_int *LB, const PU_int *UB, int dimensions, int order = NUMBITS );
+bool H_nextmatch_RQ( HRQ_STATE& state, HU_int *match, HU_int *key );
+// the sorted intervals of codes ([lower, upper] pairs) covering a query box
+int H_box_intervals( const PU_int *LB, const PU_int *UB, vector<HU_int>& intervals, int dimensions, int order = NUMBITS, int max_intervals = 0 );
+
+// the classification of a box (eg a sub-quadrant) against a query region
+#define H_OUTSIDE		0
+#define H_INSIDE		1
+#define H_PARTIAL		2
+
+// the no. of regions per bit of a code that a next-match to a query region
+// examines before it settles for a code that may be below the next match
+#define H_REGION_BUDGET	64
+
+// classifies the box (lo, hi) against the query region described by 'arg'
+typedef int (*H_CLASSIFY)( const PU_int *lo, const PU_int *hi, int dims, const void *arg );
+
+// the next match to a query region of any shape that 'classify' can describe;
+// 'inside' (2 keys) receives the codes of the sub-quadrant wholly within the
+// region that the match was found in
+bool H_nextmatch_region( H_CLASSIFY classify, const void *arg, HU_int *match, const HU_int *key, int dimensions, int order = NUMBITS, HU_int *inside = NULL );
+
+// a convex polytope: the points x for which a[f].x <= b[f] for every face f,
+// where a holds 'faces' rows of 'dims' coefficients
+typedef struct H_POLYTOPE {
+	int				faces;
+	const double	*a;
+	const double	*b;
+} H_POLYTOPE;
+
+int H_classify_polytope( const PU_int *lo, const PU_int *hi, int dims, const void *arg );
+
+// a ball (hypersphere) query: points no further than sqrt( radius2 ) from the
+// centre
+typedef struct H_BALL {
+	PU_int	centre[MAXDIMS];
+	double	radius2;
+} H_BALL;
+
+int H_classify_ball( const PU_int *lo, const PU_int *hi, int dims, const void *arg );
+bool H_nextmatch_ball( const H_BALL& ball, HU_int *match, const HU_int *key, int dimensions, int order = NUMBITS );
+
+// a sub-quadrant: the box of points whose codes begin with the first 'depth'
+// bits of 'key' (the rest of which are 0), with the state of the curve needed
+// to split it
+typedef struct H_QUADRANT {
+	int		depth, t;
+	U_int	P, W, xJ;
+	PU_int	lo[MAXDIMS], hi[MAXDIMS];
+	HU_int	key[HKEY_MAX_WORDS];
+} H_QUADRANT;
+
+void H_quadrant_root( H_QUADRANT& Q, int dimensions, int order = NUMBITS );
+bool H_quadrant_split( const H_QUADRANT& Q, H_QUADRANT *lower, H_QUADRANT *upper, int dimensions, int order = NUMBITS );
+void H_quadrant_codes( const H_QUADRANT& Q, HU_int *first, HU_int *last, int dimensions, int order = NUMBITS );
 
 #endif
\ No newline at end of file
@@ -0,0 +1,431 @@
+// hilbert/morton.cc
+
+/*----------------------------------------------------------------------------*/
+/*	THIS FILE CONTAINS CODE FOR THE Z-ORDER (MORTON) CURVE		      */
+/*                            						      */
+/*	A CODE INTERLEAVES THE BITS OF THE COORDINATES: AT EACH LEVEL OF      */
+/*	THE CURVE, BIT k OF EVERY COORDINATE, FIRST COORDINATE MOST	      */
+/*	SIGNIFICANT (AS IS 'A' IN THE HILBERT CURVE)			      */
+/*----------------------------------------------------------------------------*/
+
+#ifdef __MSDOS__
+	#include "..\gendefs.h"
+	#include "..\utils\utils.h"
+#else
+	#include "../gendefs.h"
+	#include "../utils/utils.h"
+#endif
+#include "hilbert.h"
+#include "morton.h"
+
+using namespace std;
+
+/*============================================================================*/
+/*                            						      */
+/*                            ENCODING & DECODING FUNCTIONS		      */
+/*                            						      */
+/*============================================================================*/
+/* Where the processor supports BMI2, the bits of each coordinate are spread
+   out (and gathered back in) by PDEP (PEXT), 64 / DIMS levels of the curve at
+   a time. As with the AVX2 hilbert encoding, that code is compiled for the
+   instruction set regardless of the compiler flags and only called when the
+   CPU is found to support it at run time. */
+
+#if defined(__GNUC__) && defined(__x86_64__)
+	#define M_BMI2
+	#include <immintrin.h>
+#endif
+
+typedef unsigned long long	U_int64;
+
+/*============================================================================*/
+/*                            M_ENCODE_bits				      */
+/*============================================================================*/
+static HU_int* M_ENCODE_bits( HU_int* hcode, const PU_int* const point,
+				int DIMS, int order )
+{
+	int		i, j, k, b;
+
+	memset( hcode, 0, sizeof(HU_int) * HKEY_WORDS( DIMS, order ) );
+	for (k = order - 1, i = k * DIMS; k >= 0; k--, i -= DIMS)
+		for (j = 0; j < DIMS; j++)
+			if (point[j] >> k & 1)
+			{
+				b = i + DIMS - 1 - j;
+				hcode[b / WORDBITS] |= (U_int)1 << b % WORDBITS;
+			}
+	return hcode;
+}
+
+/*============================================================================*/
+/*                            M_DECODE_bits				      */
+/*============================================================================*/
+static PU_int* M_DECODE_bits( PU_int* point, HU_int* hcode, int DIMS,
+				int order )
+{
+	int		i, j, k, b;
+
+	memset( point, 0, sizeof(PU_int) * DIMS );
+	for (k = order - 1, i = k * DIMS; k >= 0; k--, i -= DIMS)
+		for (j = 0; j < DIMS; j++)
+		{
+			b = i + DIMS - 1 - j;
+			point[j] |= (hcode[b / WORDBITS] >> b % WORDBITS & 1) << k;
+		}
+	return point;
+}
+
+#ifdef M_BMI2
+/*============================================================================*/
+/*                            M_MASKS					      */
+/*============================================================================*/
+// mask[DIMS][j] selects the bits of coordinate j in 64 / DIMS levels of a
+// code of DIMS dimensions
+struct M_MASKS {
+	U_int64		mask[MAXDIMS + 1][MAXDIMS];
+
+	M_MASKS();
+	static const M_MASKS& get() { static const M_MASKS masks; return masks; }
+};
+
+M_MASKS::M_MASKS()
+{
+	for (int DIMS = 1; DIMS <= MAXDIMS; DIMS++)
+		for (int j = 0; j < DIMS; j++)
+		{
+			mask[DIMS][j] = 0;
+			for (int l = 0; l < 64 / DIMS; l++)
+				mask[DIMS][j] |= (U_int64)1 << (l * DIMS + DIMS - 1 - j);
+		}
+}
+
+/*============================================================================*/
+/*                            M_ENCODE_bmi2				      */
+/*============================================================================*/
+__attribute__((target("bmi2")))
+static HU_int* M_ENCODE_bmi2( HU_int* hcode, const PU_int* const point,
+				int DIMS, int order )
+{
+	const U_int64	*mask = M_MASKS::get().mask[DIMS];
+	const int		words = HKEY_WORDS( DIMS, order ), L = 64 / DIMS;
+	U_int64			chunk, lowmask;
+	int				j, k, n, w, sh;
+
+	memset( hcode, 0, sizeof(HU_int) * words );
+	for (k = 0; k < order; k += L)
+	{
+		n = order - k < L ? order - k : L;
+		lowmask = ((U_int64)1 << n) - 1;
+		for (j = 0, chunk = 0; j < DIMS; j++)
+			chunk |= _pdep_u64( (U_int64)point[j] >> k & lowmask, mask[j] );
+
+		// levels k to k + n - 1 occupy the code from bit k * DIMS up
+		w = k * DIMS / WORDBITS;
+		sh = k * DIMS % WORDBITS;
+		hcode[w] |= (U_int)(chunk << sh);
+		if (w + 1 < words)
+			hcode[w + 1] |= (U_int)(chunk << sh >> WORDBITS);
+		if (sh != 0 && w + 2 < words)
+			hcode[w + 2] |= (U_int)(chunk >> (64 - sh));
+	}
+	return hcode;
+}
+
+/*============================================================================*/
+/*                            M_DECODE_bmi2				      */
+/*============================================================================*/
+__attribute__((target("bmi2")))
+static PU_int* M_DECODE_bmi2( PU_int* point, HU_int* hcode, int DIMS,
+				int order )
+{
+	const U_int64	*mask = M_MASKS::get().mask[DIMS];
+	const int		words = HKEY_WORDS( DIMS, order ), L = 64 / DIMS;
+	U_int64			chunk;
+	int				j, k, n, w, sh;
+
+	memset( point, 0, sizeof(PU_int) * DIMS );
+	for (k = 0; k < order; k += L)
+	{
+		n = order - k < L ? order - k : L;
+		w = k * DIMS / WORDBITS;
+		sh = k * DIMS % WORDBITS;
+		chunk = hcode[w];
+		if (w + 1 < words)
+			chunk |= (U_int64)hcode[w + 1] << WORDBITS;
+		chunk >>= sh;
+		if (sh != 0 && w + 2 < words)
+			chunk |= (U_int64)hcode[w + 2] << (64 - sh);
+		if (n * DIMS < 64)
+			chunk &= ((U_int64)1 << n * DIMS) - 1;
+
+		for (j = 0; j < DIMS; j++)
+			point[j] |= (PU_int)_pext_u64( chunk, mask[j] ) << k;
+	}
+	return point;
+}
+#endif
+
+/*============================================================================*/
+/*                            M_ENCODE					      */
+/*============================================================================*/
+// point is the point to be encoded, hcode receives its Z-order code, which
+// is returned. Only the low 'order' bits of each coordinate are mapped.
+HU_int* M_ENCODE( HU_int* hcode, const PU_int* const point, int DIMS, int order )
+{
+#ifdef M_BMI2
+	static const bool bmi2 = __builtin_cpu_supports( "bmi2" );
+
+	if (bmi2)
+		return M_ENCODE_bmi2( hcode, point, DIMS, order );
+#endif
+	return M_ENCODE_bits( hcode, point, DIMS, order );
+}
+
+/*============================================================================*/
+/*                            M_DECODE					      */
+/*============================================================================*/
+PU_int* M_DECODE( PU_int* point, HU_int* hcode, int DIMS, int order )
+{
+#ifdef M_BMI2
+	static const bool bmi2 = __builtin_cpu_supports( "bmi2" );
+
+	if (bmi2)
+		return M_DECODE_bmi2( point, hcode, DIMS, order );
+#endif
+	return M_DECODE_bits( point, hcode, DIMS, order );
+}
+
+/*============================================================================*/
+/*                            M_ENCODE_batch				      */
+/*============================================================================*/
+// as ENCODE_batch: n points held contiguously in 'points', their codes placed
+// contiguously in 'out'
+void M_ENCODE_batch( const PU_int* points, size_t n, HU_int* out, int DIMS, int order )
+{
+	for (size_t p = 0; p < n; p++, points += DIMS, out += HKEY_WORDS( DIMS, order ))
+		M_ENCODE( out, points, DIMS, order );
+}
+
+/*============================================================================*/
+/*                                                                            */
+/*                    NEXT-MATCHES TO QUERIES                                 */
+/*                                                                            */
+/*============================================================================*/
+/* As for the hilbert curve (see H_nextmatch_region()), the curve is descended
+   one bit of the code at a time, each bit halving the region reached so far
+   in one dimension. On this curve the dimension is simply the next in turn
+   and a bit of 1 always selects its upper half, so no state is needed. Range
+   and partial match queries are boxes (in a partial match query, a box with
+   no extent in its specified dimensions) and are classified exactly. Other
+   regions may not be, so the no. of regions examined is limited as it is on
+   the hilbert curve. */
+
+struct M_REGION {
+	H_CLASSIFY		classify;
+	const void		*arg;
+	int				DIMS, order, KEYWORDS, KEYBITS;
+	PU_int			lo[MAXDIMS], hi[MAXDIMS];	// the region reached
+	HU_int			*match;
+	const HU_int	*key;
+	HU_int			*inside;	// the codes of the region found, or NULL
+	long			nodes, budget;	// regions examined, and the limit
+};
+
+// a query box
+typedef struct {
+	const PU_int	*LB, *UB;
+} M_BOX;
+
+/*============================================================================*/
+/*                            M_classify_box				      */
+/*============================================================================*/
+static int M_classify_box( const PU_int *lo, const PU_int *hi, int dims,
+							const void *arg )
+{
+	const M_BOX	*B = (const M_BOX*)arg;
+	int			c = H_INSIDE;
+
+	for (int i = 0; i < dims; i++)
+	{
+		if (hi[i] < B->LB[i] || lo[i] > B->UB[i])
+			return H_OUTSIDE;
+		if (lo[i] < B->LB[i] || hi[i] > B->UB[i])
+			c = H_PARTIAL;
+	}
+	return c;
+}
+
+/*============================================================================*/
+/*                            M_region_descend				      */
+/*============================================================================*/
+// 'depth' bits of the code have been fixed (and set in R.match); they are
+// those of R.key if 'follow' is true
+static bool M_region_descend( M_REGION& R, int depth, bool follow )
+{
+	int		c;
+
+	if ((c = R.classify( R.lo, R.hi, R.DIMS, R.arg )) == H_OUTSIDE)
+		return false;
+	// a region of a single point is either inside or outside
+	if (c == H_INSIDE || depth == R.KEYBITS)
+	{
+		if (R.inside != NULL)
+		{
+			keycopy( R.inside, R.match, R.KEYWORDS );
+			keysetlow( R.inside + R.KEYWORDS, R.match, R.KEYBITS - depth,
+				R.KEYWORDS );
+		}
+		if (follow)
+			keycopy( R.match, R.key, R.KEYWORDS );
+		return true;
+	}
+	if (++R.nodes > R.budget)
+	{
+		// give up, leaving 'inside' empty (see H_nextmatch_region())
+		if (R.inside != NULL)
+		{
+			memset( R.inside, 0xff, sizeof(HU_int) * R.KEYWORDS );
+			memset( R.inside + R.KEYWORDS, 0, sizeof(HU_int) * R.KEYWORDS );
+		}
+		if (follow)
+			keycopy( R.match, R.key, R.KEYWORDS );
+		return true;
+	}
+
+	int		dim = depth % R.DIMS, kbit = R.KEYBITS - 1 - depth;
+	U_int	cmask = (U_int)1 << (R.order - 1 - depth / R.DIMS),
+			lo = R.lo[dim], hi = R.hi[dim],
+			keybit = follow ? R.key[kbit / WORDBITS] >> kbit % WORDBITS & 1 : 0;
+
+	for (U_int bit = keybit; bit <= 1; bit++)
+	{
+		if (bit == 0)
+			R.hi[dim] = hi & ~cmask;
+		else
+		{
+			R.lo[dim] = lo | cmask;
+			R.match[kbit / WORDBITS] |= (U_int)1 << kbit % WORDBITS;
+		}
+
+		if (M_region_descend( R, depth + 1, follow && bit == keybit ))
+			return true;
+
+		R.lo[dim] = lo;
+		R.hi[dim] = hi;
+	}
+	R.match[kbit / WORDBITS] &= ~((U_int)1 << kbit % WORDBITS);
+	return false;
+}
+
+/*============================================================================*/
+/*                            M_nextmatch_region			      */
+/*============================================================================*/
+// as H_nextmatch_region()
+bool M_nextmatch_region( H_CLASSIFY classify, const void *arg,
+		HU_int *match, const HU_int *key, int dimensions, int order,
+		HU_int *inside )
+{
+	M_REGION	R;
+	PU_int		max_coord = order == WORDBITS ? UINT_MAX : ((U_int)1 << order) - 1;
+
+	R.classify = classify;
+	R.arg = arg;
+	R.DIMS = dimensions;
+	R.order = order;
+	R.KEYWORDS = HKEY_WORDS( dimensions, order );
+	R.KEYBITS = dimensions * order;
+	R.match = match;
+	R.key = key;
+	R.inside = inside;
+	R.nodes = 0;
+	R.budget = (long)H_REGION_BUDGET * R.KEYBITS;
+	for (int i = 0; i < dimensions; i++)
+	{
+		R.lo[i] = 0;
+		R.hi[i] = max_coord;
+	}
+	memset( match, 0, sizeof(HU_int) * R.KEYWORDS );
+
+	return M_region_descend( R, 0, true );
+}
+
+/*============================================================================*/
+/*                            M_nextmatch_PM				      */
+/*============================================================================*/
+// as H_nextmatch_PM(): bit (dimensions - 1 - i) of Qsaf is set if coordinate
+// i of the query is specified
+bool M_nextmatch_PM( PU_int *query, HU_int *match, HU_int *key, U_int Qsaf,
+		int dimensions, int order )
+{
+	PU_int	LB[MAXDIMS], UB[MAXDIMS],
+			max_coord = order == WORDBITS ? UINT_MAX : ((U_int)1 << order) - 1;
+	M_BOX	B;
+
+	for (int i = 0; i < dimensions; i++)
+		if (Qsaf >> (dimensions - 1 - i) & 1)
+			LB[i] = UB[i] = query[i];
+		else
+		{
+			LB[i] = 0;
+			UB[i] = max_coord;
+		}
+	B.LB = LB;
+	B.UB = UB;
+	return M_nextmatch_region( M_classify_box, &B, match, key, dimensions,
+			order );
+}
+
+/*============================================================================*/
+/*                            M_nextmatch_RQ_start			      */
+/*============================================================================*/
+// as H_nextmatch_RQ_start(), but only the query box is kept: it is held as
+// the bounds of the first level
+void M_nextmatch_RQ_start( HRQ_STATE& state, const PU_int *LB,
+		const PU_int *UB, int dimensions, int order )
+{
+	state.DIMS = dimensions;
+	state.order = order;
+	state.KEYWORDS = HKEY_WORDS( dimensions, order );
+	state.valid = -1;
+	for (int i = 0; i < dimensions; i++)
+	{
+		state.level[0].LoBound[i] = LB[i];
+		state.level[0].HiBound[i] = UB[i];
+	}
+}
+
+/*============================================================================*/
+/*                            M_nextmatch_RQ				      */
+/*============================================================================*/
+bool M_nextmatch_RQ( HRQ_STATE& state, HU_int *match, HU_int *key )
+{
+	M_BOX	B;
+
+	B.LB = state.level[0].LoBound;
+	B.UB = state.level[0].HiBound;
+	return M_nextmatch_region( M_classify_box, &B, match, key, state.DIMS,
+			state.order );
+}
+
+/*============================================================================*/
+/*                            M_quadrant_split				      */
+/*============================================================================*/
+// as H_quadrant_split(): only Q's depth, box and code are used
+bool M_quadrant_split( const H_QUADRANT& Q, H_QUADRANT *lower,
+		H_QUADRANT *upper, int dimensions, int order )
+{
+	int		dim = Q.depth % dimensions,
+			kbit = dimensions * order - 1 - Q.depth;
+	U_int	cmask;
+
+	if (Q.depth == dimensions * order)
+		return false;
+	cmask = (U_int)1 << (order - 1 - Q.depth / dimensions);
+
+	*lower = *upper = Q;
+	lower->depth = upper->depth = Q.depth + 1;
+	lower->hi[dim] = Q.hi[dim] & ~cmask;
+	upper->lo[dim] = Q.lo[dim] | cmask;
+	upper->key[kbit / WORDBITS] |= (U_int)1 << kbit % WORDBITS;
+	return true;
+}
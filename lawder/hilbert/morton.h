@@ -0,0 +1,18 @@
+// hilbert/morton.h
+
+#ifndef _MORTON_H
+#define _MORTON_H
+
+// the Z-order (Morton) curve: codes occupy HKEY_WORDS( dims, order ) U_ints
+// and are laid out as hilbert codes are, so that the two are interchangeable
+// as keys; the query functions match those of hilbert.h
+HU_int* M_ENCODE( HU_int*, const PU_int* const, int, int order = NUMBITS );
+PU_int* M_DECODE( PU_int*, HU_int*, int, int order = NUMBITS );
+void M_ENCODE_batch( const PU_int* points, size_t n, HU_int* out, int dims, int order = NUMBITS );
+bool M_nextmatch_PM( PU_int *query, HU_int *match, HU_int *key, U_int Qsaf, int dimensions, int order = NUMBITS );
+void M_nextmatch_RQ_start( HRQ_STATE& state, const PU_int *LB, const PU_int *UB, int dimensions, int order = NUMBITS );
+bool M_nextmatch_RQ( HRQ_STATE& state, HU_int *match, HU_int *key );
+bool M_nextmatch_region( H_CLASSIFY classify, const void *arg, HU_int *match, const HU_int *key, int dimensions, int order = NUMBITS, HU_int *inside = NULL );
+bool M_quadrant_split( const H_QUADRANT& Q, H_QUADRANT *lower, H_QUADRANT *upper, int dimensions, int order = NUMBITS );
+
+#endif
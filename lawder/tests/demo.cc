@@ -41,7 +41,7 @@ int main(void)
 	DBASE	*DB;
 	char	c;
 	string	dbname, junk;
-	int	DIMS, bt_node_entries, n_bslots, p_entries;
+	int	DIMS, bt_node_entries, n_bslots, p_entries, order, split;
 
 	cout << "Enter database name : ";
 	cin >> dbname;
@@ -73,8 +73,25 @@ int main(void)
 		cout << "\nEnter size of page (records) (suggested value is 35 - 1500) : ";
 		cin >> p_entries;
 		getline(cin, junk);
+		cout << "\nEnter order of the curve (bits per coordinate) (1 - " << NUMBITS << ") : ";
+		cin >> order;
+		getline(cin, junk);
+		if( order < 1 || order > NUMBITS )
+		{
+			cout << "Invalid order : " << order << "\n";
+			return 0;
+		}
+		cout << "\nEnter page split policy (0 median, 1 append, 2 adaptive) : ";
+		cin >> split;
+		getline(cin, junk);
+		if( split < SPLIT_MEDIAN || split > SPLIT_ADAPTIVE )
+		{
+			cout << "Invalid split policy : " << split << "\n";
+			return 0;
+		}
 
-		DB = new DBASE( dbname, DIMS, bt_node_entries, n_bslots, p_entries );
+		DB = new DBASE( dbname, DIMS, bt_node_entries, n_bslots, p_entries, order,
+			CURVE_HILBERT, false, false, split );
 
 		DB->db_info();
 
@@ -89,7 +106,13 @@ int main(void)
 		cout << "\nEnter size of buffer (pages) (suggested value is 10) : ";
 		cin >> n_bslots;
 		getline(cin, junk);
-		DB = new DBASE( dbname, info[3], info[5], n_bslots, info[4] );
+		if (info[6] == 0)	// the order isn't recorded in older .inf files
+			info[6] = NUMBITS;
+		// (as are the curve, the page format and the split policy, but 0
+		// stands for the hilbert curve, unpacked and unaligned pages of points
+		// only and splits at the median)
+		DB = new DBASE( dbname, info[3], info[5], n_bslots, info[4], info[6],
+			info[7], info[8] != 0, info[9] != 0, info[10], info[11] != 0 );
 
 		DB->db_info();
 
@@ -111,6 +134,7 @@ int main(void)
 			"  4 : dump index to file : " << idxdump << endl <<
 			"  5 : dump database keys to file : " << keydump << endl <<
 			"  6 : dump database to file : " << datadump << endl <<
+			"  7 : show database information, including page fill\n" <<
 			"  > ";
 
 
@@ -125,6 +149,7 @@ int main(void)
 			case '4':  DB->BT.idx_dump( idxdump );     break;	//
 			case '5':  DB->db_key_dump( keydump );     break;	//
 			case '6':  DB->db_data_dump( datadump, 'd' );     break;	//
+			case '7':  DB->db_info();     break;
 
 			default :  cout << "closing database " << dbname << "\n"; DB->db_close();  return 0;
 		}
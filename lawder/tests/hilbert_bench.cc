@@ -0,0 +1,443 @@
+// tests/hilbert_bench.cc
+// Microbenchmarks of the curve kernels: ENCODE, DECODE and the range and
+// partial match next-match functions, swept over the no. of dimensions, the
+// order of the curve, the volume of the query box and the position of the key
+// the next match is sought from.
+//
+// Flags:
+//   [--curve hilbert|morton|all]
+//   [--dims <lo>-<hi>] (default 2-16)
+//   [--orders <o,o,...>] (default 8,16,32)
+//   [--volumes <v,v,...>] (query box volumes as fractions of the space;
+//                          default 1e-6,1e-3,1e-1)
+//   [--positions start,inside,random] (the key each next match is sought from:
+//                          the first code, the code of a point in the box, or
+//                          any code)
+//   [--min_ms <ms>] (the least time each case is run for; default 50)
+//   [--format csv|json] [--out <path>]
+//
+// Each row gives ns/op and, where perf_event_open is permitted, instructions
+// and cache misses per op; counters that could not be read are left empty in
+// csv output and null in json output.
+//
+// Notes:
+//   The objects should be built with the optimizer on for the figures to mean
+//   anything, eg: make -f linux.m OPTIMIZE=-O2 hilbert_bench.exe
+
+#ifdef DEV
+  #include "../gendefs.h"
+  #include "../hilbert/curve.h"
+#else
+  #include "gendefs.h"
+  #include "curve.h"
+#endif
+
+#include <cstdio>
+#include <cmath>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <sstream>
+#include <chrono>
+
+#ifdef __linux__
+  #include <linux/perf_event.h>
+  #include <sys/ioctl.h>
+  #include <sys/syscall.h>
+  #include <unistd.h>
+#endif
+
+using namespace std;
+
+// the no. of distinct inputs each case cycles through
+#define		BENCH_INSTANCES		1024
+
+// ---------------- random numbers ----------------
+static uint64_t rs = 88172645463325252ULL;
+static U_int rnd() { rs ^= rs << 13; rs ^= rs >> 7; rs ^= rs << 17; return (U_int)rs; }
+
+static U_int coord_mask(int order) {
+    return order >= WORDBITS ? 0xFFFFFFFFu : (((U_int)1 << order) - 1);
+}
+
+// ---------------- hardware counters ----------------
+// instructions and cache misses, counted as a group so that both cover the
+// same code; 'ok' is false where the kernel does not allow them
+struct PerfCounters {
+    bool ok = false;
+    int leader = -1, member = -1;
+
+#ifdef __linux__
+    static int open_one(uint64_t config, int group) {
+        struct perf_event_attr pe;
+        memset(&pe, 0, sizeof(pe));
+        pe.type = PERF_TYPE_HARDWARE;
+        pe.size = sizeof(pe);
+        pe.config = config;
+        pe.disabled = (group == -1);
+        pe.exclude_kernel = 1;
+        pe.exclude_hv = 1;
+        pe.read_format = PERF_FORMAT_GROUP;
+        return (int)syscall(__NR_perf_event_open, &pe, 0, -1, group, 0);
+    }
+#endif
+
+    PerfCounters() {
+#ifdef __linux__
+        leader = open_one(PERF_COUNT_HW_INSTRUCTIONS, -1);
+        if (leader < 0) return;
+        member = open_one(PERF_COUNT_HW_CACHE_MISSES, leader);
+        if (member < 0) { close(leader); leader = -1; return; }
+        ok = true;
+#endif
+    }
+    ~PerfCounters() {
+#ifdef __linux__
+        if (member >= 0) close(member);
+        if (leader >= 0) close(leader);
+#endif
+    }
+    void start() {
+#ifdef __linux__
+        if (!ok) return;
+        ioctl(leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+        ioctl(leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+#endif
+    }
+    // instructions and cache misses since start()
+    bool stop(uint64_t* instructions, uint64_t* misses) {
+#ifdef __linux__
+        if (!ok) return false;
+        ioctl(leader, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+        uint64_t buf[3];   // nr, then the values in the order opened
+        if (read(leader, buf, sizeof(buf)) != (ssize_t)sizeof(buf) || buf[0] != 2)
+            return false;
+        *instructions = buf[1];
+        *misses = buf[2];
+        return true;
+#else
+        return false;
+#endif
+    }
+};
+
+// ---------------- one measured case ----------------
+struct Result {
+    string kernel, curve, position;
+    int dims = 0, order = 0, specified = -1;
+    double volume = -1;
+    uint64_t ops = 0;
+    double ns_per_op = 0;
+    bool counted = false;
+    double instr_per_op = 0, misses_per_op = 0;
+};
+
+// runs 'body' (which performs BENCH_INSTANCES ops) until at least min_ms
+// have passed, and fills in the timings of r
+template <class BODY>
+static void measure(Result& r, PerfCounters& perf, double min_ms, BODY body) {
+    body();     // warm up the caches and branch predictors
+    uint64_t instructions = 0, misses = 0;
+    uint64_t rounds = 0;
+    perf.start();
+    auto t0 = chrono::steady_clock::now();
+    double elapsed_ns = 0;
+    do {
+        body();
+        rounds++;
+        elapsed_ns = chrono::duration<double, nano>(chrono::steady_clock::now() - t0).count();
+    } while (elapsed_ns < min_ms * 1e6);
+    r.counted = perf.stop(&instructions, &misses);
+    r.ops = rounds * BENCH_INSTANCES;
+    r.ns_per_op = elapsed_ns / r.ops;
+    if (r.counted) {
+        r.instr_per_op = (double)instructions / r.ops;
+        r.misses_per_op = (double)misses / r.ops;
+    }
+}
+
+// keeps the compiler from discarding the results of the kernels
+static volatile U_int sink;
+
+// ---------------- the kernels ----------------
+static void bench_encode(vector<Result>& out, PerfCounters& perf, const SF_CURVE* crv,
+                         int dims, int order, double min_ms)
+{
+    int words = HKEY_WORDS(dims, order);
+    vector<PU_int> points(BENCH_INSTANCES * dims);
+    vector<HU_int> keys(BENCH_INSTANCES * words);
+    for (auto& c : points) c = rnd() & coord_mask(order);
+
+    Result r;
+    r.kernel = "encode"; r.curve = crv->name; r.dims = dims; r.order = order;
+    measure(r, perf, min_ms, [&]() {
+        for (int i = 0; i < BENCH_INSTANCES; i++) {
+            HU_int* k = &keys[i * words];
+            memset(k, 0, sizeof(HU_int) * words);
+            crv->encode(k, &points[i * dims], dims, order);
+        }
+        sink = keys[0];
+    });
+    out.push_back(r);
+
+    r.kernel = "decode";
+    for (int i = 0; i < BENCH_INSTANCES; i++)
+        crv->encode(&keys[i * words], &points[i * dims], dims, order);
+    measure(r, perf, min_ms, [&]() {
+        for (int i = 0; i < BENCH_INSTANCES; i++) {
+            PU_int* p = &points[i * dims];
+            memset(p, 0, sizeof(PU_int) * dims);
+            crv->decode(p, &keys[i * words], dims, order);
+        }
+        sink = points[0];
+    });
+    out.push_back(r);
+}
+
+// the key that a next match is sought from: 'p' is a point within the query
+static void position_key(HU_int* key, const string& position, const PU_int* p,
+                         const SF_CURVE* crv, int dims, int order)
+{
+    int words = HKEY_WORDS(dims, order);
+    memset(key, 0, sizeof(HU_int) * words);
+    if (position == "inside")
+        crv->encode(key, p, dims, order);
+    else if (position == "random") {
+        vector<PU_int> q(dims);
+        for (auto& c : q) c = rnd() & coord_mask(order);
+        crv->encode(key, q.data(), dims, order);
+    }
+}
+
+static void bench_nextmatch_RQ(vector<Result>& out, PerfCounters& perf, const SF_CURVE* crv,
+                               int dims, int order, double volume,
+                               const string& position, double min_ms)
+{
+    int words = HKEY_WORDS(dims, order);
+    U_int mask = coord_mask(order);
+    // the side of a box of the given volume, in cells
+    double side = pow(volume, 1.0 / dims) * ((double)mask + 1);
+    if (side < 1) side = 1;
+    if (side > (double)mask + 1) side = (double)mask + 1;
+
+    vector<PU_int> LB(BENCH_INSTANCES * dims), UB(BENCH_INSTANCES * dims);
+    vector<HU_int> keys(BENCH_INSTANCES * words), match(words);
+    vector<PU_int> p(dims);
+    for (int i = 0; i < BENCH_INSTANCES; i++) {
+        for (int d = 0; d < dims; d++) {
+            U_int s = (U_int)(side - 1);
+            U_int lo = rnd() & mask;
+            if (lo > mask - s) lo = mask - s;
+            LB[i * dims + d] = lo;
+            UB[i * dims + d] = lo + s;
+            p[d] = lo + (s ? rnd() % s : 0);
+        }
+        position_key(&keys[i * words], position, p.data(), crv, dims, order);
+    }
+
+    Result r;
+    r.kernel = "nextmatch_RQ"; r.curve = crv->name; r.dims = dims; r.order = order;
+    r.volume = volume; r.position = position;
+    HRQ_STATE state;
+    measure(r, perf, min_ms, [&]() {
+        U_int found = 0;
+        for (int i = 0; i < BENCH_INSTANCES; i++) {
+            crv->nextmatch_RQ_start(state, &LB[i * dims], &UB[i * dims], dims, order);
+            found += crv->nextmatch_RQ(state, match.data(), &keys[i * words]);
+        }
+        sink = found;
+    });
+    out.push_back(r);
+}
+
+static void bench_nextmatch_PM(vector<Result>& out, PerfCounters& perf, const SF_CURVE* crv,
+                               int dims, int order, int specified,
+                               const string& position, double min_ms)
+{
+    int words = HKEY_WORDS(dims, order);
+    vector<PU_int> query(BENCH_INSTANCES * dims);
+    vector<U_int> Qsaf(BENCH_INSTANCES);
+    vector<HU_int> keys(BENCH_INSTANCES * words), match(words);
+    vector<PU_int> p(dims);
+    for (int i = 0; i < BENCH_INSTANCES; i++) {
+        for (auto& c : p) c = rnd() & coord_mask(order);
+        // specify a random choice of 'specified' dimensions
+        Qsaf[i] = 0;
+        for (int n = 0; n < specified; ) {
+            int d = rnd() % dims;
+            if (Qsaf[i] & ((U_int)1 << (dims - 1 - d))) continue;
+            Qsaf[i] |= (U_int)1 << (dims - 1 - d);
+            n++;
+        }
+        for (int d = 0; d < dims; d++)
+            query[i * dims + d] = (Qsaf[i] & ((U_int)1 << (dims - 1 - d))) ? p[d] : 0;
+        position_key(&keys[i * words], position, p.data(), crv, dims, order);
+    }
+
+    Result r;
+    r.kernel = "nextmatch_PM"; r.curve = crv->name; r.dims = dims; r.order = order;
+    r.specified = specified; r.position = position;
+    measure(r, perf, min_ms, [&]() {
+        U_int found = 0;
+        for (int i = 0; i < BENCH_INSTANCES; i++)
+            found += crv->nextmatch_PM(&query[i * dims], match.data(), &keys[i * words],
+                                       Qsaf[i], dims, order);
+        sink = found;
+    });
+    out.push_back(r);
+}
+
+// ---------------- output ----------------
+static string fmt(double v) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%.3f", v);
+    return buf;
+}
+
+static void write_csv(FILE* f, const vector<Result>& rows) {
+    fprintf(f, "kernel,curve,dims,order,volume,specified,position,ops,ns_per_op,"
+               "instructions_per_op,cache_misses_per_op\n");
+    for (auto& r : rows) {
+        fprintf(f, "%s,%s,%d,%d,", r.kernel.c_str(), r.curve.c_str(), r.dims, r.order);
+        if (r.volume >= 0) fprintf(f, "%g", r.volume);
+        fprintf(f, ",");
+        if (r.specified >= 0) fprintf(f, "%d", r.specified);
+        fprintf(f, ",%s,%llu,%s,", r.position.c_str(), (unsigned long long)r.ops,
+                fmt(r.ns_per_op).c_str());
+        if (r.counted)
+            fprintf(f, "%s,%s", fmt(r.instr_per_op).c_str(), fmt(r.misses_per_op).c_str());
+        else
+            fprintf(f, ",");
+        fprintf(f, "\n");
+    }
+}
+
+static void write_json(FILE* f, const vector<Result>& rows, bool counters) {
+    fprintf(f, "{\n  \"benchmark\": \"hilbert_bench\",\n  \"perf_counters\": %s,\n"
+               "  \"results\": [\n", counters ? "true" : "false");
+    for (size_t i = 0; i < rows.size(); i++) {
+        const Result& r = rows[i];
+        fprintf(f, "    {\"kernel\": \"%s\", \"curve\": \"%s\", \"dims\": %d, \"order\": %d, ",
+                r.kernel.c_str(), r.curve.c_str(), r.dims, r.order);
+        if (r.volume >= 0) fprintf(f, "\"volume\": %g, ", r.volume);
+        else fprintf(f, "\"volume\": null, ");
+        if (r.specified >= 0) fprintf(f, "\"specified\": %d, ", r.specified);
+        else fprintf(f, "\"specified\": null, ");
+        if (!r.position.empty()) fprintf(f, "\"position\": \"%s\", ", r.position.c_str());
+        else fprintf(f, "\"position\": null, ");
+        fprintf(f, "\"ops\": %llu, \"ns_per_op\": %s, ", (unsigned long long)r.ops,
+                fmt(r.ns_per_op).c_str());
+        if (r.counted)
+            fprintf(f, "\"instructions_per_op\": %s, \"cache_misses_per_op\": %s}",
+                    fmt(r.instr_per_op).c_str(), fmt(r.misses_per_op).c_str());
+        else
+            fprintf(f, "\"instructions_per_op\": null, \"cache_misses_per_op\": null}");
+        fprintf(f, "%s\n", i + 1 < rows.size() ? "," : "");
+    }
+    fprintf(f, "  ]\n}\n");
+}
+
+// ---------------- command line ----------------
+static void usage(const char* prog) {
+    fprintf(stderr,
+      "Usage:\n"
+      "  %s [--curve hilbert|morton|all] [--dims <lo>-<hi>] [--orders <o,o,...>]\n"
+      "         [--volumes <v,v,...>] [--positions start,inside,random]\n"
+      "         [--min_ms <ms>] [--format csv|json] [--out <path>]\n"
+      "Example:\n"
+      "  %s --dims 2-8 --orders 16 --format json --out bench.json\n", prog, prog);
+}
+
+static vector<string> split_list(const string& s) {
+    vector<string> v;
+    stringstream ss(s);
+    string item;
+    while (getline(ss, item, ','))
+        if (!item.empty()) v.push_back(item);
+    return v;
+}
+
+int main(int argc, char** argv) {
+    string curve_name = "hilbert", format = "csv", out_path;
+    int dims_lo = 2, dims_hi = 16;
+    vector<int> orders = {8, 16, 32};
+    vector<double> volumes = {1e-6, 1e-3, 1e-1};
+    vector<string> positions = {"start", "inside", "random"};
+    double min_ms = 50;
+
+    try {
+        for (int i = 1; i < argc; i++) {
+            string a = argv[i];
+            if (a == "--curve" && i + 1 < argc) curve_name = argv[++i];
+            else if (a == "--dims" && i + 1 < argc) {
+                string s = argv[++i];
+                size_t dash = s.find('-');
+                dims_lo = stoi(s.substr(0, dash));
+                dims_hi = dash == string::npos ? dims_lo : stoi(s.substr(dash + 1));
+            }
+            else if (a == "--orders" && i + 1 < argc) {
+                orders.clear();
+                for (auto& o : split_list(argv[++i])) orders.push_back(stoi(o));
+            }
+            else if (a == "--volumes" && i + 1 < argc) {
+                volumes.clear();
+                for (auto& v : split_list(argv[++i])) volumes.push_back(stod(v));
+            }
+            else if (a == "--positions" && i + 1 < argc) positions = split_list(argv[++i]);
+            else if (a == "--min_ms" && i + 1 < argc) min_ms = stod(argv[++i]);
+            else if (a == "--format" && i + 1 < argc) format = argv[++i];
+            else if (a == "--out" && i + 1 < argc) out_path = argv[++i];
+            else if (a == "--help" || a == "-h") { usage(argv[0]); return 0; }
+            else { fprintf(stderr, "Unknown or incomplete arg: %s\n", a.c_str()); usage(argv[0]); return 2; }
+        }
+    } catch (...) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    vector<const SF_CURVE*> curves;
+    if (curve_name == "all")
+        for (int c = 0; c < NUM_CURVES; c++) curves.push_back(SF_curve(c));
+    else if (SF_curve_number(curve_name) >= 0)
+        curves.push_back(SF_curve(SF_curve_number(curve_name)));
+
+    bool bad = curves.empty() || dims_lo < 1 || dims_hi > MAXDIMS || dims_lo > dims_hi
+            || (format != "csv" && format != "json") || min_ms <= 0;
+    for (int o : orders) bad |= o < 1 || o > NUMBITS;
+    for (double v : volumes) bad |= !(v > 0 && v <= 1);
+    for (auto& p : positions) bad |= p != "start" && p != "inside" && p != "random";
+    if (bad) { usage(argv[0]); return 2; }
+
+    PerfCounters perf;
+    if (!perf.ok)
+        fprintf(stderr, "hardware counters unavailable: reporting time only\n");
+
+    vector<Result> rows;
+    for (const SF_CURVE* crv : curves)
+        for (int dims = dims_lo; dims <= dims_hi; dims++)
+            for (int order : orders) {
+                bench_encode(rows, perf, crv, dims, order, min_ms);
+                for (double v : volumes)
+                    for (auto& p : positions)
+                        bench_nextmatch_RQ(rows, perf, crv, dims, order, v, p, min_ms);
+                // partial matches need one dimension unspecified
+                if (dims > 1) {
+                    vector<int> specs = {1, dims / 2, dims - 1};
+                    for (size_t s = 0; s < specs.size(); s++) {
+                        if (s && specs[s] == specs[s - 1]) continue;
+                        for (auto& p : positions)
+                            bench_nextmatch_PM(rows, perf, crv, dims, order, specs[s], p, min_ms);
+                    }
+                }
+            }
+
+    FILE* f = stdout;
+    if (!out_path.empty() && !(f = fopen(out_path.c_str(), "w"))) {
+        fprintf(stderr, "cannot write %s\n", out_path.c_str());
+        return 1;
+    }
+    if (format == "json") write_json(f, rows, perf.ok);
+    else write_csv(f, rows);
+    if (f != stdout) fclose(f);
+    return 0;
+}
@@ -13,6 +13,36 @@
 //   [--vec_already_ms] (do not multiply Vec by 1000)
 //   [--json <path>]
 //   [--fp_counts_json <path>]
+//   [--ball] (answer the sphere with the engine's ball query instead of
+//             covering it with boxes)
+//   [--knn <k>] (also list the k stored points nearest to the query node,
+//                with no RTT threshold involved)
+//   [--curve hilbert|morton] (the curve the DB is built on; a morton DB is
+//                kept in its own files)
+//   [--page_keys] (build the DB with each record's key kept on its page, so
+//                  that page splits need not re-encode; kept in its own files)
+//   [--columns] (range queries test a page's points a dimension at a time,
+//                several points at once)
+//   [--packed] (build the DB with its pages packed on disk to ORDER bits per
+//               coordinate; kept in its own files)
+//   [--split median|append|adaptive] (how full pages are split while the DB
+//                                     is built; kept in its own files)
+//   [--page_bytes <n>] (build the DB with as many points per page as fit in
+//                       n bytes on disk, rather than 200; kept in its own files)
+//   [--aligned] (build the DB with its pages padded on disk to a power of two
+//                multiple of 4 KiB; kept in its own files)
+//   [--direct] (read and write an aligned DB's pages with O_DIRECT, bypassing
+//               the kernel's page cache)
+//   [--load] (build the DB by sorting the points and loading them page by
+//             page, the index built bottom-up, rather than inserting them one
+//             by one; kept in its own files)
+//   [--delete_check] (also build a scratch DB with the same settings, insert
+//                     points in ascending key order, so that the split policy
+//                     splits the last page, then delete them in descending
+//                     order, checking which are still found)
+//   [--slab] (also check region queries on slabs across dimension 0 at the
+//             query point, one between two grid lines, which holds no point,
+//             and one across a grid line, against a brute-force scan)
 //
 // Notes:
 //   Hilbert order k implies 2^k cells per axis.
@@ -54,6 +84,9 @@
 #include <cstdint>
 
 #include "../tests/third-party/json.hpp"
+
+// counted by the buffer since the DB was opened
+extern int Pages_retrieved, Disk_reads;
 using json = nlohmann::json;
 using namespace std;
 
@@ -96,6 +129,11 @@ static void usage(const char* prog) {
       << "         [--vec_already_ms]\n"
       << "         [--json <path>]\n"
       << "         [--fp_counts_json <path>]\n"
+      << "         [--ball] [--knn <k>] [--curve hilbert|morton] [--page_keys]\n"
+      << "         [--columns] [--packed] [--split median|append|adaptive]\n"
+      << "         [--page_bytes <n>] [--aligned] [--direct] [--load]\n"
+      << "         [--delete_check]\n"
+      << "         [--slab]\n"
       << "Example:\n"
       << "  " << prog << " --json cluster-status-15012026.json --qnode clab-nebula-serf1 --rtt 15 --horder 10 --fp_counts_json fp_counts.json\n";
 }
@@ -311,6 +349,19 @@ int main(int argc, char** argv) {
     int step = 3;
     bool debug = false;
     bool vec_already_ms = false;
+    bool native_ball = false;
+    int knn_k = 0;
+    std::string curve_name = "hilbert";
+    bool page_keys = false;
+    bool columns = false;
+    bool packed = false;
+    std::string split_name = "median";
+    int page_bytes = 0;
+    bool aligned = false;
+    bool direct = false;
+    bool slab = false;
+    bool load = false;
+    bool delete_check = false;
 
     std::string input_json = "cluster-status-15012026.json";
     std::string fp_counts_json;
@@ -324,13 +375,32 @@ int main(int argc, char** argv) {
         else if (a == "--step" && i + 1 < argc) step = std::stoi(argv[++i]);
         else if (a == "--debug") debug = true;
         else if (a == "--vec_already_ms") vec_already_ms = true;
+        else if (a == "--ball") native_ball = true;
+        else if (a == "--knn" && i + 1 < argc) knn_k = std::stoi(argv[++i]);
+        else if (a == "--curve" && i + 1 < argc) curve_name = argv[++i];
+        else if (a == "--page_keys") page_keys = true;
+        else if (a == "--columns") columns = true;
+        else if (a == "--packed") packed = true;
+        else if (a == "--split" && i + 1 < argc) split_name = argv[++i];
+        else if (a == "--page_bytes" && i + 1 < argc) page_bytes = std::stoi(argv[++i]);
+        else if (a == "--aligned") aligned = true;
+        else if (a == "--direct") direct = true;
+        else if (a == "--slab") slab = true;
+        else if (a == "--load") load = true;
+        else if (a == "--delete_check") delete_check = true;
         else if (a == "--json" && i + 1 < argc) input_json = argv[++i];
         else if (a == "--fp_counts_json" && i + 1 < argc) fp_counts_json = argv[++i];
         else if (a == "--help" || a == "-h") { usage(argv[0]); return 0; }
         else { std::cerr << "Unknown or incomplete arg: " << a << "\n"; usage(argv[0]); return 2; }
     }
 
-    if (qname.empty() || T_ms < 0 || ORDER < 1 || ORDER > 30 || step < 1 || step > 3) {
+    const int curve_no = SF_curve_number(curve_name);
+    const int split = split_name == "median" ? SPLIT_MEDIAN :
+                      split_name == "append" ? SPLIT_APPEND :
+                      split_name == "adaptive" ? SPLIT_ADAPTIVE : -1;
+
+    if (qname.empty() || T_ms < 0 || ORDER < 1 || ORDER > 30 || step < 1 || step > 3 ||
+        curve_no < 0 || split < 0 || page_bytes < 0) {
         usage(argv[0]);
         return 2;
     }
@@ -415,6 +485,13 @@ int main(int argc, char** argv) {
     const double cell_size_ms = latency_max / denom;
 
     std::string dbname = "serfdb_o" + std::to_string(ORDER);
+    if (curve_no != CURVE_HILBERT) dbname += "_" + curve_name;
+    if (page_keys) dbname += "_keys";
+    if (packed) dbname += "_packed";
+    if (split != SPLIT_MEDIAN) dbname += "_" + split_name;
+    if (page_bytes) dbname += "_pb" + std::to_string(page_bytes);
+    if (aligned) dbname += "_aligned";
+    if (load) dbname += "_load";
 
     cout << "DB name: " << dbname << " (ORDER=" << ORDER << ", GRID_MAX=" << ((1u<<ORDER)-1u) << ")\n";
     cout << "latency_max(ms): " << latency_max << "\n";
@@ -480,7 +557,7 @@ int main(int argc, char** argv) {
     const int DIMS = 5;
     const int BT_NODE_ENTRIES = 10;
     const int BUFFER_PAGES = 10;
-    const int PAGE_RECORDS = 200;
+    int PAGE_RECORDS = 200;
 
     bool db_exists =
         file_exists(dbname + ".db") &&
@@ -492,9 +569,28 @@ int main(int argc, char** argv) {
         remove((dbname + ".idx").c_str());
         remove((dbname + ".inf").c_str());
         remove((dbname + ".fpl").c_str());
+        remove((dbname + ".mbr").c_str());
+    }
+
+    // a new DB uses a curve of order ORDER, which covers GRID_MAX; an existing
+    // one is opened with the order recorded in its .inf file (older files
+    // don't record it and were built on the full order curve)
+    int db_order = ORDER;
+    if (!(rebuild || !db_exists)) {
+        int info[INF_SIZE] = {0};
+        ifstream f((dbname + ".inf").c_str(), ios::in | ios::binary);
+        f.read(reinterpret_cast<char*>(info), sizeof(info[0]) * INF_SIZE);
+        db_order = info[6] ? info[6] : NUMBITS;
+        PAGE_RECORDS = info[4];
+    }
+    else if (page_bytes) {
+        PAGE_RECORDS = DBASE::db_page_records(page_bytes, DIMS, db_order, page_keys, packed);
+        if (PAGE_RECORDS == 0) { cerr << "--page_bytes " << page_bytes << " is too small\n"; return 2; }
     }
 
-    DBASE* DB = new DBASE(dbname, DIMS, BT_NODE_ENTRIES, BUFFER_PAGES, PAGE_RECORDS);
+    DBASE* DB = new DBASE(dbname, DIMS, BT_NODE_ENTRIES, BUFFER_PAGES, PAGE_RECORDS, db_order,
+                          curve_no, page_keys, packed, split, aligned);
+    DB->db_direct_io(direct);
 
     if (rebuild || !db_exists) {
         cout << "Creating new DB files...\n";
@@ -502,18 +598,84 @@ int main(int argc, char** argv) {
     }
 
     if (!DB->db_open()) { cerr << "DB open failed\n"; delete DB; return 1; }
+    DB->db_range_columns(columns);
 
     if (rebuild || !db_exists) {
-        int inserted = 0;
-        for (size_t i=0; i<N; i++) {
-            PU_int p[5]; for (int d=0; d<5; d++) p[d] = pts[i][d];
-            if (!DB->db_data_insert(p)) {
-                cerr << "Insert failed for " << names[i] << "\n";
-                DB->db_close(); delete DB; return 1;
+        // encode the whole dataset in one batch
+        vector<PU_int> flat(N * 5);
+        for (size_t i=0; i<N; i++)
+            for (int d=0; d<5; d++) flat[i*5 + d] = pts[i][d];
+        if (load) {
+            int loaded = DB->db_data_load(flat.data(), (int)N);
+            cout << "Loaded " << loaded << " points into DB\n";
+            // every point must be found through the index built over the pages
+            size_t present = 0;
+            for (size_t i=0; i<N; i++)
+                if (DB->db_data_present(&flat[i*5])) present++;
+            cout << "VALIDATION load: present=" << present << " of " << N << "\n";
+        } else {
+            int inserted = DB->db_data_insert_batch(flat.data(), (int)N);
+            cout << "Inserted " << inserted << " points into DB\n";
+        }
+    }
+
+    if (delete_check) {
+        // pseudo-random points in ascending key order: under SPLIT_APPEND or
+        // SPLIT_ADAPTIVE each split leaves the last page with few records, so
+        // the first deletions from it must not undo the split (or, with two
+        // pages, find no page to merge with)
+        const string cname = dbname + "_delcheck";
+        const char* exts[] = {".db", ".idx", ".inf", ".fpl", ".mbr"};
+        // one split, which leaves two pages, and many
+        const int sizes[] = {PAGE_RECORDS, 20 * PAGE_RECORDS};
+        for (int M : sizes) {
+            for (const char* e : exts) remove((cname + e).c_str());
+            const int kw = HKEY_WORDS(5, db_order);
+            const SF_CURVE* crv = SF_curve(curve_no);
+            vector<PU_int> cp(M * 5);
+            vector<HU_int> ck(M * kw);
+            vector<int> order_idx(M);
+            unsigned long long rs = 88172645463325252ULL;
+            for (int i=0; i<M; i++) {
+                for (int d=0; d<5; d++) {
+                    rs = rs * 6364136223846793005ULL + 1442695040888963407ULL;
+                    cp[i*5 + d] = (PU_int)((rs >> 33) & GRID_MAX);
+                }
+                crv->encode(&ck[i*kw], &cp[i*5], 5, db_order);
+                order_idx[i] = i;
+            }
+            sort(order_idx.begin(), order_idx.end(), [&](int a, int b) {
+                for (int w=kw-1; w>=0; w--)
+                    if (ck[a*kw + w] != ck[b*kw + w]) return ck[a*kw + w] < ck[b*kw + w];
+                return a < b;
+            });
+
+            DBASE* CD = new DBASE(cname, DIMS, BT_NODE_ENTRIES, BUFFER_PAGES, PAGE_RECORDS, db_order,
+                                  curve_no, page_keys, packed, split, aligned);
+            if (!CD->db_create() || !CD->db_open()) { cerr << "delete check DB create failed\n"; delete CD; return 1; }
+            vector<bool> in(M, false);
+            for (int i=0; i<M; i++)
+                if (CD->db_data_insert(&cp[order_idx[i]*5]) != ALREADY_PRESENT) in[order_idx[i]] = true;
+            const int pages = CD->nextPID - CD->NumFreePages;
+
+            // delete the last point, then half of them, then all, from the top
+            long wrong = 0;
+            int deleted = 0;
+            const int stops[] = {1, M / 2, M};
+            for (int stop : stops) {
+                for ( ; deleted < stop; deleted++) {
+                    int j = order_idx[M - 1 - deleted];
+                    if (in[j]) { CD->db_data_delete(&cp[j*5]); in[j] = false; }
+                }
+                for (int i=0; i<M; i++)
+                    if (CD->db_data_present(&cp[i*5]) != (bool)in[i]) wrong++;
             }
-            inserted++;
+            cout << "VALIDATION delete after " << split_name << " splits: points=" << M
+                 << " pages=" << pages << " wrong=" << wrong << "\n";
+            CD->db_close();
+            delete CD;
+            for (const char* e : exts) remove((cname + e).c_str());
         }
-        cout << "Inserted " << inserted << " points into DB\n";
     }
 
     const double r_cont = (double)T_ms / cell_size_ms;
@@ -552,16 +714,113 @@ int main(int argc, char** argv) {
     QueryStats qs_cover;
     CoverStats st;
 
-    coverSphere5D_indexed(DB, ORDER, center_ms, T_ms, cell_size_ms,
-                          point_to_names, qname, hilbert_set, hilbert_names,
-                          root_lo, root_hi, 0, st, qs_cover);
+    // pages fetched from the buffer (and read from disk) by the query itself
+    const int pages_before = Pages_retrieved, reads_before = Disk_reads;
 
-    cout << "Cover stats:\n";
-    cout << "  visited=" << st.visited
-         << " pruned_outside=" << st.pruned_outside
-         << " pruned_empty=" << st.pruned_empty
-         << " accepted_inside=" << st.accepted_inside
-         << " accepted_leaf=" << st.accepted_leaf << "\n";
+    if (native_ball) {
+        // one ball query in grid units: the engine prunes sub-quadrants
+        // against the sphere and reads each page at most once
+        PU_int C[5], result[5];
+        for (int d=0; d<5; d++) C[d] = pts[qi][d];
+
+        int set_id = -1;
+        if (true == DB->db_ball_open_set(C, (double)r_cells, &set_id)) {
+            qs_cover.open_ok++;
+            while (true == DB->db_ball_fetch_another(set_id, result)) {
+                qs_cover.fetched_rows++;
+
+                array<PU_int,5> rp = {result[0],result[1],result[2],result[3],result[4]};
+                auto itp = point_to_names.find(point_key(rp));
+                if (itp == point_to_names.end()) continue;
+                for (const string& nm : itp->second) {
+                    if (nm == qname) continue;
+                    if (hilbert_set.emplace(nm,1).second) hilbert_names.push_back(nm);
+                    qs_cover.matched_names++;
+                }
+            }
+            DB->db_close_set(set_id);
+        } else {
+            qs_cover.open_fail++;
+        }
+
+        cout << "Ball query stats:\n";
+        cout << "  fetched_rows=" << qs_cover.fetched_rows
+             << " matched_names=" << qs_cover.matched_names << "\n";
+    } else {
+        coverSphere5D_indexed(DB, ORDER, center_ms, T_ms, cell_size_ms,
+                              point_to_names, qname, hilbert_set, hilbert_names,
+                              root_lo, root_hi, 0, st, qs_cover);
+
+        cout << "Cover stats:\n";
+        cout << "  visited=" << st.visited
+             << " pruned_outside=" << st.pruned_outside
+             << " pruned_empty=" << st.pruned_empty
+             << " accepted_inside=" << st.accepted_inside
+             << " accepted_leaf=" << st.accepted_leaf << "\n";
+    }
+    cout << "Pages retrieved (" << curve_name << "): " << Pages_retrieved - pages_before
+         << " disk_reads=" << Disk_reads - reads_before << "\n";
+
+    if (knn_k > 0) {
+        // nearest stored points first; the query node's own point is among
+        // them, and several nodes may share a point
+        PU_int C[5];
+        for (int d=0; d<5; d++) C[d] = pts[qi][d];
+        vector<PU_int> knn_pts((size_t)knn_k * 5);
+        vector<double> knn_dist(knn_k);
+        int n = DB->db_knn(C, knn_k, knn_pts.data(), knn_dist.data());
+
+        cout << "Nearest " << n << " points (distance in ms):\n";
+        for (int i=0; i<n; i++) {
+            array<PU_int,5> rp = {knn_pts[i*5],knn_pts[i*5+1],knn_pts[i*5+2],
+                                  knn_pts[i*5+3],knn_pts[i*5+4]};
+            auto itp = point_to_names.find(point_key(rp));
+            if (itp == point_to_names.end()) continue;
+            for (const string& nm : itp->second)
+                cout << "  " << nm << "  dist=" << knn_dist[i] * cell_size_ms << "\n";
+        }
+    }
+
+    if (slab) {
+        // x0 within [lo, hi]: a polytope of two faces. A slab between two
+        // grid lines leaves the engine no sub-quadrant inside it, so its
+        // descent is cut short and the pages it finds are tested point by
+        // point
+        const double bounds[2][2] = {
+            { pts[qi][0] + 0.4, pts[qi][0] + 0.6 },
+            { pts[qi][0] - 0.5, pts[qi][0] + 0.5 } };
+        for (int s = 0; s < 2; s++) {
+            double a[2 * 5] = {0}, b[2] = { bounds[s][1], -bounds[s][0] };
+            a[0] = 1.0;
+            a[5] = -1.0;
+            H_POLYTOPE T;
+            T.faces = 2;
+            T.a = a;
+            T.b = b;
+
+            unordered_map<string,int> got, expect;
+            PU_int result[5];
+            int set_id = -1, fetched = 0;
+            if (true == DB->db_region_open_set(H_classify_polytope, &T, &set_id)) {
+                while (true == DB->db_region_fetch_another(set_id, result)) {
+                    array<PU_int,5> rp = {result[0],result[1],result[2],result[3],result[4]};
+                    got.emplace(point_key(rp), 1);
+                    fetched++;
+                }
+                DB->db_close_set(set_id);
+            }
+            for (size_t i=0; i<N; i++)
+                if (pts[i][0] >= bounds[s][0] && pts[i][0] <= bounds[s][1])
+                    expect.emplace(point_key(pts[i]), 1);
+
+            int missing = 0, extra = 0;
+            for (auto& kv : expect) if (got.find(kv.first) == got.end()) missing++;
+            for (auto& kv : got) if (expect.find(kv.first) == expect.end()) extra++;
+            cout << "VALIDATION slab " << bounds[s][0] << " <= x0 <= " << bounds[s][1]
+                 << ": fetched=" << fetched << " expected=" << expect.size()
+                 << " missing=" << missing << " extra=" << extra << "\n";
+        }
+    }
 
     cout << "Hilbert result count (excluding self): " << hilbert_names.size() << "\n";
     for (const string& nm : hilbert_names) {
@@ -8,18 +8,17 @@
 #else
 	#include "../gendefs.h"
 #endif
+#include "utils.h"
 
 
 /*============================================================================*/
 /*                            Hcode::Hcode                         	      */
 /*============================================================================*/
-Hcode::Hcode( int dims )
+Hcode::Hcode( int kwords ) : words( kwords )
 {
-	for ( int i = 0; i < dims; i++ )
-		hcode.push_back( (U_int)0 );
-/*	for ( int i = 0; i < dims; i++ )
-		cout << hcode[i];
-	cout << endl;*/
+	if ( kwords < 1 || kwords > HKEY_MAX_WORDS )
+		errorexit( "Hcode: key size out of range\n" );
+	memset( hcode, 0, words * sizeof(U_int) );
 }
 
 /*============================================================================*/
@@ -38,7 +37,7 @@ void keycopy ( HU_int *destination, const HU_int * const source, const int dim )
 /*============================================================================*/
 void keycopy ( HU_int *destination, const Hcode& source )
 {
-	for ( int i = source.hcode.size() - 1; i >= 0; i-- )
+	for ( int i = source.words - 1; i >= 0; i-- )
 	{
 		destination[i] = source.hcode[i];
 	}
@@ -49,11 +48,46 @@ void keycopy ( HU_int *destination, const Hcode& source )
 /*============================================================================*/
 void keycopy ( Hcode& destination, const HU_int * const source )
 {
-	for ( int i = destination.hcode.size() - 1; i >= 0; i-- )
+	for ( int i = destination.words - 1; i >= 0; i-- )
 	{
 		destination.hcode[i] = source[i];
 	}
 }
+
+/*============================================================================*/
+/*                            keysetlow                          	      */
+/*============================================================================*/
+// copies a key of 'words' U_ints, setting its lowest 'bits' bits: if the bits
+// above them are those of a region of the curve, the result is the highest
+// code in the region
+void keysetlow ( HU_int *destination, const HU_int * const source,
+	int bits, const int words )
+{
+	for ( int i = 0; i < words; i++, bits -= WORDBITS )
+	{
+		if ( bits >= WORDBITS )
+			destination[i] = UINT_MAX;
+		else if ( bits > 0 )
+			destination[i] = source[i] | (((U_int)1 << bits) - 1);
+		else
+			destination[i] = source[i];
+	}
+}
+
+/*============================================================================*/
+/*                            keycmp                          	      */
+/*============================================================================*/
+// compares two keys of 'words' U_ints, the most significant last: returns
+// < 0, 0 or > 0 as a is less than, equal to or greater than b
+int keycmp ( const HU_int * const a, const HU_int * const b, const int words )
+{
+	for ( int i = words - 1; i >= 0; i-- )
+	{
+		if ( a[i] != b[i] )
+			return a[i] < b[i] ? -1 : 1;
+	}
+	return 0;
+}
  #if 0
         /*============================================================================*/
         /*                            getstorage				      */
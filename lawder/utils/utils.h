@@ -8,6 +8,8 @@ void	errorexit( string );
 void	keycopy( HU_int*, const HU_int* const, const int );
 void	keycopy( HU_int*, const Hcode& );
 void	keycopy( Hcode&, const HU_int* const );
+void	keysetlow( HU_int*, const HU_int* const, int, const int );
+int	keycmp( const HU_int* const, const HU_int* const, const int );
 char	*int2bins( unsigned int, int );
 
 #endif
\ No newline at end of file